@@ -0,0 +1,437 @@
+/********************************************************************************
+ * MOSES telemetry downlink benchmark
+ *
+ * Runs the full read -> frame -> write pipeline of sendTM against a backend
+ * that needs no flight hardware, so throughput regressions show up on a
+ * desk rather than at White Sands:
+ *
+ *   null  /dev/null, the cost of the pipeline alone
+ *   pty   a pseudo-terminal drained by a second thread, adds the tty layer
+ *   loop  a SyncLink in internal loopback (params.loopback = 1), the real
+ *         driver and USB path without a receiver on the far end
+ *
+ * Each run queues the same file a number of times and ends with a
+ * machine-readable line:
+ *
+ *   BENCH backend=<b> source=<read|mmap> file_bytes=<n> chunk_bytes=<n>
+ *         fec=<k>,<m> ratio=<x> files=<n> MBps=<x> syscr_per_MB=<x>
+ *         syscw_per_MB=<x> cpu_pct=<x> maxrss_kB=<n>
+ *
+ * System call counts come from /proc/self/io. Reads done by the pty or
+ * loopback drain thread are not counted, so the figures cover the sending
+ * side only. MBps counts bytes on the link, so with -z it is the compressed
+ * rate and ratio says how much file data that carried. CPU time covers the
+ * run itself and peak RSS the whole process, mapped file pages included.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE //posix_openpt()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <termios.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "synclink.h"
+#include "device.h"
+#include "pipeline.h"
+#include "stats.h"
+
+#define BENCH_NULL 0
+#define BENCH_PTY 1
+#define BENCH_LOOP 2
+
+/*Default test file: one full MOSES image*/
+#define BENCH_FILE_SIZE 16777200
+#define BENCH_FILES 4
+
+/*Receiving end of the pty or loopback backend*/
+struct bench_drain {
+    int fd;
+    int stop;
+    unsigned long reads;        //read() calls, taken off the syscall count
+    unsigned long long bytes;
+    pthread_t thread;
+};
+
+void display_usage(void) {
+    printf("Usage: sendtm-bench [-b null|pty|loop] [-m read|mmap] [-s bytes] [-c frames]\n"
+            "                    [-F bytes] [-n files] [-e k,m] [-z] [-C sel] [-f file]\n"
+            "                    [-t dir] [-P prio] [-L] <devname>\n"
+            "-b = backend (default null). loop uses devname, default /dev/ttyUSB0\n"
+            "-m = source of the frames (default mmap)\n"
+            "-s = size of the generated test file (default %d)\n"
+            "-c = frames per chunk, the unit of each read from disk (default %d)\n"
+            "-F = payload bytes per HDLC frame (default %d)\n"
+            "-n = times the file is queued (default %d)\n"
+            "-e = add m FEC parity frames to every k data frames (default off)\n"
+            "-z = compress every queued file (default off)\n"
+            "-C = send only the selected ROE channels of every queued file, see roe.h\n"
+            "-f = benchmark an existing file instead of generating one\n"
+            "-t = directory for the generated test file (default /tmp)\n"
+            "-P = run the transmit thread under SCHED_FIFO at prio, see rt.h (default off)\n"
+            "-L = lock the process's memory before the run (default off)\n",
+            BENCH_FILE_SIZE, TM_FRAMES_PER_CHUNK, TM_FRAME_SIZE, BENCH_FILES);
+}
+
+/*Read and write system calls made by this process so far*/
+static int read_syscalls(unsigned long long *syscr, unsigned long long *syscw) {
+
+    char line[128];
+    FILE *fp;
+
+    fp = fopen("/proc/self/io", "r");
+    if (fp == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof (line), fp) != NULL) {
+        sscanf(line, "syscr: %llu", syscr);
+        sscanf(line, "syscw: %llu", syscw);
+    }
+    fclose(fp);
+
+    return 0;
+}
+
+/*Write a test file of size bytes with a pattern that is not all zero pages*/
+static int make_file(char *path, long size) {
+
+    unsigned char buf[65536];
+    long left;
+    size_t i, n;
+    int fd;
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        printf("mkstemp(%s) error=%d %s\n", path, errno, strerror(errno));
+        return -1;
+    }
+
+    for (i = 0; i < sizeof (buf); i++) {
+        buf[i] = (unsigned char) (i * 131 + (i >> 8));
+    }
+    for (left = size; left > 0; left -= n) {
+        n = (left < (long) sizeof (buf)) ? (size_t) left : sizeof (buf);
+        if (write(fd, buf, n) != (ssize_t) n) {
+            printf("write(%s) error=%d %s\n", path, errno, strerror(errno));
+            close(fd);
+            unlink(path);
+            return -1;
+        }
+    }
+    close(fd);
+
+    return 0;
+}
+
+static void *drain_thread(void *arg) {
+
+    struct bench_drain *d = arg;
+    static unsigned char buf[HDLC_MAX_FRAME_SIZE];
+    struct pollfd pfd;
+    ssize_t rc;
+
+    pfd.fd = d->fd;
+    pfd.events = POLLIN;
+
+    while (!d->stop) {
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+        rc = read(d->fd, buf, sizeof (buf));
+        d->reads++;
+        if (rc > 0) {
+            d->bytes += rc;
+        } else if (rc < 0 && errno != EINTR && errno != EAGAIN) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/*Open a raw pty. The pipeline writes the slave, the drain thread reads the master*/
+static int open_pty(int *master, int *slave) {
+
+    struct termios tio;
+
+    *master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (*master < 0 || grantpt(*master) < 0 || unlockpt(*master) < 0) {
+        printf("posix_openpt error=%d %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    *slave = open(ptsname(*master), O_RDWR | O_NOCTTY);
+    if (*slave < 0) {
+        printf("open(%s) error=%d %s\n", ptsname(*master), errno, strerror(errno));
+        close(*master);
+        return -1;
+    }
+
+    tcgetattr(*slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(*slave, TCSANOW, &tio);
+
+    return 0;
+}
+
+/*Program entry point*/
+int main(int argc, char **argv) {
+
+    int rc, j, opt;
+    int backend = BENCH_NULL;
+    int source = TM_SOURCE_MMAP;
+    long file_size = BENCH_FILE_SIZE;
+    int frames_per_chunk = TM_FRAMES_PER_CHUNK;
+    long frame_size = TM_FRAME_SIZE;
+    int nfiles = BENCH_FILES;
+    int fec_k = 0, fec_m = 0;
+    int compress = 0;
+    int rt_priority = 0;
+    int lock_memory = 0;
+    struct tm_roe_select select;
+    int selected = 0;
+    char *filename = NULL;
+    const char *tmpdir = "/tmp";
+    char *devname = "/dev/ttyUSB0";
+    char tmpname[4096];
+    int master = -1, fd = -1;
+    unsigned long long syscr0 = 0, syscw0 = 0, syscr1 = 0, syscw1 = 0;
+    struct timespec t0;
+    struct rusage ru0, ru;
+    double wall, cpu, mb;
+    struct tm_device dev;
+    struct tm_pipeline pl;
+    struct tm_pool pool;
+    struct tm_queue queue;
+    struct tm_stats stats;
+    struct tm_flow flow;
+    struct tm_fec_code fec;
+    struct bench_drain drain;
+
+    while ((opt = getopt(argc, argv, "b:m:s:c:F:n:e:zC:f:t:P:L")) != -1) {
+        switch (opt) {
+            case 'b':
+                if (strcmp(optarg, "null") == 0) {
+                    backend = BENCH_NULL;
+                } else if (strcmp(optarg, "pty") == 0) {
+                    backend = BENCH_PTY;
+                } else if (strcmp(optarg, "loop") == 0) {
+                    backend = BENCH_LOOP;
+                } else {
+                    display_usage();
+                    return 1;
+                }
+                break;
+            case 'm':
+                source = (strcmp(optarg, "read") == 0) ? TM_SOURCE_READ : TM_SOURCE_MMAP;
+                break;
+            case 's':
+                file_size = atol(optarg);
+                break;
+            case 'c':
+                frames_per_chunk = atoi(optarg);
+                break;
+            case 'F':
+                frame_size = atol(optarg);
+                break;
+            case 'n':
+                nfiles = atoi(optarg);
+                break;
+            case 'e':
+                if (sscanf(optarg, "%d,%d", &fec_k, &fec_m) != 2) {
+                    display_usage();
+                    return 1;
+                }
+                break;
+            case 'z':
+                compress = 1;
+                break;
+            case 'C':
+                if (roe_parse_select(&select, optarg) < 0) {
+                    display_usage();
+                    return 1;
+                }
+                selected = 1;
+                break;
+            case 'f':
+                filename = optarg;
+                break;
+            case 't':
+                tmpdir = optarg;
+                break;
+            case 'P':
+                rt_priority = atoi(optarg);
+                break;
+            case 'L':
+                lock_memory = 1;
+                break;
+            default:
+                display_usage();
+                return 1;
+        }
+    }
+    if (optind < argc) {
+        devname = argv[optind];
+    }
+    if (file_size <= 0 || frames_per_chunk <= 0 || frame_size <= 0 || nfiles <= 0) {
+        display_usage();
+        return 1;
+    }
+
+    /*Test file, generated unless an existing one was given*/
+    if (filename == NULL) {
+        snprintf(tmpname, sizeof (tmpname), "%s/sendtm-bench.XXXXXX", tmpdir);
+        if (make_file(tmpname, file_size) < 0) {
+            return 1;
+        }
+        filename = tmpname;
+    } else {
+        fd = open(filename, O_RDONLY);
+        if (fd < 0) {
+            printf("open(%s) error=%d %s\n", filename, errno, strerror(errno));
+            return 1;
+        }
+        file_size = lseek(fd, 0, SEEK_END);
+        close(fd);
+        fd = -1;
+    }
+
+    if (fec_k > 0 && fec_code_init(&fec, fec_k, fec_m) < 0) {
+        return 1;
+    }
+
+    queue_init(&queue);
+    for (j = 0; j < nfiles; j++) {
+        queue_push(&queue, filename, (int) file_size, TM_PRIO_SCIENCE,
+                (compress ? TM_FILE_COMPRESS : 0) | (selected ? TM_FILE_SELECT : 0));
+    }
+    queue_close(&queue);
+
+    rc = pool_init(&pool, TM_POOL_BUFFERS, frame_size * frames_per_chunk);
+    if (rc < 0) {
+        printf("Unable to allocate %d transmit buffers\n", TM_POOL_BUFFERS);
+        goto out;
+    }
+
+    /*Backend*/
+    memset(&drain, 0, sizeof (drain));
+    memset(&pl, 0, sizeof (pl));
+    if (backend == BENCH_NULL) {
+        fd = open("/dev/null", O_WRONLY);
+        if (fd < 0) {
+            printf("open(/dev/null) error=%d %s\n", errno, strerror(errno));
+            rc = -1;
+            goto out_pool;
+        }
+    } else if (backend == BENCH_PTY) {
+        rc = open_pty(&master, &fd);
+        if (rc < 0) {
+            goto out_pool;
+        }
+        drain.fd = master;
+    } else {
+        device_defaults(&dev, devname);
+        dev.params.loopback = 1; //Transmit data comes straight back to the receiver
+        rc = device_open(&dev);
+        if (rc < 0) {
+            goto out_pool;
+        }
+        fd = dev.fd;
+        drain.fd = dev.fd;
+
+        flow_init(&flow, fd, dev.params.clock_speed, frame_size);
+        pl.flow = &flow;
+    }
+
+    if (backend != BENCH_NULL) {
+        rc = pthread_create(&drain.thread, NULL, drain_thread, &drain);
+        if (rc != 0) {
+            printf("pthread_create(drain) error=%d %s\n", rc, strerror(rc));
+            goto out_backend;
+        }
+    }
+
+    stats_init(&stats);
+
+    pl.fd = fd;
+    pl.frame_size = frame_size;
+    pl.source = source;
+    pl.pool = &pool;
+    pl.queue = &queue;
+    pl.stats = &stats;
+    pl.fec = (fec_k > 0) ? &fec : NULL;
+    pl.compress = compress;
+    pl.select = selected ? &select : NULL;
+    pl.rt_priority = rt_priority;
+    pl.lock_memory = lock_memory;
+
+    read_syscalls(&syscr0, &syscw0);
+    getrusage(RUSAGE_SELF, &ru0);
+    stats_now(&t0);
+
+    rc = pipeline_run(&pl);
+
+    wall = stats_usec_since(&t0) / 1e6;
+    read_syscalls(&syscr1, &syscw1);
+    getrusage(RUSAGE_SELF, &ru);
+
+    if (backend != BENCH_NULL) {
+        drain.stop = 1; //Seen within one poll timeout
+        pthread_join(drain.thread, NULL);
+    }
+
+    if (rc != 0) {
+        printf("Benchmark stopped early\n");
+    }
+
+    cpu = (ru.ru_utime.tv_sec - ru0.ru_utime.tv_sec) + (ru.ru_utime.tv_usec - ru0.ru_utime.tv_usec) / 1e6
+            + (ru.ru_stime.tv_sec - ru0.ru_stime.tv_sec) + (ru.ru_stime.tv_usec - ru0.ru_stime.tv_usec) / 1e6;
+    mb = stats.bytes / 1e6;
+    if (mb <= 0 || wall <= 0) {
+        mb = wall = 1e-9;
+    }
+
+    printf("Sent %llu bytes in %lu frames, %.3f s\n", stats.bytes, stats.frames, wall);
+    printf("BENCH backend=%s source=%s file_bytes=%ld chunk_bytes=%ld fec=%d,%d"
+            " ratio=%.2f files=%lu MBps=%.2f syscr_per_MB=%.1f syscw_per_MB=%.1f cpu_pct=%.1f maxrss_kB=%ld\n",
+            backend == BENCH_NULL ? "null" : backend == BENCH_PTY ? "pty" : "loop",
+            source == TM_SOURCE_READ ? "read" : "mmap", file_size,
+            frame_size * frames_per_chunk, fec_k, fec_m,
+            stats.payload_bytes > 0 ? (double) stats.raw_bytes / stats.payload_bytes : 1.0,
+            stats.files, mb / wall,
+            (syscr1 - syscr0 - drain.reads) / mb, (syscw1 - syscw0) / mb,
+            100.0 * cpu / wall, ru.ru_maxrss);
+
+    stats_destroy(&stats);
+
+out_backend:
+    if (backend == BENCH_LOOP) {
+        device_close(&dev);
+    } else {
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (master >= 0) {
+            close(master);
+        }
+    }
+out_pool:
+    pool_destroy(&pool);
+out:
+    queue_destroy(&queue);
+    if (fec_k > 0) {
+        fec_code_destroy(&fec);
+    }
+    if (filename == tmpname) {
+        unlink(tmpname);
+    }
+
+    return rc == 0 ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+/********************************************************************************
+ * MOSES telemetry downlink buffer pool
+ *
+ * See bufpool.h.
+ *
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <memory.h>
+
+#include "bufpool.h"
+
+int pool_init(struct tm_pool *pool, int nbufs, size_t buf_size) {
+
+    int i;
+
+    memset(pool, 0, sizeof (*pool));
+
+    pool->arena = malloc(nbufs * buf_size);
+    pool->free = calloc(nbufs, sizeof (unsigned char *));
+    if (pool->arena == NULL || pool->free == NULL) {
+        free(pool->arena);
+        free(pool->free);
+        pool->arena = NULL;
+        return -1;
+    }
+
+    for (i = 0; i < nbufs; i++) {
+        pool->free[i] = pool->arena + i * buf_size;
+    }
+
+    pool->nfree = nbufs;
+    pool->nbufs = nbufs;
+    pool->buf_size = buf_size;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->avail, NULL);
+
+    return 0;
+}
+
+void pool_destroy(struct tm_pool *pool) {
+
+    if (pool->arena != NULL) {
+        free(pool->arena);
+        free(pool->free);
+        pool->arena = NULL;
+        pool->free = NULL;
+
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->avail);
+    }
+}
+
+unsigned char *pool_get(struct tm_pool *pool) {
+
+    unsigned char *buf;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->nfree == 0) {
+        pthread_cond_wait(&pool->avail, &pool->lock);
+    }
+    buf = pool->free[--pool->nfree];
+    pthread_mutex_unlock(&pool->lock);
+
+    return buf;
+}
+
+unsigned char *pool_tryget(struct tm_pool *pool, int reserve) {
+
+    unsigned char *buf = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->nfree > reserve) {
+        buf = pool->free[--pool->nfree];
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return buf;
+}
+
+void pool_put(struct tm_pool *pool, unsigned char *buf) {
+
+    pthread_mutex_lock(&pool->lock);
+    pool->free[pool->nfree++] = buf;
+    pthread_cond_signal(&pool->avail);
+    pthread_mutex_unlock(&pool->lock);
+}
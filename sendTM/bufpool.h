@@ -0,0 +1,40 @@
+/********************************************************************************
+ * MOSES telemetry downlink buffer pool
+ *
+ * Fixed set of equal-sized buffers carved out of one arena allocated at
+ * startup. Pipeline stages check buffers out per chunk and hand them back
+ * when the chunk is on the wire, so memory use stays constant no matter how
+ * long the downlink queue is.
+ *
+ ******************************************************************************/
+
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+struct tm_pool {
+    unsigned char *arena;       //nbufs * buf_size bytes, allocated once
+    unsigned char **free;       //stack of buffers not checked out
+    int nfree;
+    int nbufs;
+    size_t buf_size;
+    pthread_mutex_t lock;
+    pthread_cond_t avail;
+};
+
+int pool_init(struct tm_pool *pool, int nbufs, size_t buf_size);
+void pool_destroy(struct tm_pool *pool);
+
+/*Check out a buffer, blocking until one is returned if the pool is empty*/
+unsigned char *pool_get(struct tm_pool *pool);
+
+/*Check out a buffer only if more than reserve would still be left free, else NULL.
+ *Lets more urgent users keep some buffers to themselves.*/
+unsigned char *pool_tryget(struct tm_pool *pool, int reserve);
+
+/*Return a buffer obtained from pool_get() or pool_tryget()*/
+void pool_put(struct tm_pool *pool, unsigned char *buf);
+
+#endif /* BUFPOOL_H */
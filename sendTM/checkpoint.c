@@ -0,0 +1,486 @@
+/********************************************************************************
+ * MOSES telemetry downlink checkpoints
+ *
+ * See checkpoint.h. Entries are few, one per file queued in a run, so they
+ * are kept in an array and searched in order. Each entry notes which of its
+ * lines are still to be written, so however many chunks drain between two
+ * passes of the journal thread, only the last drained offset is written.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "checkpoint.h"
+
+/*Longest journal line*/
+#define CKPT_LINE_MAX (PATH_MAX + 128)
+
+/*Caller holds ck->lock*/
+static struct tm_ckpt_entry *find_entry(struct tm_checkpoint *ck, unsigned long id) {
+
+    int i;
+
+    for (i = 0; i < ck->n; i++) {
+        if (ck->entry[i].id == id) {
+            return &ck->entry[i];
+        }
+    }
+    return NULL;
+}
+
+/*Caller holds ck->lock*/
+static struct tm_ckpt_entry *add_entry(struct tm_checkpoint *ck, unsigned long id) {
+
+    struct tm_ckpt_entry *e;
+    int cap;
+
+    if (ck->n == ck->cap) {
+        cap = ck->cap ? 2 * ck->cap : 16;
+        e = realloc(ck->entry, cap * sizeof (*e));
+        if (e == NULL) {
+            return NULL;
+        }
+        ck->entry = e;
+        ck->cap = cap;
+    }
+    e = &ck->entry[ck->n++];
+    memset(e, 0, sizeof (*e));
+    e->id = id;
+    return e;
+}
+
+static int sync_journal(struct tm_checkpoint *ck) {
+
+    if (fflush(ck->fp) != 0 || fdatasync(fileno(ck->fp)) < 0) {
+        printf("checkpoint sync error=%d %s\n", errno, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*Format e's start line into line. Returns its length, cut short to fit if need be*/
+static size_t start_line(char *line, size_t size, const struct tm_ckpt_entry *e) {
+
+    size_t n;
+
+    n = snprintf(line, size, "start %lu %lu %lld %lld %lu %08x %s\n", e->id, e->frame_size,
+            e->size, e->mtime, e->off, e->crc, e->path);
+    return (n >= size) ? size - 1 : n;
+}
+
+/*Add what e still has to write to ck->out. Caller holds ck->lock*/
+static int take_lines(struct tm_checkpoint *ck, struct tm_ckpt_entry *e, size_t *len) {
+
+    char line[CKPT_LINE_MAX];
+    size_t n = 0, cap;
+    char *out;
+
+    /*A start line carries the drained offset too, and a dropped entry needs no other*/
+    if (e->pending & TM_CKPT_LOG_DROP) {
+        n = snprintf(line, sizeof (line), "drop %lu\n", e->id);
+    } else if (e->pending & TM_CKPT_LOG_START) {
+        n = start_line(line, sizeof (line), e);
+    } else if (e->pending & TM_CKPT_LOG_DRAINED) {
+        n = snprintf(line, sizeof (line), "drained %lu %lu %08x\n", e->id, e->off, e->crc);
+    }
+    if (n >= sizeof (line)) {
+        n = sizeof (line) - 1;
+    }
+    if (e->pending & TM_CKPT_LOG_DONE) {
+        n += snprintf(line + n, sizeof (line) - n, "done %lu\n", e->id);
+    }
+    if (n >= sizeof (line)) {
+        n = sizeof (line) - 1;
+    }
+
+    if (*len + n > ck->out_cap) {
+        cap = 2 * (*len + n);
+        out = realloc(ck->out, cap);
+        if (out == NULL) {
+            return -1; //Left pending for the next pass
+        }
+        ck->out = out;
+        ck->out_cap = cap;
+    }
+    memcpy(ck->out + *len, line, n);
+    *len += n;
+    e->pending = 0;
+    return 0;
+}
+
+/*Write and sync every line still pending*/
+static int write_pending(struct tm_checkpoint *ck) {
+
+    size_t len = 0;
+    int i, rc = 0;
+
+    pthread_mutex_lock(&ck->io_lock);
+
+    pthread_mutex_lock(&ck->lock);
+    ck->dirty = 0;
+    for (i = 0; i < ck->n; i++) {
+        if (ck->entry[i].pending && take_lines(ck, &ck->entry[i], &len) < 0) {
+            printf("Unable to allocate the checkpoint journal lines\n");
+            rc = -1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ck->lock);
+
+    if (len > 0) {
+        if (fwrite(ck->out, 1, len, ck->fp) != len) {
+            printf("checkpoint write error=%d %s\n", errno, strerror(errno));
+            rc = -1;
+        } else if (sync_journal(ck) < 0) {
+            rc = -1;
+        }
+    }
+
+    pthread_mutex_unlock(&ck->io_lock);
+    return rc;
+}
+
+/*Hand e's new lines to the journal thread, or write them now without one. Caller
+ *holds ck->lock, and no longer does on return*/
+static int note(struct tm_checkpoint *ck, struct tm_ckpt_entry *e, int lines) {
+
+    e->pending |= lines;
+    ck->dirty = 1;
+    if (ck->running) {
+        pthread_cond_signal(&ck->wake);
+        pthread_mutex_unlock(&ck->lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&ck->lock);
+    return write_pending(ck);
+}
+
+/*Apply one journal line. Malformed or unknown lines are skipped*/
+static void parse_line(struct tm_checkpoint *ck, char *line) {
+
+    struct tm_ckpt_entry *e, rec;
+    char *path;
+    size_t len;
+    int n = 0;
+
+    memset(&rec, 0, sizeof (rec));
+    if (sscanf(line, "start %lu %lu %lld %lld %lu %x %n", &rec.id, &rec.frame_size, &rec.size,
+            &rec.mtime, &rec.off, &rec.crc, &n) == 6 && n > 0) {
+        len = strcspn(line + n, "\n");
+        if (len == 0 || (path = strndup(line + n, len)) == NULL) {
+            return;
+        }
+        e = find_entry(ck, rec.id);
+        if (e == NULL && (e = add_entry(ck, rec.id)) == NULL) {
+            free(path);
+            return;
+        }
+        free(e->path);
+        rec.path = path;
+        *e = rec;
+        e->earlier = 1;
+        if (rec.id >= ck->next_id) {
+            ck->next_id = rec.id + 1;
+        }
+
+    } else if (sscanf(line, "drained %lu %lu %x", &rec.id, &rec.off, &rec.crc) == 3) {
+        if ((e = find_entry(ck, rec.id)) != NULL && rec.off > e->off) {
+            e->off = rec.off;
+            e->crc = rec.crc;
+        }
+
+    } else if (sscanf(line, "done %lu", &rec.id) == 1) {
+        if ((e = find_entry(ck, rec.id)) != NULL) {
+            e->done = 1;
+        }
+
+    } else if (sscanf(line, "drop %lu", &rec.id) == 1) {
+        if ((e = find_entry(ck, rec.id)) != NULL) {
+            free(e->path);
+            ck->n--;
+            memmove(e, e + 1, (ck->entry + ck->n - e) * sizeof (*e));
+        }
+    }
+}
+
+/*Replace the journal with one start line, and a done line if done, per entry*/
+static int compact(struct tm_checkpoint *ck) {
+
+    char tmp[PATH_MAX], line[CKPT_LINE_MAX];
+    FILE *fp;
+    int i;
+
+    snprintf(tmp, sizeof (tmp), "%s.new", ck->path);
+    fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        printf("fopen(%s) error=%d %s\n", tmp, errno, strerror(errno));
+        return -1;
+    }
+    for (i = 0; i < ck->n; i++) {
+        start_line(line, sizeof (line), &ck->entry[i]);
+        fputs(line, fp);
+        if (ck->entry[i].done) {
+            fprintf(fp, "done %lu\n", ck->entry[i].id);
+        }
+    }
+    if (fflush(fp) != 0 || fdatasync(fileno(fp)) < 0) {
+        printf("checkpoint sync error=%d %s\n", errno, strerror(errno));
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    /*Either the old journal or the new one survives a power cut*/
+    if (rename(tmp, ck->path) < 0) {
+        printf("rename(%s) error=%d %s\n", tmp, errno, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int checkpoint_open(struct tm_checkpoint *ck, const char *path) {
+
+    char line[CKPT_LINE_MAX];
+    FILE *fp;
+    int i, done = 0;
+
+    memset(ck, 0, sizeof (*ck));
+    pthread_mutex_init(&ck->lock, NULL);
+    pthread_mutex_init(&ck->io_lock, NULL);
+    pthread_cond_init(&ck->wake, NULL);
+    ck->next_id = 1;
+    ck->path = strdup(path);
+    if (ck->path == NULL) {
+        return -1;
+    }
+
+    fp = fopen(path, "r");
+    if (fp != NULL) {
+        while (fgets(line, sizeof (line), fp) != NULL) {
+            parse_line(ck, line);
+        }
+        fclose(fp);
+    }
+    if (compact(ck) < 0) {
+        return -1;
+    }
+
+    ck->fp = fopen(path, "a");
+    if (ck->fp == NULL) {
+        printf("fopen(%s) error=%d %s\n", path, errno, strerror(errno));
+        return -1;
+    }
+
+    for (i = 0; i < ck->n; i++) {
+        done += ck->entry[i].done;
+    }
+    printf("Checkpoint journal %s: %d files done, %d unfinished\n", path, done, ck->n - done);
+
+    return 0;
+}
+
+static void *journal_thread(void *arg) {
+
+    struct tm_checkpoint *ck = arg;
+    int running = 1;
+
+    while (running) {
+        pthread_mutex_lock(&ck->lock);
+        while (ck->running && !ck->dirty) {
+            pthread_cond_wait(&ck->wake, &ck->lock);
+        }
+        running = ck->running;
+        pthread_mutex_unlock(&ck->lock);
+
+        write_pending(ck);
+    }
+    return NULL;
+}
+
+int checkpoint_run(struct tm_checkpoint *ck) {
+
+    int rc;
+
+    ck->running = 1;
+    rc = pthread_create(&ck->thread, NULL, journal_thread, ck);
+    if (rc != 0) {
+        printf("pthread_create(checkpoint) error=%d %s\n", rc, strerror(rc));
+        ck->running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void checkpoint_close(struct tm_checkpoint *ck) {
+
+    int i, was_running;
+
+    pthread_mutex_lock(&ck->lock);
+    was_running = ck->running;
+    ck->running = 0;
+    pthread_cond_signal(&ck->wake);
+    pthread_mutex_unlock(&ck->lock);
+
+    /*Its last pass writes out whatever is still pending*/
+    if (was_running) {
+        pthread_join(ck->thread, NULL);
+    }
+
+    if (ck->fp != NULL) {
+        write_pending(ck);
+        fclose(ck->fp);
+    }
+    for (i = 0; i < ck->n; i++) {
+        free(ck->entry[i].path);
+    }
+    free(ck->entry);
+    free(ck->path);
+    free(ck->out);
+    pthread_mutex_destroy(&ck->lock);
+    pthread_mutex_destroy(&ck->io_lock);
+    pthread_cond_destroy(&ck->wake);
+    memset(ck, 0, sizeof (*ck));
+}
+
+int checkpoint_lookup(struct tm_checkpoint *ck, const char *path, const struct stat *st,
+        size_t frame_size, unsigned long *id, unsigned long *off, unsigned int *crc) {
+
+    struct tm_ckpt_entry *e;
+    int i, rc = TM_CKPT_NEW;
+
+    pthread_mutex_lock(&ck->lock);
+    for (i = 0; i < ck->n; i++) {
+        e = &ck->entry[i];
+        if (!e->earlier || e->claimed || strcmp(e->path, path) != 0) {
+            continue;
+        }
+
+        /*Rewritten since, so whatever went down is stale*/
+        if (e->size != (long long) st->st_size || e->mtime != (long long) st->st_mtime) {
+            continue;
+        }
+
+        /* Sequence numbers follow from offsets and the frame size, so frames cut to
+         * another size would repeat ones the ground station already has
+         */
+        e->claimed = 1;
+        if (!e->done && e->frame_size != frame_size) {
+            printf("Sending %s over, its frames were %lu Bytes, not %lu\n", path,
+                    e->frame_size, (unsigned long) frame_size);
+            note(ck, e, TM_CKPT_LOG_DROP); //So no later run resumes it instead
+            return TM_CKPT_NEW;
+        }
+        *id = e->id;
+        *off = e->off;
+        *crc = e->crc;
+        rc = e->done ? TM_CKPT_DONE : TM_CKPT_PARTIAL;
+        break;
+    }
+    pthread_mutex_unlock(&ck->lock);
+
+    return rc;
+}
+
+int checkpoint_start(struct tm_checkpoint *ck, unsigned long id, const char *path,
+        const struct stat *st, size_t frame_size, unsigned long off, unsigned int crc) {
+
+    struct tm_ckpt_entry *e;
+    char *copy;
+
+    copy = strdup(path);
+    if (copy == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&ck->lock);
+    e = find_entry(ck, id);
+    if (e == NULL) {
+        e = add_entry(ck, id);
+    }
+    if (e == NULL) {
+        free(copy);
+        pthread_mutex_unlock(&ck->lock);
+        return -1;
+    }
+    free(e->path);
+    e->path = copy;
+    e->size = st->st_size;
+    e->mtime = st->st_mtime;
+    e->frame_size = frame_size;
+    e->off = off;
+    e->crc = crc;
+    e->done = 0;
+    return note(ck, e, TM_CKPT_LOG_START);
+}
+
+int checkpoint_drained(struct tm_checkpoint *ck, unsigned long id, unsigned long off,
+        unsigned int crc) {
+
+    struct tm_ckpt_entry *e;
+
+    pthread_mutex_lock(&ck->lock);
+    e = find_entry(ck, id);
+    if (e != NULL && e->path != NULL && !e->done && off > e->off) {
+        e->off = off;
+        e->crc = crc;
+        return note(ck, e, TM_CKPT_LOG_DRAINED);
+    }
+    pthread_mutex_unlock(&ck->lock);
+
+    return 0;
+}
+
+int checkpoint_done(struct tm_checkpoint *ck, unsigned long id) {
+
+    struct tm_ckpt_entry *e;
+
+    pthread_mutex_lock(&ck->lock);
+    e = find_entry(ck, id);
+    if (e != NULL && !e->done) {
+        e->done = 1;
+        return note(ck, e, TM_CKPT_LOG_DONE);
+    }
+    pthread_mutex_unlock(&ck->lock);
+
+    return 0;
+}
+
+void checkpoint_unfinished(struct tm_checkpoint *ck, void (*fn)(const char *path, void *arg),
+        void *arg) {
+
+    int i;
+
+    /*Entries are only added by this run's threads, which are not running yet*/
+    for (i = 0; i < ck->n; i++) {
+        if (ck->entry[i].earlier && !ck->entry[i].claimed && !ck->entry[i].done) {
+            fn(ck->entry[i].path, arg);
+        }
+    }
+}
+
+int checkpoint_clear(struct tm_checkpoint *ck) {
+
+    int i, rc = 0;
+
+    /*Lines still pending are dropped along with their entries*/
+    pthread_mutex_lock(&ck->io_lock);
+    pthread_mutex_lock(&ck->lock);
+    for (i = 0; i < ck->n; i++) {
+        free(ck->entry[i].path);
+    }
+    ck->n = 0;
+    ck->dirty = 0;
+    pthread_mutex_unlock(&ck->lock);
+    if (fflush(ck->fp) != 0 || ftruncate(fileno(ck->fp), 0) < 0) {
+        printf("checkpoint truncate error=%d %s\n", errno, strerror(errno));
+        rc = -1;
+    }
+    pthread_mutex_unlock(&ck->io_lock);
+
+    return rc;
+}
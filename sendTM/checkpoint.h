@@ -0,0 +1,126 @@
+/********************************************************************************
+ * MOSES telemetry downlink checkpoints
+ *
+ * A journal of how far each file got, so a sendTM restarted after an error or
+ * a power cycle carries on where the last run stopped instead of sending the
+ * whole queue again. One line per event, appended and fdatasync()ed:
+ *
+ *   start <file_id> <frame_size> <size> <mtime> <offset> <crc> <path>
+ *   drained <file_id> <offset> <crc>
+ *   done <file_id>
+ *   drop <file_id>
+ *
+ * start is written when the reader opens a file, drained at chunk boundaries
+ * with the offset and running CRC-32C of a point already on the wire, and
+ * done once the file has been drained at its end. A chunk is only counted as
+ * drained once the chunk after it has been queued too, since the driver holds
+ * up to flow_max frames: a resumed file repeats at most a chunk or two.
+ *
+ * The reader and transmit threads only note each event in memory. A journal
+ * thread of its own, started with checkpoint_run(), writes out everything
+ * noted since its last pass and syncs it once, so neither thread ever waits
+ * on the SD card, and a burst of drained chunks costs a single sync. A power
+ * cut loses at most what was noted since the last sync, and a resumed file
+ * then repeats a little more of itself. Without the journal thread every
+ * event is written and synced before the call returns.
+ *
+ * On restart, a queued file that matches a journal entry by path, size and
+ * modification time is skipped if it was done, or resumed under its old file
+ * ID from its last drained offset, so the ground station puts the frames of
+ * both runs into one file. A file only resumes with the frame size it started
+ * with, since its sequence numbers count frames of that size; after a change
+ * of frame_size it is sent over from the start under a new file ID, and a drop
+ * line has every later run forget its old entry. Each entry is matched once, so a file queued twice
+ * in the batch is also skipped or resumed twice. Selected images and in-memory
+ * files are always sent whole. The journal is emptied once a run finishes its
+ * whole queue.
+ *
+ ******************************************************************************/
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/*Default journal location, next to the frame index*/
+#define TM_CHECKPOINT_FILE "/tmp/sendTM.checkpoint"
+
+/*Journal lines of an entry still to be written*/
+#define TM_CKPT_LOG_START 0x1
+#define TM_CKPT_LOG_DRAINED 0x2
+#define TM_CKPT_LOG_DONE 0x4
+#define TM_CKPT_LOG_DROP 0x8
+
+/*What the journal says about a file about to be sent*/
+#define TM_CKPT_NEW 0           //not in the journal, send it whole
+#define TM_CKPT_DONE 1          //already sent whole by an earlier run
+#define TM_CKPT_PARTIAL 2       //resume it from the entry's offset
+
+struct tm_ckpt_entry {
+    unsigned long id;
+    char *path;
+    long long size;
+    long long mtime;
+    unsigned long frame_size;   //payload bytes per frame the file is sent in
+    unsigned long off;          //everything before it is on the wire
+    unsigned int crc;           //CRC-32C state of the file through off
+    int done;
+    int earlier;                //read from the journal at open, so it can be resumed
+    int claimed;                //already matched to a queued file this run
+    int pending;                //TM_CKPT_LOG_* lines not yet written
+};
+
+struct tm_checkpoint {
+    char *path;
+    FILE *fp;                   //opened for appending
+    struct tm_ckpt_entry *entry;
+    int n, cap;
+    unsigned long next_id;      //past every file ID in the journal, so new files never reuse one
+    pthread_mutex_t lock;       //reader and transmit threads both record, never held over I/O
+    pthread_mutex_t io_lock;    //fp, held while writing and syncing
+    char *out;                  //lines of one pass of the journal thread
+    size_t out_cap;
+
+    /*Journal thread*/
+    pthread_cond_t wake;
+    int dirty;                  //an entry has lines pending
+    int running;
+    pthread_t thread;
+};
+
+/*Read an existing journal (or start a new one), compact it and open it for appending*/
+int checkpoint_open(struct tm_checkpoint *ck, const char *path);
+void checkpoint_close(struct tm_checkpoint *ck);
+
+/*From now on write the journal from a thread of its own, until checkpoint_close()*/
+int checkpoint_run(struct tm_checkpoint *ck);
+
+/*Match a file about to be sent in frames of frame_size against the earlier run. Returns
+ *TM_CKPT_*, and for TM_CKPT_PARTIAL the file ID, offset and CRC to resume with*/
+int checkpoint_lookup(struct tm_checkpoint *ck, const char *path, const struct stat *st,
+        size_t frame_size, unsigned long *id, unsigned long *off, unsigned int *crc);
+
+/* Record that file id, of path, is being sent in frames of frame_size from off on.
+ * Like checkpoint_drained() and checkpoint_done(), returns -1 only if the event
+ * could not be noted, or, without the journal thread, not written.
+ */
+int checkpoint_start(struct tm_checkpoint *ck, unsigned long id, const char *path,
+        const struct stat *st, size_t frame_size, unsigned long off, unsigned int crc);
+
+/*Record that file id is on the wire up to off. Ignores files never started*/
+int checkpoint_drained(struct tm_checkpoint *ck, unsigned long id, unsigned long off,
+        unsigned int crc);
+
+/*Record that file id is on the wire in full*/
+int checkpoint_done(struct tm_checkpoint *ck, unsigned long id);
+
+/*Call fn for each file an earlier run left unfinished and this one has not matched*/
+void checkpoint_unfinished(struct tm_checkpoint *ck, void (*fn)(const char *path, void *arg),
+        void *arg);
+
+/*Forget everything, once the whole queue has been sent*/
+int checkpoint_clear(struct tm_checkpoint *ck);
+
+#endif /* CHECKPOINT_H */
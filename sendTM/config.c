@@ -0,0 +1,583 @@
+/********************************************************************************
+ * MOSES telemetry downlink configuration
+ *
+ * See config.h.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "config.h"
+#include "frame.h"
+#include "flow.h"
+#include "stats.h"
+#include "pipeline.h"
+#include "index.h"
+#include "checkpoint.h"
+#include "trace.h"
+#include "shmring.h"
+#include "preview.h"
+
+#define CONFIG_LINE_MAX 1024
+
+/*Symbolic value of a setting*/
+struct config_name {
+    const char *name;
+    int value;
+};
+
+static const struct config_name modes[] = {
+    {"async", MGSL_MODE_ASYNC},
+    {"hdlc", MGSL_MODE_HDLC},
+    {"monosync", MGSL_MODE_MONOSYNC},
+    {"bisync", MGSL_MODE_BISYNC},
+    {"raw", MGSL_MODE_RAW},
+    {"xsync", MGSL_MODE_XSYNC},
+    {NULL, 0}
+};
+
+static const struct config_name encodings[] = {
+    {"nrz", HDLC_ENCODING_NRZ},
+    {"nrzb", HDLC_ENCODING_NRZB},
+    {"nrzi_mark", HDLC_ENCODING_NRZI_MARK},
+    {"nrzi_space", HDLC_ENCODING_NRZI_SPACE},
+    {"nrzi", HDLC_ENCODING_NRZI},
+    {"biphase_mark", HDLC_ENCODING_BIPHASE_MARK},
+    {"biphase_space", HDLC_ENCODING_BIPHASE_SPACE},
+    {"biphase_level", HDLC_ENCODING_BIPHASE_LEVEL},
+    {"diff_biphase_level", HDLC_ENCODING_DIFF_BIPHASE_LEVEL},
+    {NULL, 0}
+};
+
+static const struct config_name crcs[] = {
+    {"none", HDLC_CRC_NONE},
+    {"16", HDLC_CRC_16_CCITT},
+    {"32", HDLC_CRC_32_CCITT},
+    {NULL, 0}
+};
+
+static const struct config_name preambles[] = {
+    {"none", HDLC_PREAMBLE_PATTERN_NONE},
+    {"zeros", HDLC_PREAMBLE_PATTERN_ZEROS},
+    {"flags", HDLC_PREAMBLE_PATTERN_FLAGS},
+    {"10", HDLC_PREAMBLE_PATTERN_10},
+    {"01", HDLC_PREAMBLE_PATTERN_01},
+    {"ones", HDLC_PREAMBLE_PATTERN_ONES},
+    {NULL, 0}
+};
+
+static const struct config_name preamble_lengths[] = {
+    {"8", HDLC_PREAMBLE_LENGTH_8BITS},
+    {"16", HDLC_PREAMBLE_LENGTH_16BITS},
+    {"32", HDLC_PREAMBLE_LENGTH_32BITS},
+    {"64", HDLC_PREAMBLE_LENGTH_64BITS},
+    {NULL, 0}
+};
+
+static const struct config_name parities[] = {
+    {"none", ASYNC_PARITY_NONE},
+    {"even", ASYNC_PARITY_EVEN},
+    {"odd", ASYNC_PARITY_ODD},
+    {"space", ASYNC_PARITY_SPACE},
+    {NULL, 0}
+};
+
+static const struct config_name idles[] = {
+    {"flags", HDLC_TXIDLE_FLAGS},
+    {"alt_zeros_ones", HDLC_TXIDLE_ALT_ZEROS_ONES},
+    {"zeros", HDLC_TXIDLE_ZEROS},
+    {"ones", HDLC_TXIDLE_ONES},
+    {"alt_mark_space", HDLC_TXIDLE_ALT_MARK_SPACE},
+    {"space", HDLC_TXIDLE_SPACE},
+    {"mark", HDLC_TXIDLE_MARK},
+    {NULL, 0}
+};
+
+static const struct config_name bools[] = {
+    {"off", 0}, {"no", 0}, {"false", 0}, {"0", 0},
+    {"on", 1}, {"yes", 1}, {"true", 1}, {"1", 1},
+    {NULL, 0}
+};
+
+static const struct config_name synths[] = {
+    {"off", TM_SYNTH_OFF},
+    {"fsynth", TM_SYNTH_FSYNTH},
+    {NULL, 0}
+};
+
+static const struct config_name sources[] = {
+    {"read", TM_SOURCE_READ},
+    {"mmap", TM_SOURCE_MMAP},
+    {NULL, 0}
+};
+
+/*A whole decimal, octal or hex number*/
+static int parse_number(const char *value, unsigned long *out) {
+
+    char *end;
+
+    if (*value == '\0' || *value == '-') {
+        return -1;
+    }
+    errno = 0;
+    *out = strtoul(value, &end, 0);
+    return (errno != 0 || *end != '\0') ? -1 : 0;
+}
+
+/*One of the names in table or, if numeric is set, a number*/
+static int parse_name(const struct config_name *table, const char *value, int numeric, int *out) {
+
+    unsigned long n;
+
+    for (; table->name != NULL; table++) {
+        if (strcmp(table->name, value) == 0) {
+            *out = table->value;
+            return 0;
+        }
+    }
+    if (numeric && parse_number(value, &n) == 0) {
+        *out = (int) n;
+        return 0;
+    }
+    return -1;
+}
+
+/*Replace a string setting, "none" clearing it*/
+static int set_string(char **field, const char *value, int none) {
+
+    char *copy = NULL;
+
+    if (!(none && strcmp(value, "none") == 0)) {
+        copy = strdup(value);
+        if (copy == NULL) {
+            return -1;
+        }
+    }
+    free(*field);
+    *field = copy;
+    return 0;
+}
+
+void config_defaults(struct tm_config *cfg) {
+
+    memset(cfg, 0, sizeof (*cfg));
+    device_defaults(&cfg->dev, NULL);
+    set_string(&cfg->device, "/dev/ttyUSB0", 0);
+    cfg->dev.name = cfg->device;
+
+    cfg->frame_size = TM_FRAME_SIZE;
+    cfg->chunk_frames = TM_FRAMES_PER_CHUNK;
+    cfg->buffers = TM_POOL_BUFFERS;
+    cfg->source = TM_SOURCE_MMAP; //Frame straight from the page cache, no copy into the heap
+    cfg->flow = 1;
+    cfg->flow_min = TM_FLOW_MIN_DEPTH;
+    cfg->flow_max = TM_FLOW_MAX_DEPTH;
+    cfg->stats_interval = TM_STATS_INTERVAL;
+    cfg->link_signal = TM_LINK_WAKE_SIGNAL;
+    set_string(&cfg->index, TM_INDEX_FILE, 0);
+    set_string(&cfg->checkpoint, TM_CHECKPOINT_FILE, 0);
+    set_string(&cfg->trace, TM_TRACE_FILE, 0);
+    cfg->nports = 1;
+    cfg->shm_slots = TM_SHM_SLOTS;
+    cfg->shm_slot_size = TM_ROE_IMAGE_BYTES;
+}
+
+void config_destroy(struct tm_config *cfg) {
+
+    int i;
+
+    free(cfg->device);
+    free(cfg->index);
+    free(cfg->checkpoint);
+    free(cfg->trace);
+    free(cfg->watch_dir);
+    free(cfg->fifo);
+    free(cfg->shm);
+    free(cfg->archive_dir);
+    free(cfg->filler);
+    for (i = 0; i < cfg->nfiles; i++) {
+        free(cfg->files[i]);
+    }
+    free(cfg->files);
+    for (i = 1; i < cfg->nports; i++) {
+        free(cfg->ports[i]);
+    }
+    for (i = 0; i < cfg->nport_opts; i++) {
+        free(cfg->port_opts[i].key);
+        free(cfg->port_opts[i].value);
+    }
+    free(cfg->port_opts);
+    memset(cfg, 0, sizeof (*cfg));
+}
+
+/*Settings applied by device_open(), returns 1 if key is not one of them*/
+static int set_device(struct tm_device *dev, const char *key, const char *value) {
+
+    MGSL_PARAMS *p = &dev->params;
+
+    unsigned long n;
+    int v;
+
+    if (strcmp(key, "mode") == 0) {
+        if (parse_name(modes, value, 1, &v) < 0) return -1;
+        p->mode = v;
+    } else if (strcmp(key, "encoding") == 0) {
+        if (parse_name(encodings, value, 1, &v) < 0) return -1;
+        p->encoding = v;
+    } else if (strcmp(key, "crc") == 0) {
+        if (parse_name(crcs, value, 0, &v) < 0) return -1;
+        p->crc_type = v;
+    } else if (strcmp(key, "preamble") == 0) {
+        if (parse_name(preambles, value, 0, &v) < 0) return -1;
+        p->preamble = v;
+    } else if (strcmp(key, "preamble_length") == 0) {
+        if (parse_name(preamble_lengths, value, 0, &v) < 0) return -1;
+        p->preamble_length = v;
+    } else if (strcmp(key, "parity") == 0) {
+        if (parse_name(parities, value, 1, &v) < 0) return -1;
+        p->parity = v;
+    } else if (strcmp(key, "loopback") == 0) {
+        if (parse_name(bools, value, 0, &v) < 0) return -1;
+        p->loopback = v;
+    } else if (strcmp(key, "flags") == 0) {
+        if (parse_number(value, &n) < 0 || n > 0xffff) return -1;
+        p->flags = n;
+    } else if (strcmp(key, "clock_speed") == 0) {
+        if (parse_number(value, &n) < 0) return -1;
+        p->clock_speed = n;
+    } else if (strcmp(key, "addr_filter") == 0) {
+        if (parse_number(value, &n) < 0 || n > 0xff) return -1;
+        p->addr_filter = n;
+    } else if (strcmp(key, "data_rate") == 0) {
+        if (parse_number(value, &n) < 0) return -1;
+        p->data_rate = n;
+    } else if (strcmp(key, "data_bits") == 0) {
+        if (parse_number(value, &n) < 0 || n < 5 || n > 8) return -1;
+        p->data_bits = n;
+    } else if (strcmp(key, "stop_bits") == 0) {
+        if (parse_number(value, &n) < 0 || n < 1 || n > 2) return -1;
+        p->stop_bits = n;
+    } else if (strcmp(key, "idle") == 0) {
+        if (parse_name(idles, value, 1, &dev->idle) < 0) return -1;
+    } else if (strcmp(key, "synth") == 0) {
+        if (parse_name(synths, value, 0, &dev->synth) < 0) return -1;
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+/*Record "port<n>.<key> = value", checked against a scratch device*/
+static int set_port_opt(struct tm_config *cfg, const char *key, const char *value) {
+
+    struct tm_config_port_opt *opts, *o;
+    struct tm_device dev = cfg->dev;
+    unsigned long n;
+    char *end;
+
+    n = strtoul(key + 4, &end, 10);
+    if (end == key + 4 || *end != '.' || n < 1 || n >= TM_MAX_PORTS) {
+        printf("Unknown setting %s\n", key);
+        return -1;
+    }
+    if (set_device(&dev, end + 1, value) != 0) {
+        printf("Invalid port setting %s = %s\n", key, value);
+        return -1;
+    }
+
+    opts = realloc(cfg->port_opts, (cfg->nport_opts + 1) * sizeof (*opts));
+    if (opts == NULL) {
+        return -1;
+    }
+    cfg->port_opts = opts;
+    o = &opts[cfg->nport_opts];
+    o->port = (int) n;
+    o->key = strdup(end + 1);
+    o->value = strdup(value);
+    if (o->key == NULL || o->value == NULL) {
+        free(o->key);
+        free(o->value);
+        return -1;
+    }
+    cfg->nport_opts++;
+    return 0;
+}
+
+void config_port(const struct tm_config *cfg, int n, struct tm_device *dev) {
+
+    int i;
+
+    *dev = cfg->dev;
+    if (n == 0) {
+        return;
+    }
+    dev->name = cfg->ports[n];
+    dev->fd = -1;
+    for (i = 0; i < cfg->nport_opts; i++) {
+        if (cfg->port_opts[i].port == n) {
+            set_device(dev, cfg->port_opts[i].key, cfg->port_opts[i].value);
+        }
+    }
+}
+
+/*Comma-separated bit rates, or none*/
+static int parse_rates(struct tm_config *cfg, const char *value) {
+
+    char buf[256], *tok, *save;
+    unsigned long n;
+    int count = 0;
+
+    if (strcmp(value, "none") != 0) {
+        if (strlen(value) >= sizeof (buf)) {
+            return -1;
+        }
+        strcpy(buf, value);
+        for (tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+            if (count == TM_RATE_MAX || parse_number(tok, &n) < 0 || n == 0) {
+                return -1;
+            }
+            cfg->rates[count++] = n;
+        }
+    }
+    cfg->nrates = count;
+    return 0;
+}
+
+/*A count of at least min*/
+static int parse_count(const char *value, unsigned long min, int *out) {
+
+    unsigned long n;
+
+    if (parse_number(value, &n) < 0 || n < min || n > 0x7fffffff) {
+        return -1;
+    }
+    *out = (int) n;
+    return 0;
+}
+
+int config_set(struct tm_config *cfg, const char *key, const char *value) {
+
+    char **files;
+    int v, rc;
+
+    rc = set_device(&cfg->dev, key, value);
+    if (rc == 0) {
+        return 0;
+    }
+    if (rc < 0) {
+        goto bad_value;
+    }
+    if (strncmp(key, "port", 4) == 0 && key[4] != '\0') {
+        return set_port_opt(cfg, key, value);
+    }
+
+    if (strcmp(key, "device") == 0) {
+        if (set_string(&cfg->device, value, 0) < 0) goto bad_value;
+        cfg->dev.name = cfg->device;
+    } else if (strcmp(key, "frame_size") == 0) {
+        if (parse_count(value, 1, &v) < 0) goto bad_value;
+        cfg->frame_size = v;
+    } else if (strcmp(key, "chunk_frames") == 0) {
+        if (parse_count(value, 1, &cfg->chunk_frames) < 0) goto bad_value;
+    } else if (strcmp(key, "buffers") == 0) {
+        if (parse_count(value, 2, &cfg->buffers) < 0) goto bad_value;
+    } else if (strcmp(key, "source") == 0) {
+        if (parse_name(sources, value, 0, &cfg->source) < 0) goto bad_value;
+    } else if (strcmp(key, "flow") == 0) {
+        if (parse_name(bools, value, 0, &cfg->flow) < 0) goto bad_value;
+    } else if (strcmp(key, "flow_min") == 0) {
+        if (parse_count(value, 1, &cfg->flow_min) < 0) goto bad_value;
+    } else if (strcmp(key, "flow_max") == 0) {
+        if (parse_count(value, 1, &cfg->flow_max) < 0) goto bad_value;
+    } else if (strcmp(key, "stats_interval") == 0) {
+        if (parse_count(value, 1, &cfg->stats_interval) < 0) goto bad_value;
+    } else if (strcmp(key, "rt_priority") == 0) {
+        if (parse_count(value, 0, &cfg->rt_priority) < 0 || cfg->rt_priority > 99) goto bad_value;
+    } else if (strcmp(key, "lock_memory") == 0) {
+        if (parse_name(bools, value, 0, &cfg->lock_memory) < 0) goto bad_value;
+    } else if (strcmp(key, "link_signal") == 0) {
+        if (parse_count(value, 0, &cfg->link_signal) < 0 || cfg->link_signal > SIGRTMAX) goto bad_value;
+    } else if (strcmp(key, "index") == 0) {
+        if (set_string(&cfg->index, value, 1) < 0) goto bad_value;
+    } else if (strcmp(key, "checkpoint") == 0) {
+        if (set_string(&cfg->checkpoint, value, 1) < 0) goto bad_value;
+    } else if (strcmp(key, "trace") == 0) {
+        if (set_string(&cfg->trace, value, 1) < 0) goto bad_value;
+    } else if (strcmp(key, "fec") == 0) {
+        if (strcmp(value, "off") == 0) {
+            cfg->fec_k = cfg->fec_m = 0;
+        } else if (sscanf(value, "%d,%d", &cfg->fec_k, &cfg->fec_m) != 2) {
+            goto bad_value;
+        }
+    } else if (strcmp(key, "rates") == 0) {
+        if (parse_rates(cfg, value) < 0) goto bad_value;
+    } else if (strcmp(key, "rate_auto") == 0) {
+        if (parse_name(bools, value, 0, &cfg->rate_auto) < 0) goto bad_value;
+    } else if (strcmp(key, "compress") == 0) {
+        if (parse_name(bools, value, 0, &cfg->compress) < 0) goto bad_value;
+    } else if (strcmp(key, "preview") == 0) {
+        if (strcmp(value, "off") == 0) {
+            cfg->preview = 0;
+        } else if (parse_count(value, 1, &v) < 0 || !preview_bin_valid(v)) {
+            goto bad_value;
+        } else {
+            cfg->preview = v;
+        }
+    } else if (strcmp(key, "select") == 0) {
+        if (strcmp(value, "all") == 0) {
+            cfg->selected = 0;
+        } else if (roe_parse_select(&cfg->select, value) < 0) {
+            goto bad_value;
+        } else {
+            cfg->selected = 1;
+        }
+    } else if (strcmp(key, "watch") == 0) {
+        if (set_string(&cfg->watch_dir, value, 1) < 0) goto bad_value;
+    } else if (strcmp(key, "fifo") == 0) {
+        if (set_string(&cfg->fifo, value, 1) < 0) goto bad_value;
+    } else if (strcmp(key, "daemon") == 0) {
+        if (parse_name(bools, value, 0, &cfg->daemonize) < 0) goto bad_value;
+    } else if (strcmp(key, "shm") == 0) {
+        if (set_string(&cfg->shm, value, 1) < 0) goto bad_value;
+    } else if (strcmp(key, "shm_slots") == 0) {
+        if (parse_count(value, 1, &cfg->shm_slots) < 0 || cfg->shm_slots > TM_SHM_MAX_SLOTS) goto bad_value;
+    } else if (strcmp(key, "shm_slot_size") == 0) {
+        if (parse_count(value, 1, &cfg->shm_slot_size) < 0) goto bad_value;
+    } else if (strcmp(key, "archive") == 0) {
+        if (set_string(&cfg->archive_dir, value, 1) < 0) goto bad_value;
+    } else if (strcmp(key, "filler") == 0) {
+        if (set_string(&cfg->filler, value, 1) < 0) goto bad_value;
+    } else if (strcmp(key, "file") == 0) {
+        files = realloc(cfg->files, (cfg->nfiles + 1) * sizeof (*files));
+        if (files == NULL) goto bad_value;
+        cfg->files = files;
+        files[cfg->nfiles] = strdup(value);
+        if (files[cfg->nfiles] == NULL) goto bad_value;
+        cfg->nfiles++;
+    } else if (strcmp(key, "port") == 0) {
+        if (cfg->nports == TM_MAX_PORTS) {
+            printf("At most %d ports\n", TM_MAX_PORTS);
+            goto bad_value;
+        }
+        if (set_string(&cfg->ports[cfg->nports], value, 0) < 0) goto bad_value;
+        cfg->nports++;
+    } else {
+        printf("Unknown setting %s\n", key);
+        return -1;
+    }
+    return 0;
+
+bad_value:
+    printf("Invalid value %s for %s\n", value, key);
+    return -1;
+}
+
+/*Strip leading and trailing blanks in place*/
+static char *trim(char *s) {
+
+    char *end;
+
+    while (isspace((unsigned char) *s)) {
+        s++;
+    }
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char) end[-1])) {
+        *--end = '\0';
+    }
+    return s;
+}
+
+/*Split "key = value" (or "key value") and apply it*/
+static int set_line(struct tm_config *cfg, char *line) {
+
+    char *key, *value;
+
+    key = trim(line);
+    value = key + strcspn(key, "= \t");
+    if (*value == '\0') {
+        printf("Missing value for %s\n", key);
+        return -1;
+    }
+    *value++ = '\0';
+    value = trim(value);
+    if (*value == '=') {
+        value = trim(value + 1);
+    }
+    return config_set(cfg, key, value);
+}
+
+int config_set_option(struct tm_config *cfg, const char *option) {
+
+    char line[CONFIG_LINE_MAX];
+
+    if (strchr(option, '=') == NULL || strlen(option) >= sizeof (line)) {
+        printf("Expected key=value, not %s\n", option);
+        return -1;
+    }
+    strcpy(line, option);
+    return set_line(cfg, line);
+}
+
+int config_load(struct tm_config *cfg, const char *path, int required) {
+
+    char line[CONFIG_LINE_MAX];
+    FILE *f;
+    char *p;
+    int lineno = 0, rc = 0;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        if (!required && errno == ENOENT) {
+            return 0;
+        }
+        printf("fopen(%s) error=%d %s\n", path, errno, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof (line), f) != NULL) {
+        lineno++;
+        p = strchr(line, '#');
+        if (p != NULL) {
+            *p = '\0';
+        }
+        p = trim(line);
+        if (*p == '\0') {
+            continue;
+        }
+        if (set_line(cfg, p) < 0) {
+            printf("  at %s line %d\n", path, lineno);
+            rc = -1;
+        }
+    }
+    fclose(f);
+
+    if (rc == 0) {
+        printf("Read settings from %s\n", path);
+    }
+    return rc;
+}
+
+void config_print(const struct tm_config *cfg) {
+
+    const MGSL_PARAMS *p = &cfg->dev.params;
+
+    printf("CONFIG device=%s mode=%lu flags=0x%04x encoding=%u clock_speed=%lu crc=%u "
+            "preamble=%u/%u idle=%d synth=%d frame_size=%lu chunk_frames=%d buffers=%d "
+            "flow=%d/%d-%d rates=%d rate_auto=%d fec=%d,%d compress=%d preview=%d select=%d "
+            "index=%s checkpoint=%s trace=%s ports=%d rt_priority=%d lock_memory=%d link_signal=%d "
+            "shm=%s/%dx%d archive=%s filler=%s\n",
+            cfg->device, p->mode, p->flags, p->encoding, p->clock_speed, p->crc_type,
+            p->preamble, p->preamble_length, cfg->dev.idle, cfg->dev.synth,
+            (unsigned long) cfg->frame_size, cfg->chunk_frames, cfg->buffers, cfg->flow,
+            cfg->flow_min, cfg->flow_max, cfg->nrates, cfg->rate_auto, cfg->fec_k, cfg->fec_m,
+            cfg->compress, cfg->preview, cfg->selected, cfg->index != NULL ? cfg->index : "none",
+            cfg->checkpoint != NULL ? cfg->checkpoint : "none",
+            cfg->trace != NULL ? cfg->trace : "none", cfg->nports, cfg->rt_priority,
+            cfg->lock_memory, cfg->link_signal, cfg->shm != NULL ? cfg->shm : "none", cfg->shm_slots,
+            cfg->shm_slot_size, cfg->archive_dir != NULL ? cfg->archive_dir : "none",
+            cfg->filler != NULL ? cfg->filler : "none");
+}
@@ -0,0 +1,158 @@
+/********************************************************************************
+ * MOSES telemetry downlink configuration
+ *
+ * Everything sendTM used to need a recompile for: the SyncLink device and
+ * every MGSL_PARAMS field, the frame and chunk sizes, the buffer and driver
+ * queue depths, and which pipeline stages run. Settings start from the
+ * built-in defaults, then TM_CONFIG_FILE (or the file given with -F) is read,
+ * then command-line options apply in order, -o key=value the same way as a
+ * line of the file.
+ *
+ * The file has one key = value per line, '#' starting a comment:
+ *
+ *   device          /dev/ttyUSB0
+ *   mode            hdlc, raw, monosync, bisync, xsync or async
+ *   loopback        0 or 1, internal loopback
+ *   flags           HDLC_FLAG_* bits as a number, e.g. 0x0800
+ *   encoding        nrz, nrzb, nrzi_mark, nrzi_space, biphase_mark,
+ *                   biphase_space, biphase_level or diff_biphase_level
+ *   clock_speed     bits per second, the rate the link starts at
+ *   rates           up to TM_RATE_MAX rates, e.g. 2500000,5000000,10000000,
+ *                   for rate_auto to choose from, or none
+ *   rate_auto       on or off, move along rates by the driver's transmit
+ *                   error counts, see rate.h
+ *   addr_filter     receive address filter, 0xff to disable
+ *   crc             none, 16 or 32
+ *   preamble        none, zeros, flags, 10, 01 or ones
+ *   preamble_length 8, 16, 32 or 64 bits
+ *   data_rate, data_bits, stop_bits, parity (none, even, odd, space)
+ *                   async mode only
+ *   idle            flags, alt_zeros_ones, zeros, ones, alt_mark_space,
+ *                   space, mark, or an HDLC_TXIDLE_* number
+ *   synth           fsynth or off, whether fsynth sets the clock
+ *                   synthesizer to TM_SYNTH_FSYNTH_HZ for clock_speed
+ *   frame_size      payload bytes per HDLC frame
+ *   chunk_frames    frames per buffer, the unit of each read from disk
+ *   buffers         chunk buffers, the depth of the read-ahead
+ *   source          read or mmap
+ *   flow            on or off, adapt the driver queue depth to underruns
+ *   flow_min, flow_max
+ *                   bounds of the driver queue depth, in frames
+ *   stats_interval  seconds between STATS lines
+ *   rt_priority     SCHED_FIFO priority (1-99) of the thread feeding the
+ *                   link, or 0 for normal scheduling, see rt.h
+ *   lock_memory     on or off, pin the buffers in memory
+ *   link_signal     signal that stops the modem signal watchers, one the
+ *                   application leaves alone, or 0 not to watch the modem
+ *                   signals, see link.h
+ *   index           frame index file, or none
+ *   checkpoint      journal to resume files from after a restart, or none,
+ *                   see checkpoint.h
+ *   trace           file the timeline of every run is appended to, or
+ *                   none, see trace.h
+ *   fec             k,m or off
+ *   compress        on or off
+ *   preview         off, or the bin (2, 4, 8 or 16) of a preview sent ahead
+ *                   of each .roe image, see preview.h
+ *   select          ROE channel selection (see roe.h), or all
+ *   watch           directory to send new files from
+ *   fifo            FIFO to read pathnames from
+ *   daemon          on or off
+ *   shm             POSIX shared memory ring to take images from, e.g.
+ *                   /sendTM, or none, see shmring.h
+ *   shm_slots       images the ring holds
+ *   shm_slot_size   bytes of each slot, the largest image
+ *   archive         directory every shared memory image is also written
+ *                   to, or none
+ *   filler          backlog directory sent whenever nothing else is queued,
+ *                   or none, see filler.h
+ *   file            a file to send, once per file, in place of the built-in
+ *                   test queue
+ *   port            another SyncLink port to stripe frames over, once per
+ *                   port, see stripe.h. The device key is port 0
+ *   port<n>.<key>   a device setting (mode through synth above) for port n
+ *                   alone, e.g. port1.clock_speed = 5000000. Ports take
+ *                   every other device setting from the shared keys
+ *
+ ******************************************************************************/
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stddef.h>
+
+#include "device.h"
+#include "roe.h"
+#include "stripe.h"
+#include "rate.h"
+
+/*Read at startup if it exists, unless -F names another file*/
+#define TM_CONFIG_FILE "/etc/sendTM.conf"
+
+/*A device setting given for one striped port*/
+struct tm_config_port_opt {
+    int port;
+    char *key;
+    char *value;
+};
+
+struct tm_config {
+    char *device;
+    struct tm_device dev;       //MGSL_PARAMS and idle pattern applied by device_open()
+    size_t frame_size;
+    int chunk_frames;
+    int buffers;
+    int source;                 //TM_SOURCE_*
+    int flow;
+    int flow_min, flow_max;
+    int stats_interval;
+    int rt_priority;
+    int lock_memory;
+    int link_signal;            //0 for no modem signal watchers
+    char *index;                //NULL for none
+    char *checkpoint;           //NULL for none
+    char *trace;                //NULL for none
+    int fec_k, fec_m;           //fec_k zero for none
+    int compress;
+    unsigned long rates[TM_RATE_MAX];
+    int nrates;
+    int rate_auto;
+    int preview;                //bin, zero for none
+    int selected;               //nonzero to apply select
+    struct tm_roe_select select;
+    char *watch_dir;
+    char *fifo;
+    int daemonize;
+    char *shm;                  //NULL for none
+    int shm_slots;
+    int shm_slot_size;
+    char *archive_dir;          //NULL for none
+    char *filler;               //backlog directory, NULL for none
+    char **files;               //file keys, in order
+    int nfiles;
+    char *ports[TM_MAX_PORTS];  //device names of ports 1 on, port 0 being device
+    int nports;                 //at least 1
+    struct tm_config_port_opt *port_opts; //in the order given
+    int nport_opts;
+};
+
+/*Built-in defaults*/
+void config_defaults(struct tm_config *cfg);
+void config_destroy(struct tm_config *cfg);
+
+/*Apply one setting. Returns -1 and prints why if the key or value is not valid*/
+int config_set(struct tm_config *cfg, const char *key, const char *value);
+
+/*Apply a "key=value" option*/
+int config_set_option(struct tm_config *cfg, const char *option);
+
+/*Apply every line of a file. A missing file is an error only if required*/
+int config_load(struct tm_config *cfg, const char *path, int required);
+
+/*Device settings of port n, from the shared ones and that port's own*/
+void config_port(const struct tm_config *cfg, int n, struct tm_device *dev);
+
+/*Print the settings in effect as one CONFIG line*/
+void config_print(const struct tm_config *cfg);
+
+#endif /* CONFIG_H */
@@ -0,0 +1,108 @@
+/********************************************************************************
+ * MOSES telemetry downlink file checksums
+ *
+ * See crc.h. The table kernel is "slicing by 8": table[k][b] is the CRC of
+ * byte b followed by k zero bytes, so eight table lookups advance the CRC by
+ * eight bytes at once.
+ *
+ ******************************************************************************/
+
+#include <stdint.h>
+#include <memory.h>
+#include <pthread.h>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#include "crc.h"
+
+#define POLY 0x82f63b78         //CRC-32C, reflected
+
+static uint32_t table[8][256];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+static void make_table(void) {
+
+    uint32_t c;
+    int b, i, k;
+
+    for (b = 0; b < 256; b++) {
+        c = b;
+        for (i = 0; i < 8; i++) {
+            c = (c & 1) ? (c >> 1) ^ POLY : c >> 1;
+        }
+        table[0][b] = c;
+    }
+    for (b = 0; b < 256; b++) {
+        for (k = 1; k < 8; k++) {
+            table[k][b] = (table[k - 1][b] >> 8) ^ table[0][table[k - 1][b] & 0xff];
+        }
+    }
+}
+
+/*Advance the CRC by eight bytes, given in the order they appear in memory*/
+static inline uint32_t step8(uint32_t c, uint64_t w) {
+
+#if defined(__SSE4_2__)
+    return (uint32_t) _mm_crc32_u64(c, w);
+#elif defined(__ARM_FEATURE_CRC32)
+    return __crc32cd(c, w);
+#else
+    uint32_t lo, hi;
+    unsigned char b[8];
+
+    memcpy(b, &w, sizeof (b));
+    lo = c ^ ((uint32_t) b[0] | (uint32_t) b[1] << 8 | (uint32_t) b[2] << 16 | (uint32_t) b[3] << 24);
+    hi = (uint32_t) b[4] | (uint32_t) b[5] << 8 | (uint32_t) b[6] << 16 | (uint32_t) b[7] << 24;
+    return table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff]
+            ^ table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24]
+            ^ table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff]
+            ^ table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+#endif
+}
+
+static inline uint32_t step1(uint32_t c, unsigned char b) {
+
+    return (c >> 8) ^ table[0][(c ^ b) & 0xff];
+}
+
+unsigned int crc32c(unsigned int crc, const unsigned char *buf, size_t len) {
+
+    uint32_t c = ~(uint32_t) crc;
+    uint64_t w;
+
+    pthread_once(&table_once, make_table);
+
+    for (; len >= 8; len -= 8, buf += 8) {
+        memcpy(&w, buf, sizeof (w));
+        c = step8(c, w);
+    }
+    while (len-- > 0) {
+        c = step1(c, *buf++);
+    }
+
+    return ~c;
+}
+
+unsigned int crc32c_copy(unsigned int crc, unsigned char *dst, const unsigned char *src, size_t len) {
+
+    uint32_t c = ~(uint32_t) crc;
+    uint64_t w;
+
+    pthread_once(&table_once, make_table);
+
+    for (; len >= 8; len -= 8, src += 8, dst += 8) {
+        memcpy(&w, src, sizeof (w));
+        memcpy(dst, &w, sizeof (w));
+        c = step8(c, w);
+    }
+    while (len-- > 0) {
+        *dst = *src++;
+        c = step1(c, *dst++);
+    }
+
+    return ~c;
+}
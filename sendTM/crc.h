@@ -0,0 +1,33 @@
+/********************************************************************************
+ * MOSES telemetry downlink file checksums
+ *
+ * CRC-32C (Castagnoli) of each file's data, computed as the frames are built
+ * and sent after the payload of the file's last frame. The HDLC CRC only
+ * covers one frame at a time, so this is what tells the ground a file was put
+ * back together, decompressed and FEC-repaired exactly.
+ *
+ * The checksum is folded into the copy that stages each payload behind its
+ * header, so the data is read once. Without a CRC instruction the kernel is
+ * table driven, eight bytes per step, which is what the ARM9 flight computer
+ * runs. SSE 4.2 and ARMv8 CRC builds use the instruction instead.
+ *
+ ******************************************************************************/
+
+#ifndef CRC_H
+#define CRC_H
+
+#include <stddef.h>
+
+/*Checksum bytes after the payload of a frame with TM_HDR_CRC*/
+#define TM_CRC_SIZE 4
+
+/*Checksum of no data, the value to start each file from*/
+#define TM_CRC_INIT 0
+
+/*Extend crc over len bytes*/
+unsigned int crc32c(unsigned int crc, const unsigned char *buf, size_t len);
+
+/*Copy len bytes from src to dst and extend crc over them in the same pass*/
+unsigned int crc32c_copy(unsigned int crc, unsigned char *dst, const unsigned char *src, size_t len);
+
+#endif /* CRC_H */
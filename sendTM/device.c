@@ -0,0 +1,268 @@
+/********************************************************************************
+ * MOSES telemetry downlink SyncLink device bring-up
+ *
+ * See device.h.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+#include <termios.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+#include "device.h"
+
+#ifndef N_HDLC
+#define N_HDLC 13
+#endif
+
+void device_defaults(struct tm_device *dev, const char *devname) {
+
+    memset(dev, 0, sizeof (*dev));
+    dev->name = devname;
+    dev->fd = -1;
+
+    /*
+     * HDLC/SDLC mode, loopback disabled (external loopback connector), NRZ encoding
+     * Data transmit clock sourced from BRG
+     * Output 10000000bps clock on auxclk output
+     * CRC16-CCITT hardware CRC
+     */
+
+    dev->params.mode = MGSL_MODE_HDLC;                  //N_TTY?
+    dev->params.loopback = 0;
+    dev->params.flags = HDLC_FLAG_RXC_RXCPIN + HDLC_FLAG_TXC_BRG;
+    dev->params.encoding = HDLC_ENCODING_NRZ;
+    dev->params.clock_speed = 10000000;
+    dev->params.crc_type = HDLC_CRC_16_CCITT;
+    dev->params.preamble = HDLC_PREAMBLE_PATTERN_ONES;  //Remove?
+    dev->params.preamble_length = HDLC_PREAMBLE_LENGTH_16BITS;
+    dev->params.addr_filter = 0xff;                     //Receive every address
+
+    dev->idle = HDLC_TXIDLE_FLAGS; //Change? consult email stream
+    dev->synth = TM_SYNTH_FSYNTH;
+}
+
+/*Run fsynth on the device and wait for it to set TM_SYNTH_FSYNTH_HZ*/
+static int run_fsynth(struct tm_device *dev) {
+
+    pid_t pid;
+    int status;
+
+    printf("fsynth device=%s\n", dev->name);
+    fflush(stdout); //Or the child would print it again
+
+    pid = fork();
+    if (pid < 0) {
+        printf("fork error=%d %s\n", errno, strerror(errno));
+        return -1;
+    }
+    if (pid == 0) {
+        execlp("fsynth", "fsynth", dev->name, (char *) NULL);
+        printf("execlp(fsynth) error=%d %s\n", errno, strerror(errno));
+        fflush(stdout);
+        _exit(127);
+    }
+
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            printf("waitpid error=%d %s\n", errno, strerror(errno));
+            return -1;
+        }
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("fsynth failed on %s, status 0x%x\n", dev->name, status);
+        return -1;
+    }
+    dev->synth_hz = TM_SYNTH_FSYNTH_HZ;
+    return 0;
+}
+
+/*Set the clock up for a bit rate of clock_speed, unless it already runs at it*/
+static int set_synth(struct tm_device *dev, unsigned long clock_speed) {
+
+    if (dev->synth == TM_SYNTH_OFF) {
+        return 0;
+    }
+    if (clock_speed == 0 || TM_SYNTH_FSYNTH_HZ % clock_speed != 0) {
+        printf("%lu bps does not divide fsynth's %lu Hz\n", clock_speed, TM_SYNTH_FSYNTH_HZ);
+        return -1;
+    }
+    return (dev->synth_hz == TM_SYNTH_FSYNTH_HZ) ? 0 : run_fsynth(dev);
+}
+
+int device_open(struct tm_device *dev) {
+
+    int fd, rc;
+    int sigs;
+    int ldisc = N_HDLC;
+    MGSL_PARAMS params;
+
+    /* Set the clock source on the SyncLink to the synthesized clock from the
+     * onboard frequency synthesizer chip, 20 MHz for an accurate 10 Mbps
+     * datastream. fsynth opens the device itself, so it is run before the device
+     * is opened here, as it always was. Never send at a rate the clock was not
+     * set for.
+     */
+    dev->synth_hz = 0;
+    rc = set_synth(dev, dev->params.clock_speed);
+    if (rc < 0) {
+        return rc;
+    }
+
+    printf("%s HDLC data on %s\n", dev->receive ? "receive" : "send", dev->name);
+
+    /* open serial device with O_NONBLOCK to ignore DCD input */
+    fd = open(dev->name, O_RDWR | O_NONBLOCK, 0);
+    if (fd < 0) {
+        printf("open error=%d %s\n", errno, strerror(errno));
+        return fd;
+    } else printf("device opened on %s\n", dev->name);
+
+    /*
+     * set N_HDLC line discipline						//Change this to N_TTY?
+     *
+     * A line discipline is a software layer between a tty device driver
+     * and user application that performs intermediate processing,
+     * formatting, and buffering of data.
+     */
+    rc = ioctl(fd, TIOCSETD, &ldisc);
+    if (rc < 0) {
+        printf("set  2line discipline error=%d %s\n",
+                errno, strerror(errno));
+        close(fd);
+        return rc;
+    }
+
+    /* get current device parameters */
+    rc = ioctl(fd, MGSL_IOCGPARAMS, &params);
+    if (rc < 0) {
+        printf("ioctl(MGSL_IOCGPARAMS) error=%d %s\n",
+                errno, strerror(errno));
+        close(fd);
+        return rc;
+    }
+
+    /* modify device parameters */
+    params.mode = dev->params.mode;
+    params.loopback = dev->params.loopback;
+    params.flags = dev->params.flags;
+    params.encoding = dev->params.encoding;
+    params.clock_speed = dev->params.clock_speed;
+    params.crc_type = dev->params.crc_type;
+    params.preamble = dev->params.preamble;
+    params.preamble_length = dev->params.preamble_length;
+    params.addr_filter = dev->params.addr_filter;
+    if (params.mode == MGSL_MODE_ASYNC) {
+        params.data_rate = dev->params.data_rate;
+        params.data_bits = dev->params.data_bits;
+        params.stop_bits = dev->params.stop_bits;
+        params.parity = dev->params.parity;
+    }
+
+    /* set current device parameters */
+    rc = ioctl(fd, MGSL_IOCSPARAMS, &params);
+    if (rc < 0) {
+        printf("ioctl(MGSL_IOCSPARAMS) error=%d %s\n",
+                errno, strerror(errno));
+        close(fd);
+        return rc;
+    }
+
+    /* set transmit idle pattern (sent between frames) */
+    rc = ioctl(fd, MGSL_IOCSTXIDLE, dev->idle);
+    if (rc < 0) {
+        printf("ioctl(MGSL_IOCSTXIDLE) error=%d %s\n",
+                errno, strerror(errno));
+        close(fd);
+        return rc;
+    }
+
+    /* The device stays non-blocking: writers wait for room in poll(), see link.h */
+
+    printf("Turn on RTS and DTR serial outputs\n\n");
+    sigs = TIOCM_RTS + TIOCM_DTR;
+    rc = ioctl(fd, TIOCMBIS, &sigs);
+    if (rc < 0) {
+        printf("assert DTR/RTS error=%d %s\n",
+                errno, strerror(errno));
+        close(fd);
+        return rc;
+    }
+
+    /*enable transmitter*/
+    int enable = 1;
+    if (!dev->receive) {
+        rc = ioctl(fd, MGSL_IOCTXENABLE, enable);
+    } else {
+        rc = ioctl(fd, MGSL_IOCRXENABLE, enable);
+        if (rc < 0) {
+            printf("ioctl(MGSL_IOCRXENABLE) error=%d %s\n", errno, strerror(errno));
+            close(fd);
+            return rc;
+        }
+    }
+
+    dev->fd = fd;
+
+    return 0;
+}
+
+int device_set_clock(struct tm_device *dev, unsigned long clock_speed) {
+
+    MGSL_PARAMS params;
+    int rc;
+
+    rc = set_synth(dev, clock_speed);
+    if (rc < 0) {
+        return rc;
+    }
+
+    rc = ioctl(dev->fd, MGSL_IOCGPARAMS, &params);
+    if (rc < 0) {
+        printf("ioctl(MGSL_IOCGPARAMS) error=%d %s\n", errno, strerror(errno));
+        return rc;
+    }
+    params.clock_speed = clock_speed;
+    rc = ioctl(dev->fd, MGSL_IOCSPARAMS, &params);
+    if (rc < 0) {
+        printf("ioctl(MGSL_IOCSPARAMS) error=%d %s\n", errno, strerror(errno));
+        return rc;
+    }
+    dev->params.clock_speed = clock_speed;
+
+    return 0;
+}
+
+int device_close(struct tm_device *dev) {
+
+    int rc;
+    int sigs;
+
+    /*
+     * keep auxclk clock output active for 2 seconds to give remote receiver
+     * clock cycles for internal processing of received data.
+     * If an external device supplies data clocks, this is not needed.
+     */
+    if (!dev->receive) {
+        sleep(2);
+    }
+
+    printf("Turn off RTS and DTR\n");
+    sigs = TIOCM_RTS + TIOCM_DTR;
+    rc = ioctl(dev->fd, TIOCMBIC, &sigs);
+    if (rc < 0) {
+        printf("negate DTR/RTS error=%d %s\n", errno, strerror(errno));
+    }
+
+    /* Close the device */
+    close(dev->fd);
+    dev->fd = -1;
+
+    return rc;
+}
@@ -0,0 +1,48 @@
+/********************************************************************************
+ * MOSES telemetry downlink SyncLink device bring-up
+ *
+ * Sets the clock synthesizer by running fsynth, sets the N_HDLC line discipline, applies the
+ * HDLC parameters and idle pattern, raises RTS/DTR and enables the
+ * transmitter. This is done once per process, so a long-running sendTM keeps
+ * the link configured and transmitting between payloads. The device is left
+ * in non-blocking mode, see link.h. A ground station port, see rcvTM.c, comes
+ * up the same way with its receiver enabled instead.
+ *
+ ******************************************************************************/
+
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include "synclink.h"
+
+/*How the clock under clock_speed is set up*/
+#define TM_SYNTH_OFF 0          //left alone, e.g. a receiver clocked on RXC
+#define TM_SYNTH_FSYNTH 1       //by running fsynth, which needs to be in the PATH
+
+/*The one synthesizer frequency fsynth sets, which the BRG divides down to clock_speed*/
+#define TM_SYNTH_FSYNTH_HZ 20000000UL
+
+struct tm_device {
+    const char *name;           //e.g. /dev/ttyUSB0
+    int fd;                     //open and configured device, or -1
+    MGSL_PARAMS params;         //HDLC settings applied over the driver's current ones
+    int idle;                   //transmit idle pattern (sent between frames)
+    int synth;                  //TM_SYNTH_*, how the clock for clock_speed is set
+    unsigned long synth_hz;     //frequency the synthesizer was last set to, or 0 if unknown
+    int receive;                //enable the receiver rather than the transmitter
+};
+
+/*Fill in the settings used for the MOSES downlink*/
+void device_defaults(struct tm_device *dev, const char *devname);
+
+/*Bring the device up ready to transmit, or receive. Returns 0 or the failing call's error*/
+int device_open(struct tm_device *dev);
+
+/*Change the bit rate of an open device, which TM_SYNTH_FSYNTH_HZ must divide exactly
+ *unless the clock is left alone. Returns 0 or the failing call's error*/
+int device_set_clock(struct tm_device *dev, unsigned long clock_speed);
+
+/*Let the receiver finish, drop RTS/DTR and close the device*/
+int device_close(struct tm_device *dev);
+
+#endif /* DEVICE_H */
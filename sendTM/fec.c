@@ -0,0 +1,300 @@
+/********************************************************************************
+ * MOSES telemetry downlink forward error correction
+ *
+ * See fec.h. GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11d).
+ * Data frame i is the field element x_i = i and parity row j the element
+ * y_j = 128 + j, so every coefficient 1 / (x_i + y_j) exists and every square
+ * submatrix of the Cauchy matrix is invertible. Dividing each column by its
+ * row 0 coefficient keeps that property and turns row 0 into all ones.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stdint.h>
+
+#include "fec.h"
+#include "frame.h"
+
+static unsigned char gf_exp[512];
+static unsigned char gf_log[256];
+
+static void gf_init(void) {
+
+    int i, x = 1;
+
+    if (gf_exp[0] != 0) {
+        return;
+    }
+    for (i = 0; i < 255; i++) {
+        gf_exp[i] = gf_exp[i + 255] = (unsigned char) x;
+        gf_log[x] = (unsigned char) i;
+        x <<= 1;
+        if (x & 0x100) {
+            x ^= 0x11d;
+        }
+    }
+}
+
+static unsigned char gf_mul(unsigned char a, unsigned char b) {
+
+    if (a == 0 || b == 0) {
+        return 0;
+    }
+    return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+static unsigned char gf_inv(unsigned char a) {
+
+    return gf_exp[255 - gf_log[a]];
+}
+
+/*dst ^= c * src over len bytes*/
+static void gf_addmul(unsigned char *dst, const unsigned char *src, unsigned char c, size_t len) {
+
+    size_t b;
+
+    if (c == 0) {
+        return;
+    }
+    for (b = 0; b < len; b++) {
+        dst[b] ^= gf_mul(c, src[b]);
+    }
+}
+
+int fec_code_init(struct tm_fec_code *code, int k, int m) {
+
+    int i, j, v;
+
+    if (k < 1 || k > TM_FEC_MAX_K || m < 1 || m > TM_FEC_MAX_M) {
+        printf("FEC group of %d+%d frames out of range (1 to %d data, 1 to %d parity)\n",
+                k, m, TM_FEC_MAX_K, TM_FEC_MAX_M);
+        return -1;
+    }
+
+    gf_init();
+    memset(code, 0, sizeof (*code));
+    code->k = k;
+    code->m = m;
+
+    code->mul = malloc((size_t) m * k * 256);
+    if (code->mul == NULL) {
+        printf("Unable to allocate FEC tables\n");
+        return -1;
+    }
+
+    for (j = 0; j < m; j++) {
+        for (i = 0; i < k; i++) {
+            code->coef[j][i] = gf_mul(gf_inv(i ^ (128 + j)), i ^ 128); //Column i scaled by 1 / coef(0, i)
+            for (v = 0; v < 256; v++) {
+                code->mul[((size_t) j * k + i) * 256 + v] = gf_mul(code->coef[j][i], v);
+            }
+        }
+    }
+
+    return 0;
+}
+
+void fec_code_destroy(struct tm_fec_code *code) {
+
+    free(code->mul);
+    code->mul = NULL;
+}
+
+int fec_init(struct tm_fec *fec, const struct tm_fec_code *code, size_t max_len) {
+
+    memset(fec, 0, sizeof (*fec));
+    fec->code = code;
+
+    /*Word-aligned parity rows, each behind room for its header*/
+    fec->frame_len = (TM_HDR_SIZE + max_len + 3) & ~(size_t) 3;
+    fec->buf = calloc(code->m, fec->frame_len);
+    if (fec->buf == NULL) {
+        printf("Unable to allocate %d FEC parity frames\n", code->m);
+        return -1;
+    }
+
+    return 0;
+}
+
+void fec_destroy(struct tm_fec *fec) {
+
+    free(fec->buf);
+    fec->buf = NULL;
+}
+
+void fec_add(struct tm_fec *fec, unsigned long file_id, unsigned long seq,
+        const unsigned char *frame, size_t len) {
+
+    const struct tm_fec_code *code = fec->code;
+    const unsigned char *row;
+    unsigned char *p;
+    size_t b, words = 0;
+    int j;
+
+    if (fec->n == 0) {
+        fec->file_id = file_id;
+        fec->first_seq = seq;
+    }
+    if (len > fec->len) {
+        fec->len = len;
+    }
+
+    /*Row 0 is a plain XOR, a word at a time when the frame is aligned*/
+    p = fec->buf + TM_HDR_SIZE;
+    if (((uintptr_t) frame & 3) == 0) {
+        words = len / 4;
+        for (b = 0; b < words; b++) {
+            ((uint32_t *) p)[b] ^= ((const uint32_t *) frame)[b];
+        }
+    }
+    for (b = words * 4; b < len; b++) {
+        p[b] ^= frame[b];
+    }
+
+    for (j = 1; j < code->m; j++) {
+        p = fec->buf + j * fec->frame_len + TM_HDR_SIZE;
+        row = code->mul + ((size_t) j * code->k + fec->n) * 256;
+        for (b = 0; b < len; b++) {
+            p[b] ^= row[frame[b]];
+        }
+    }
+
+    fec->n++;
+}
+
+size_t fec_parity_frame(struct tm_fec *fec, int j, unsigned char **frame) {
+
+    struct tm_frame_hdr hdr;
+
+    memset(&hdr, 0, sizeof (hdr));
+    hdr.flags = TM_HDR_PARITY;
+    hdr.file_id = fec->file_id;
+    hdr.seq = fec->first_seq;
+    hdr.length = fec->len;
+    hdr.fec_k = fec->n;
+    hdr.fec_row = j;
+
+    *frame = fec->buf + j * fec->frame_len;
+    frame_hdr_pack(&hdr, *frame);
+
+    return TM_HDR_SIZE + fec->len;
+}
+
+void fec_reset(struct tm_fec *fec) {
+
+    int j;
+
+    for (j = 0; j < fec->code->m; j++) {
+        memset(fec->buf + j * fec->frame_len + TM_HDR_SIZE, 0, fec->len);
+    }
+    fec->len = 0;
+    fec->n = 0;
+}
+
+/*Invert the n x n matrix a in place by Gauss-Jordan elimination. Returns -1 if singular*/
+static int gf_invert(unsigned char *a, int n) {
+
+    unsigned char inv[TM_FEC_MAX_M * TM_FEC_MAX_M];
+    unsigned char t, c;
+    int r, col, k, piv;
+
+    memset(inv, 0, sizeof (inv));
+    for (r = 0; r < n; r++) {
+        inv[r * n + r] = 1;
+    }
+
+    for (col = 0; col < n; col++) {
+        for (piv = col; piv < n && a[piv * n + col] == 0; piv++) {
+        }
+        if (piv == n) {
+            return -1;
+        }
+        for (k = 0; k < n; k++) {
+            t = a[col * n + k], a[col * n + k] = a[piv * n + k], a[piv * n + k] = t;
+            t = inv[col * n + k], inv[col * n + k] = inv[piv * n + k], inv[piv * n + k] = t;
+        }
+
+        c = gf_inv(a[col * n + col]);
+        for (k = 0; k < n; k++) {
+            a[col * n + k] = gf_mul(a[col * n + k], c);
+            inv[col * n + k] = gf_mul(inv[col * n + k], c);
+        }
+
+        for (r = 0; r < n; r++) {
+            if (r == col || (c = a[r * n + col]) == 0) {
+                continue;
+            }
+            for (k = 0; k < n; k++) {
+                a[r * n + k] ^= gf_mul(c, a[col * n + k]);
+                inv[r * n + k] ^= gf_mul(c, inv[col * n + k]);
+            }
+        }
+    }
+
+    memcpy(a, inv, n * n);
+    return 0;
+}
+
+int fec_recover(const struct tm_fec_code *code, int k, unsigned char **data,
+        unsigned char **parity, const int *have_data, const int *have_parity, size_t len) {
+
+    unsigned char a[TM_FEC_MAX_M * TM_FEC_MAX_M];
+    int lost[TM_FEC_MAX_M], rows[TM_FEC_MAX_M];
+    unsigned char *syn;
+    int nlost = 0, nrows = 0;
+    int i, j, r, c;
+
+    for (i = 0; i < k; i++) {
+        if (!have_data[i]) {
+            if (nlost == code->m) {
+                return -1;
+            }
+            lost[nlost++] = i;
+        }
+    }
+    if (nlost == 0) {
+        return 0;
+    }
+    for (j = 0; j < code->m && nrows < nlost; j++) {
+        if (have_parity[j]) {
+            rows[nrows++] = j;
+        }
+    }
+    if (nrows < nlost) {
+        return -1;
+    }
+
+    /*Syndromes: each parity row less the frames that did arrive*/
+    syn = malloc((size_t) nlost * len);
+    if (syn == NULL) {
+        return -1;
+    }
+    for (r = 0; r < nlost; r++) {
+        memcpy(syn + r * len, parity[rows[r]], len);
+        for (i = 0; i < k; i++) {
+            if (have_data[i]) {
+                gf_addmul(syn + r * len, data[i], code->coef[rows[r]][i], len);
+            }
+        }
+        for (c = 0; c < nlost; c++) {
+            a[r * nlost + c] = code->coef[rows[r]][lost[c]];
+        }
+    }
+
+    if (gf_invert(a, nlost) < 0) {
+        free(syn);
+        return -1;
+    }
+
+    for (c = 0; c < nlost; c++) {
+        memset(data[lost[c]], 0, len);
+        for (r = 0; r < nlost; r++) {
+            gf_addmul(data[lost[c]], syn + r * len, a[c * nlost + r], len);
+        }
+    }
+
+    free(syn);
+    return 0;
+}
@@ -0,0 +1,80 @@
+/********************************************************************************
+ * MOSES telemetry downlink forward error correction
+ *
+ * The link is one-way in flight, and a frame that fails its HDLC CRC is
+ * dropped by the ground station's driver. So losses arrive as erasures of
+ * whole frames, and a packet-level erasure code across groups of frames is
+ * enough to rebuild them without a retransmission.
+ *
+ * Each group holds up to k consecutive data frames of one file and is followed
+ * by m parity frames. The ground can rebuild any m lost frames of a group,
+ * data or parity. The code is a systematic Cauchy Reed-Solomon code over
+ * GF(2^8) and covers each data frame's header as well as its payload, so a
+ * rebuilt frame carries its own length and flags. The coefficients are
+ * scaled so that parity row 0 is a plain XOR of the group. With m = 1,
+ * encoding is one word-wide XOR per data byte. Rows after the first cost one
+ * 256-byte table lookup per byte.
+ *
+ * Parity frames have TM_HDR_PARITY set and use the data frame header fields as
+ * follows. seq is the first data frame of the group and offset is zero. Byte
+ * 18 carries the group's k, byte 19 the parity row, and length covers the
+ * longest data frame of the group, header included.
+ *
+ ******************************************************************************/
+
+#ifndef FEC_H
+#define FEC_H
+
+#include <stddef.h>
+
+#define TM_FEC_MAX_K 128
+#define TM_FEC_MAX_M 8
+
+/*Coefficient tables shared by every group*/
+struct tm_fec_code {
+    int k;                      //data frames per full group
+    int m;                      //parity frames per group
+    unsigned char coef[TM_FEC_MAX_M][TM_FEC_MAX_K]; //of data frame i in parity row j
+    unsigned char *mul;         //m * k rows of 256: coefficient (j, i) times every byte
+};
+
+/*Parity being accumulated for the group in progress of one file*/
+struct tm_fec {
+    const struct tm_fec_code *code;
+    unsigned char *buf;         //m parity frames, each with room for its header
+    size_t frame_len;           //room for one parity frame
+    size_t len;                 //longest data frame added to this group
+    int n;                      //data frames in this group so far
+    unsigned long file_id;
+    unsigned long first_seq;
+};
+
+/*Build the tables for k data and m parity frames per group. Returns -1 if out of range*/
+int fec_code_init(struct tm_fec_code *code, int k, int m);
+void fec_code_destroy(struct tm_fec_code *code);
+
+/*Allocate parity for data frames of up to max_len bytes, header included*/
+int fec_init(struct tm_fec *fec, const struct tm_fec_code *code, size_t max_len);
+void fec_destroy(struct tm_fec *fec);
+
+/*Add one data frame, header included, to the group in progress*/
+void fec_add(struct tm_fec *fec, unsigned long file_id, unsigned long seq,
+        const unsigned char *frame, size_t len);
+
+/*Complete parity frame j of the current group, header included. Returns its length*/
+size_t fec_parity_frame(struct tm_fec *fec, int j, unsigned char **frame);
+
+/*Start the next group*/
+void fec_reset(struct tm_fec *fec);
+
+/* Rebuild the lost data frames of a group on the ground. data[i] (i < k) and
+ * parity[j] (j < m) are buffers of len bytes. Received data frames are
+ * zero-padded, and received parity frames have their own header stripped.
+ * have_data[] and have_parity[] are zero for the frames that were lost, and
+ * each lost data frame is rebuilt into its data[i]. Returns -1 if more data
+ * frames were lost than parity frames arrived.
+ */
+int fec_recover(const struct tm_fec_code *code, int k, unsigned char **data,
+        unsigned char **parity, const int *have_data, const int *have_parity, size_t len);
+
+#endif /* FEC_H */
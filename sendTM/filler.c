@@ -0,0 +1,151 @@
+/********************************************************************************
+ * MOSES telemetry downlink idle filler
+ *
+ * See filler.h. The backlog is a few hundred files at most, so the files
+ * already sent are kept in an array and searched in order.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "filler.h"
+#include "sched.h"
+
+int filler_init(struct tm_filler *fl, const char *dir) {
+
+    memset(fl, 0, sizeof (*fl));
+    fl->dir = strdup(dir);
+    return (fl->dir != NULL) ? 0 : -1;
+}
+
+void filler_destroy(struct tm_filler *fl) {
+
+    int i;
+
+    for (i = 0; i < fl->nsent; i++) {
+        free(fl->sent[i].name);
+    }
+    free(fl->sent);
+    free(fl->dir);
+    memset(fl, 0, sizeof (*fl));
+}
+
+static struct tm_filler_entry *find_sent(struct tm_filler *fl, const char *name) {
+
+    int i;
+
+    for (i = 0; i < fl->nsent; i++) {
+        if (strcmp(fl->sent[i].name, name) == 0) {
+            return &fl->sent[i];
+        }
+    }
+    return NULL;
+}
+
+/*Remember name as queued in the state st gives*/
+static int mark_sent(struct tm_filler *fl, const char *name, const struct stat *st) {
+
+    struct tm_filler_entry *e;
+    int cap;
+
+    e = find_sent(fl, name);
+    if (e == NULL) {
+        if (fl->nsent == fl->cap) {
+            cap = fl->cap ? 2 * fl->cap : 64;
+            e = realloc(fl->sent, cap * sizeof (*e));
+            if (e == NULL) {
+                return -1;
+            }
+            fl->sent = e;
+            fl->cap = cap;
+        }
+        e = &fl->sent[fl->nsent];
+        e->name = strdup(name);
+        if (e->name == NULL) {
+            return -1;
+        }
+        fl->nsent++;
+    }
+    e->size = st->st_size;
+    e->mtime = st->st_mtime;
+    return 0;
+}
+
+static long elapsed_ms(const struct timespec *since, const struct timespec *now) {
+
+    return (now->tv_sec - since->tv_sec) * 1000L + (now->tv_nsec - since->tv_nsec) / 1000000L;
+}
+
+int filler_next(struct tm_filler *fl, struct tm_queue *q) {
+
+    char path[PATH_MAX], best[PATH_MAX];
+    struct stat st, best_st;
+    struct tm_filler_entry *e;
+    struct timespec now;
+    struct dirent *d;
+    time_t settled;
+    DIR *dp;
+    int found = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (fl->idle && elapsed_ms(&fl->scanned, &now) < TM_FILLER_RESCAN_MS) {
+        return 0;
+    }
+
+    dp = opendir(fl->dir);
+    if (dp == NULL) {
+        printf("opendir(%s) error=%d %s\n", fl->dir, errno, strerror(errno));
+        fl->idle = 1;
+        fl->scanned = now;
+        return 0;
+    }
+
+    /*Oldest first, leaving alone whatever is still being written*/
+    settled = time(NULL) - TM_FILLER_SETTLE_SECS;
+    memset(&best_st, 0, sizeof (best_st));
+    while ((d = readdir(dp)) != NULL) {
+        if (d->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof (path), "%s/%s", fl->dir, d->d_name);
+        if (stat(path, &st) < 0 || !S_ISREG(st.st_mode) || st.st_mtime > settled) {
+            continue;
+        }
+        e = find_sent(fl, path);
+        if (e != NULL && e->size == (long long) st.st_size && e->mtime == (long long) st.st_mtime) {
+            continue;
+        }
+        if (!found || st.st_mtime < best_st.st_mtime
+                || (st.st_mtime == best_st.st_mtime && strcmp(path, best) < 0)) {
+            strcpy(best, path);
+            best_st = st;
+            found = 1;
+        }
+    }
+    closedir(dp);
+
+    if (!found) {
+        fl->idle = 1;
+        fl->scanned = now;
+        return 0;
+    }
+    fl->idle = 0;
+
+    /*A preview would go ahead of everything else, which backlog must not*/
+    if (queue_push_async(q, best, NULL, TM_FILE_WHOLE, TM_PRIO_IDLE,
+            sched_file_flags(best) & ~TM_FILE_PREVIEW, NULL, NULL) == 0) {
+        return 0;
+    }
+    if (mark_sent(fl, best, &best_st) < 0) {
+        printf("Unable to allocate the backlog list\n");
+        return -1;
+    }
+    printf("Backlog %s queued\n", best);
+    return 1;
+}
@@ -0,0 +1,62 @@
+/********************************************************************************
+ * MOSES telemetry downlink idle filler
+ *
+ * Between images the link has nothing queued and sends HDLC idle flags for
+ * as long as the camera takes to write the next one. The filler keeps a
+ * backlog directory, e.g. housekeeping logs and images from earlier in the
+ * flight, and whenever the reader thread finds every class empty it queues
+ * the next backlog file in TM_PRIO_IDLE. From there it goes out like any
+ * other file, but only in frames no other class wants, so a new image
+ * preempts it at the next frame boundary and the backlog carries on once
+ * the image is down.
+ *
+ * Files go oldest first, each once as it stands: a file that changes after
+ * it was queued, such as a log that grew, is queued again, and a file
+ * modified within the last TM_FILLER_SETTLE_SECS is left until it stops
+ * changing. The directory is listed again at most every TM_FILLER_RESCAN_MS,
+ * so files added to it are picked up while the link idles. With a checkpoint
+ * journal (see checkpoint.h) a restarted sendTM skips whatever an earlier
+ * run got through.
+ *
+ * The filler only runs while files can still be queued, so a batch or a
+ * daemon being stopped ends as it did before.
+ *
+ ******************************************************************************/
+
+#ifndef FILLER_H
+#define FILLER_H
+
+#include <time.h>
+
+#include "queue.h"
+
+/*Least time between listings of the backlog directory*/
+#define TM_FILLER_RESCAN_MS 10000
+
+/*Files modified more recently than this are not sent yet*/
+#define TM_FILLER_SETTLE_SECS 10
+
+/*A backlog file as last queued*/
+struct tm_filler_entry {
+    char *name;
+    long long size;
+    long long mtime;
+};
+
+struct tm_filler {
+    char *dir;
+    struct tm_filler_entry *sent; //files queued so far, in no order
+    int nsent, cap;
+    struct timespec scanned;    //last listing that found nothing to send
+    int idle;                   //nothing to send as of scanned
+};
+
+/*Only the reader thread uses a filler*/
+int filler_init(struct tm_filler *fl, const char *dir);
+void filler_destroy(struct tm_filler *fl);
+
+/*Queue the oldest backlog file not sent as it stands. Returns 1 if one was
+ *queued, 0 if there is none (or the queue is closed), or -1 out of memory*/
+int filler_next(struct tm_filler *fl, struct tm_queue *q);
+
+#endif /* FILLER_H */
@@ -0,0 +1,117 @@
+/********************************************************************************
+ * MOSES telemetry downlink transmit flow control
+ *
+ * See flow.h.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <memory.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "flow.h"
+
+/*Frames the driver has finished with, one way or another*/
+static unsigned long frames_done(const struct mgsl_icount *icount) {
+
+    return (unsigned long) icount->txok + icount->txabort + icount->txtimeout;
+}
+
+void flow_init(struct tm_flow *fl, int fd, long bitrate, size_t frame_size) {
+
+    struct mgsl_icount icount;
+
+    memset(fl, 0, sizeof (*fl));
+    fl->fd = fd;
+    fl->depth = TM_FLOW_START_DEPTH;
+    fl->min_depth = TM_FLOW_MIN_DEPTH;
+    fl->max_depth = TM_FLOW_MAX_DEPTH;
+    flow_set_bitrate(fl, bitrate, frame_size);
+
+    if (ioctl(fd, MGSL_IOCGSTATS, &icount) < 0) {
+        printf("MGSL_IOCGSTATS not available, transmit queue depth not adapted\n");
+        return;
+    }
+
+    fl->enabled = 1;
+    fl->done_base = frames_done(&icount);
+    fl->underruns = icount.txunder;
+}
+
+void flow_set_bitrate(struct tm_flow *fl, long bitrate, size_t frame_size) {
+
+    /*A quarter of a frame time, so a freed slot is refilled well before the link runs dry*/
+    fl->poll_us = (bitrate > 0) ? (long) (frame_size * 8 * 1000000ULL / bitrate / 4) : 1000;
+    if (fl->poll_us < 100) {
+        fl->poll_us = 100;
+    }
+}
+
+void flow_set_depth(struct tm_flow *fl, int min_depth, int max_depth) {
+
+    fl->min_depth = min_depth;
+    fl->max_depth = max_depth;
+    if (fl->depth < min_depth) {
+        fl->depth = min_depth;
+    }
+    if (fl->depth > max_depth) {
+        fl->depth = max_depth;
+    }
+}
+
+unsigned long flow_in_flight(struct tm_flow *fl) {
+
+    struct mgsl_icount icount;
+    unsigned long done;
+
+    if (!fl->enabled) {
+        return 0;
+    }
+    if (ioctl(fl->fd, MGSL_IOCGSTATS, &icount) < 0) {
+        fl->enabled = 0; //Fall back to waiting on the driver itself
+        return 0;
+    }
+    done = frames_done(&icount) - fl->done_base;
+    return (done >= fl->written) ? 0 : fl->written - done;
+}
+
+void flow_wait(struct tm_flow *fl) {
+
+    while (flow_in_flight(fl) >= (unsigned long) fl->depth) {
+        usleep(fl->poll_us);
+    }
+}
+
+void flow_sent(struct tm_flow *fl) {
+
+    struct mgsl_icount icount;
+    unsigned long under;
+
+    fl->written++;
+    if (!fl->enabled || ioctl(fl->fd, MGSL_IOCGSTATS, &icount) < 0) {
+        return;
+    }
+
+    if (icount.txunder != fl->underruns) {
+        under = (unsigned int) (icount.txunder - fl->underruns);
+        fl->underruns = icount.txunder;
+        fl->clean = 0;
+        if (fl->depth < fl->max_depth) {
+            fl->depth++;
+            printf("Transmit underrun, raising queue depth to %d frames\n", fl->depth);
+        }
+        trace_event(fl->trace, TM_TRACE_UNDERRUN, 0, 0, under, fl->depth);
+        return;
+    }
+
+    /*Give back latency once the link has stayed ahead for a while*/
+    if (++fl->clean >= TM_FLOW_DECAY_FRAMES) {
+        fl->clean = 0;
+        if (fl->depth > fl->min_depth) {
+            fl->depth--;
+            printf("No underruns in %d frames, lowering queue depth to %d frames\n",
+                    TM_FLOW_DECAY_FRAMES, fl->depth);
+        }
+    }
+}
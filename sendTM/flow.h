@@ -0,0 +1,66 @@
+/********************************************************************************
+ * MOSES telemetry downlink transmit flow control
+ *
+ * The SyncLink is set to idle with HDLC flags, so when the USB path falls
+ * behind, a frame underruns (txunder in mgsl_icount) and the link quietly
+ * drops below its line rate. Queuing more frames in the driver hides those
+ * hiccups, but every queued frame also delays a more urgent class that
+ * preempts at the next frame boundary.
+ *
+ * The flow controller keeps a target number of frames in flight. Frames in
+ * flight are those written but not yet counted by the driver as sent,
+ * aborted or timed out. Each new underrun raises the target by one frame,
+ * and every TM_FLOW_DECAY_FRAMES frames without an underrun lower it by one.
+ * The target stays between TM_FLOW_MIN_DEPTH and TM_FLOW_MAX_DEPTH unless
+ * flow_set_depth() gives other bounds. Devices without MGSL_IOCGSTATS are
+ * not paced at all.
+ *
+ ******************************************************************************/
+
+#ifndef FLOW_H
+#define FLOW_H
+
+#include <stddef.h>
+
+#include "synclink.h"
+#include "trace.h"
+
+#define TM_FLOW_MIN_DEPTH 2
+#define TM_FLOW_MAX_DEPTH 8
+#define TM_FLOW_START_DEPTH 3   //N_HDLC's own transmit buffer count
+
+/*Clean frames before the target depth is lowered again*/
+#define TM_FLOW_DECAY_FRAMES 256
+
+struct tm_flow {
+    int fd;                     //configured SyncLink device
+    int enabled;                //zero if the device does not provide MGSL_IOCGSTATS
+    int depth;                  //target frames in flight
+    int min_depth, max_depth;   //bounds of depth
+    long poll_us;               //sleep between counter reads while the driver is full
+    unsigned long written;      //frames handed to the driver
+    unsigned long done_base;    //sent + aborted + timed out when flow_init() ran
+    unsigned long underruns;    //txunder when flow_init() ran, then as last seen
+    unsigned long clean;        //frames since the last underrun or depth change
+    struct tm_trace *trace;     //underruns logged to, or NULL. Set after flow_init()
+};
+
+/*Set up pacing for frames of frame_size bytes at bitrate bits per second*/
+void flow_init(struct tm_flow *fl, int fd, long bitrate, size_t frame_size);
+
+/*Pace for a new bit rate, the counters carrying on*/
+void flow_set_bitrate(struct tm_flow *fl, long bitrate, size_t frame_size);
+
+/*Keep the target depth within [min_depth, max_depth]*/
+void flow_set_depth(struct tm_flow *fl, int min_depth, int max_depth);
+
+/*Frames written but not yet finished with by the driver, zero if not paced*/
+unsigned long flow_in_flight(struct tm_flow *fl);
+
+/*Wait until fewer than the target number of frames are in flight*/
+void flow_wait(struct tm_flow *fl);
+
+/*Account for a frame just written, and adapt the depth to any new underrun*/
+void flow_sent(struct tm_flow *fl);
+
+#endif /* FLOW_H */
@@ -0,0 +1,224 @@
+/********************************************************************************
+ * MOSES telemetry downlink HDLC framing
+ *
+ * See frame.h.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <unistd.h>
+#include <termios.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include "frame.h"
+
+static void put16(unsigned char *p, unsigned int v) {
+
+    uint16_t n = htons((uint16_t) v);
+
+    memcpy(p, &n, sizeof (n));
+}
+
+static void put32(unsigned char *p, unsigned long v) {
+
+    uint32_t n = htonl((uint32_t) v);
+
+    memcpy(p, &n, sizeof (n));
+}
+
+static unsigned int get16(const unsigned char *p) {
+
+    uint16_t n;
+
+    memcpy(&n, p, sizeof (n));
+    return ntohs(n);
+}
+
+static unsigned long get32(const unsigned char *p) {
+
+    uint32_t n;
+
+    memcpy(&n, p, sizeof (n));
+    return ntohl(n);
+}
+
+void frame_hdr_pack(const struct tm_frame_hdr *hdr, unsigned char *buf) {
+
+    buf[0] = TM_HDR_MAGIC0;
+    buf[1] = TM_HDR_MAGIC1;
+    buf[2] = TM_HDR_VERSION;
+    buf[3] = (unsigned char) hdr->flags;
+    put32(buf + 4, hdr->file_id);
+    put32(buf + 8, hdr->seq);
+    put32(buf + 12, hdr->offset);
+    put16(buf + 16, (unsigned int) hdr->length);
+    buf[18] = (unsigned char) hdr->fec_k;
+    buf[19] = (unsigned char) hdr->fec_row;
+}
+
+int frame_hdr_unpack(struct tm_frame_hdr *hdr, const unsigned char *buf, size_t len) {
+
+    if (len < TM_HDR_SIZE || buf[0] != TM_HDR_MAGIC0 || buf[1] != TM_HDR_MAGIC1
+            || buf[2] != TM_HDR_VERSION) {
+        return -1;
+    }
+
+    hdr->flags = buf[3];
+    hdr->file_id = get32(buf + 4);
+    hdr->seq = get32(buf + 8);
+    hdr->offset = get32(buf + 12);
+    hdr->length = get16(buf + 16);
+    hdr->fec_k = buf[18];
+    hdr->fec_row = buf[19];
+
+    if (TM_HDR_SIZE + hdr->length != len) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int framer_init(struct tm_framer *fr, int fd, size_t frame_size) {
+
+    if (frame_size == 0 || TM_HDR_SIZE + frame_size + TM_CRC_SIZE > HDLC_MAX_FRAME_SIZE) {
+        printf("Frame size %d out of range (1 to %d bytes)\n",
+                (int) frame_size, HDLC_MAX_FRAME_SIZE - TM_HDR_SIZE - TM_CRC_SIZE);
+        return -1;
+    }
+
+    /*The header has to go out in the same write() as its payload. Older kernels turn
+     *a writev() on a tty into one write, and so one frame, per iovec*/
+    fr->frame_buf = malloc(TM_HDR_SIZE + frame_size + TM_CRC_SIZE);
+    if (fr->frame_buf == NULL) {
+        printf("Unable to allocate a %d byte frame buffer\n",
+                (int) (TM_HDR_SIZE + frame_size + TM_CRC_SIZE));
+        return -1;
+    }
+
+    fr->fd = fd;
+    fr->frame_size = frame_size;
+    fr->frames = 0;
+    fr->stats = NULL;
+    fr->flow = NULL;
+    fr->stripe = NULL;
+    fr->link = NULL;
+
+    return 0;
+}
+
+void framer_destroy(struct tm_framer *fr) {
+
+    free(fr->frame_buf);
+    fr->frame_buf = NULL;
+}
+
+int framer_write_frame(struct tm_framer *fr, const struct tm_frame_hdr *hdr,
+        const unsigned char *data, size_t len, unsigned int *crc) {
+
+    struct tm_frame_hdr h = *hdr;
+    unsigned char *payload = fr->frame_buf + TM_HDR_SIZE;
+
+    if (crc != NULL) {
+        *crc = crc32c_copy(*crc, payload, data, len);
+        h.crc = *crc;
+    } else {
+        memcpy(payload, data, len);
+    }
+
+    h.length = len;
+    if (h.flags & TM_HDR_CRC) {
+        put32(payload + len, h.crc);
+        h.length += TM_CRC_SIZE;
+    }
+    frame_hdr_pack(&h, fr->frame_buf);
+
+    return framer_write_raw(fr, fr->frame_buf, TM_HDR_SIZE + h.length);
+}
+
+int framer_write_raw(struct tm_framer *fr, const unsigned char *frame, size_t len) {
+
+    struct timespec t0;
+    ssize_t rc;
+
+    if (fr->stripe != NULL) {
+        fr->frames++;
+        return stripe_write(fr->stripe, frame, len);
+    }
+
+    if (fr->flow != NULL) {
+        flow_wait(fr->flow);
+    }
+
+    stats_now(&t0);
+    rc = link_write(fr->link, fr->fd, frame, len);
+    if (rc < 0) {
+        return -1;
+    }
+
+    fr->frames++;
+    if (fr->flow != NULL) {
+        flow_sent(fr->flow);
+    }
+    if (fr->stats != NULL) {
+        stats_frame(fr->stats, len, stats_usec_since(&t0));
+    }
+
+    return 0;
+}
+
+int framer_send(struct tm_framer *fr, unsigned long file_id, const unsigned char *data, size_t len) {
+
+    struct tm_frame_hdr hdr;
+    unsigned int crc = TM_CRC_INIT;
+    size_t n;
+    int rc;
+
+    memset(&hdr, 0, sizeof (hdr));
+    hdr.file_id = file_id;
+
+    do {
+        n = (len < fr->frame_size) ? len : fr->frame_size;
+        if (n == len) {
+            hdr.flags = TM_HDR_LAST | TM_HDR_CRC; //An empty file still gets its one frame
+        }
+
+        rc = framer_write_frame(fr, &hdr, data, n, &crc);
+        if (rc < 0) {
+            return rc;
+        }
+
+        data += n;
+        len -= n;
+        hdr.seq++;
+        hdr.offset += n;
+    } while (len > 0);
+
+    return 0;
+}
+
+int framer_end_file(struct tm_framer *fr) {
+
+    struct timespec t0;
+    int rc;
+
+    if (fr->stripe != NULL) {
+        fr->frames = 0;
+        return stripe_drain(fr->stripe);
+    }
+
+    stats_now(&t0);
+    rc = link_drain(fr->fd, fr->flow);
+    if (rc < 0) {
+        return rc;
+    }
+    if (fr->stats != NULL) {
+        stats_drain(fr->stats, stats_usec_since(&t0));
+    }
+
+    fr->frames = 0;
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+/********************************************************************************
+ * MOSES telemetry downlink HDLC framing
+ *
+ * With the N_HDLC line discipline every write() becomes one HDLC frame, and
+ * the driver refuses anything larger than HDLC_MAX_FRAME_SIZE. The framer
+ * splits each payload into frames of a configurable size and hands them to
+ * the driver back to back. It only drains the transmitter at file boundaries,
+ * so several frames stay queued in the driver and the link never waits on a
+ * tcdrain() between chunks.
+ *
+ * Every frame starts with a TM_HDR_SIZE byte header, so the ground side can
+ * put each frame in place by index and see a gap as soon as a sequence number
+ * is skipped, with no scan for a terminator string. All fields are big-endian:
+ *
+ *   0  magic    'M' 'T'
+ *   2  version  TM_HDR_VERSION
+ *   3  flags    TM_HDR_LAST on the final frame of a file
+ *   4  file_id  u32, distinct for every file queued by this sender
+ *   8  seq      u32, frame number within the file, from 0
+ *  12  offset   u32, file offset of the first payload byte, which limits files
+ *               to TM_FILE_MAX bytes, see queue.h
+ *  16  length   u16, payload bytes following the header
+ *  18  fec_k    u8, data frames in the FEC group on parity frames, else zero
+ *  19  fec_row  u8, parity row on parity frames, else zero
+ *
+ * The last frame of a file also carries the file's CRC-32C, see crc.h: with
+ * TM_HDR_CRC set, the final TM_CRC_SIZE bytes counted by length are the
+ * big-endian checksum of every byte the file's data frames stand for, i.e.
+ * of the file (or selected stream) as rebuilt on the ground.
+ *
+ ******************************************************************************/
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+
+#include "synclink.h"
+#include "stats.h"
+#include "flow.h"
+#include "crc.h"
+#include "stripe.h"
+#include "link.h"
+
+/*Default payload bytes per HDLC frame, kept even so 16 bit pixels never straddle frames*/
+#define TM_FRAME_SIZE 65024
+
+#define TM_HDR_SIZE 20
+#define TM_HDR_MAGIC0 'M'
+#define TM_HDR_MAGIC1 'T'
+#define TM_HDR_VERSION 1
+
+/*Header flags*/
+#define TM_HDR_LAST 0x01        //final frame of the file, may carry no payload
+#define TM_HDR_PARITY 0x02      //FEC parity over the group starting at seq, see fec.h
+#define TM_HDR_RICE 0x04        //payload is compressed, see rice.h
+#define TM_HDR_SELECT 0x08      //offset is into the selected channels of an image, see roe.h
+#define TM_HDR_CRC 0x10         //payload is followed by the file's checksum
+
+/*Frame header fields in host byte order*/
+struct tm_frame_hdr {
+    unsigned int flags;
+    unsigned long file_id;
+    unsigned long seq;
+    unsigned long offset;
+    size_t length;
+    unsigned int fec_k;
+    unsigned int fec_row;
+    unsigned int crc;           //file checksum sent with TM_HDR_CRC, if not computed by the framer
+};
+
+struct tm_framer {
+    int fd;                     //configured SyncLink device
+    size_t frame_size;          //largest payload per frame, header not included
+    unsigned char *frame_buf;   //header and payload of the last frame written
+    unsigned long frames;       //frames queued since the last drain
+    struct tm_stats *stats;     //write() and tcdrain() timings, if set
+    struct tm_flow *flow;       //paces writes to the adaptive queue depth, if set
+    struct tm_stripe *stripe;   //hands frames to several ports instead of fd, if set
+    struct tm_link *link;       //signal state reported when the driver stalls, if set
+};
+
+/*Pack a header into the first TM_HDR_SIZE bytes of buf*/
+void frame_hdr_pack(const struct tm_frame_hdr *hdr, unsigned char *buf);
+
+/*Unpack the header of a received frame of len bytes. Returns -1 if it is not one
+ *of ours or its length field does not match the frame*/
+int frame_hdr_unpack(struct tm_frame_hdr *hdr, const unsigned char *buf, size_t len);
+
+/*Timings are not recorded and writes not paced until stats and flow are set, and
+ *frames go to fd unless stripe is set, in which case the stripe's ports do both.
+ *Returns -1 if frame_size plus the header and checksum does not fit HDLC_MAX_FRAME_SIZE*/
+int framer_init(struct tm_framer *fr, int fd, size_t frame_size);
+void framer_destroy(struct tm_framer *fr);
+
+/*Queue a single frame of at most frame_size payload bytes behind its header. If crc
+ *is not NULL the payload is folded into *crc while it is staged, and that is the
+ *checksum a TM_HDR_CRC frame carries. Otherwise it carries hdr->crc*/
+int framer_write_frame(struct tm_framer *fr, const struct tm_frame_hdr *hdr,
+        const unsigned char *data, size_t len, unsigned int *crc);
+
+/*Queue a frame that already has its header, e.g. FEC parity*/
+int framer_write_raw(struct tm_framer *fr, const unsigned char *frame, size_t len);
+
+/*Queue a whole file payload as a run of full frames, the last one flagged and
+ *carrying the checksum*/
+int framer_send(struct tm_framer *fr, unsigned long file_id, const unsigned char *data, size_t len);
+
+/*Wait until every frame of the file is on the wire*/
+int framer_end_file(struct tm_framer *fr);
+
+#endif /* FRAME_H */
@@ -0,0 +1,411 @@
+/********************************************************************************
+ * MOSES telemetry downlink frame index
+ *
+ * See index.h. The transmit thread is the only writer while the pipeline
+ * runs, so the index needs no lock.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "index.h"
+#include "rice.h"
+
+/*Longest index line*/
+#define INDEX_LINE_MAX (PATH_MAX + 128)
+
+/*One line of the index*/
+struct index_rec {
+    unsigned long pass;
+    struct tm_frame_hdr hdr;
+    char path[PATH_MAX];
+};
+
+/*One line of the retransmit list, and the records that satisfy it*/
+struct resend_req {
+    unsigned long file_id;
+    unsigned long first, last;  //frame range, inclusive
+    int whole;                  //every frame from first on, last set from the index
+    char *path;                 //file the frames come from, once found
+    struct tm_frame_hdr *hdr;   //latest record of each frame in the range
+    char *found;                //nonzero where hdr holds a record
+};
+
+/*Parse an index line. Returns -1 for a malformed one*/
+static int parse_rec(char *line, struct index_rec *rec) {
+
+    unsigned int flags;
+    size_t len;
+    int n = 0;
+
+    memset(rec, 0, sizeof (*rec));
+    if (sscanf(line, "%lu %lu %lu %lu %zu %x %n", &rec->pass, &rec->hdr.file_id,
+            &rec->hdr.seq, &rec->hdr.offset, &rec->hdr.length, &flags, &n) < 6 || n == 0) {
+        return -1;
+    }
+    rec->hdr.flags = flags;
+
+    len = strcspn(line + n, "\n");
+    if (len == 0 || len >= sizeof (rec->path)) {
+        return -1;
+    }
+    memcpy(rec->path, line + n, len);
+    rec->path[len] = '\0';
+
+    return 0;
+}
+
+int index_open(struct tm_index *ix, const char *path) {
+
+    char line[INDEX_LINE_MAX];
+    struct index_rec rec;
+    FILE *fp;
+
+    memset(ix, 0, sizeof (*ix));
+    ix->path = strdup(path);
+    if (ix->path == NULL) {
+        return -1;
+    }
+    ix->pass = 1;
+    ix->next_id = 1;
+
+    /*Carry pass numbers and file IDs on from earlier passes*/
+    fp = fopen(path, "r");
+    if (fp != NULL) {
+        while (fgets(line, sizeof (line), fp) != NULL) {
+            if (parse_rec(line, &rec) < 0) {
+                continue;
+            }
+            if (rec.pass >= ix->pass) {
+                ix->pass = rec.pass + 1;
+            }
+            if (rec.hdr.file_id >= ix->next_id) {
+                ix->next_id = rec.hdr.file_id + 1;
+            }
+        }
+        fclose(fp);
+    }
+
+    ix->fp = fopen(path, "a");
+    if (ix->fp == NULL) {
+        printf("fopen(%s) error=%d %s\n", path, errno, strerror(errno));
+        return -1;
+    }
+
+    printf("Frame index %s, pass %lu, first file ID %lu\n", path, ix->pass, ix->next_id);
+
+    return 0;
+}
+
+void index_close(struct tm_index *ix) {
+
+    if (ix->fp != NULL) {
+        index_sync(ix);
+        fclose(ix->fp);
+        ix->fp = NULL;
+    }
+    free(ix->path);
+    ix->path = NULL;
+}
+
+int index_frame(struct tm_index *ix, const char *name, const struct tm_frame_hdr *hdr, size_t len) {
+
+    if (fprintf(ix->fp, "%lu %lu %lu %lu %zu %x %s\n", ix->pass, hdr->file_id, hdr->seq,
+            hdr->offset, len, hdr->flags, name) < 0) {
+        printf("index write error=%d %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int index_sync(struct tm_index *ix) {
+
+    if (fflush(ix->fp) != 0 || fdatasync(fileno(ix->fp)) < 0) {
+        printf("index sync error=%d %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*Read the retransmit list. Returns the number of requests, or -1*/
+static int read_list(const char *list, struct resend_req **reqs) {
+
+    char line[256];
+    char star;
+    char *p;
+    struct resend_req *r, *grown;
+    int n = 0, size = 0;
+    FILE *fp;
+
+    fp = fopen(list, "r");
+    if (fp == NULL) {
+        printf("fopen(%s) error=%d %s\n", list, errno, strerror(errno));
+        return -1;
+    }
+
+    *reqs = NULL;
+    while (fgets(line, sizeof (line), fp) != NULL) {
+        if ((p = strchr(line, '#')) != NULL) {
+            *p = '\0';
+        }
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[strspn(line, " \t")] == '\0') {
+            continue;
+        }
+
+        if (n == size) {
+            size = size ? 2 * size : 64;
+            grown = realloc(*reqs, size * sizeof (**reqs));
+            if (grown == NULL) {
+                printf("Unable to allocate the retransmit list\n");
+                free(*reqs);
+                fclose(fp);
+                return -1;
+            }
+            *reqs = grown;
+        }
+        r = &(*reqs)[n];
+        memset(r, 0, sizeof (*r));
+
+        if (sscanf(line, "%lu %lu-%lu", &r->file_id, &r->first, &r->last) == 3 && r->first <= r->last) {
+            n++;
+        } else if (sscanf(line, "%lu %lu-%c", &r->file_id, &r->first, &star) == 3 && star == '*') {
+            r->last = r->first;
+            r->whole = 1;
+            n++;
+        } else if (sscanf(line, "%lu %lu", &r->file_id, &r->first) == 2) {
+            r->last = r->first;
+            n++;
+        } else if (sscanf(line, "%lu %c", &r->file_id, &star) == 2 && star == '*') {
+            r->whole = 1;
+            n++;
+        } else {
+            printf("Ignoring retransmit request: %s\n", line);
+        }
+    }
+    fclose(fp);
+
+    return n;
+}
+
+/* Match every index record against the requests. The first scan only sizes
+ * whole-file requests, the second keeps the latest record of each frame.
+ */
+static int scan_index(struct tm_index *ix, struct resend_req *reqs, int nreqs, int fill) {
+
+    char line[INDEX_LINE_MAX];
+    struct index_rec rec;
+    struct resend_req *r;
+    unsigned long i;
+    int k;
+    FILE *fp;
+
+    fp = fopen(ix->path, "r");
+    if (fp == NULL) {
+        printf("fopen(%s) error=%d %s\n", ix->path, errno, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof (line), fp) != NULL) {
+        if (parse_rec(line, &rec) < 0) {
+            continue;
+        }
+
+        for (k = 0; k < nreqs; k++) {
+            r = &reqs[k];
+            if (r->file_id != rec.hdr.file_id) {
+                continue;
+            }
+
+            if (!fill) {
+                if (r->whole && rec.hdr.seq > r->last) {
+                    r->last = rec.hdr.seq;
+                }
+                continue;
+            }
+
+            if (rec.hdr.seq < r->first || rec.hdr.seq > r->last) {
+                continue;
+            }
+            if (r->path == NULL && (r->path = strdup(rec.path)) == NULL) {
+                fclose(fp);
+                return -1;
+            }
+            i = rec.hdr.seq - r->first;
+            r->hdr[i] = rec.hdr;
+            r->found[i] = 1;
+        }
+    }
+    fclose(fp);
+
+    return 0;
+}
+
+/*Read the payload of a frame again. Frames of selected channels are gathered
+ *from a mapping of the file, made on first use*/
+static ssize_t read_frame(int fd, const struct tm_roe_select *sel, unsigned char **map,
+        size_t *map_len, const struct tm_frame_hdr *hdr, unsigned char *buf) {
+
+    struct stat st;
+
+    if (!(hdr->flags & TM_HDR_SELECT)) {
+        return pread(fd, buf, hdr->length, hdr->offset);
+    }
+
+    if (*map == NULL) {
+        if (fstat(fd, &st) < 0 || st.st_size == 0) {
+            return -1;
+        }
+        *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (*map == MAP_FAILED) {
+            printf("mmap error=%d %s\n", errno, strerror(errno));
+            *map = NULL;
+            return -1;
+        }
+        *map_len = st.st_size;
+    }
+
+    return roe_gather(sel, *map, *map_len, hdr->offset, buf, hdr->length);
+}
+
+/*Send the frames found for one request straight out of the file*/
+static int resend_req(struct tm_index *ix, struct tm_framer *fr, const struct tm_roe_select *sel,
+        struct resend_req *r, unsigned char *buf, unsigned char *packed,
+        unsigned long *sent, unsigned long *missing) {
+
+    struct tm_frame_hdr *hdr;
+    unsigned long i;
+    const unsigned char *payload;
+    unsigned char *map = NULL;
+    size_t len, map_len = 0;
+    ssize_t got;
+    int fd = -1, rc = 0;
+
+    for (i = 0; i <= r->last - r->first; i++) {
+        hdr = &r->hdr[i];
+        if (!r->found[i] || hdr->length > fr->frame_size) {
+            printf("Frame %lu of file %lu not in the index\n", r->first + i, r->file_id);
+            (*missing)++;
+            continue;
+        }
+        if ((hdr->flags & TM_HDR_SELECT) && sel == NULL) {
+            printf("Frame %lu of file %lu holds selected channels, give the selection\n",
+                    hdr->seq, r->file_id);
+            (*missing)++;
+            continue;
+        }
+
+        if (fd < 0) {
+            fd = open(r->path, O_RDONLY);
+            if (fd < 0) {
+                printf("open(%s) error=%d %s\n", r->path, errno, strerror(errno));
+                *missing += r->last - r->first + 1 - i;
+                return 0;
+            }
+        }
+
+        got = read_frame(fd, sel, &map, &map_len, hdr, buf);
+        if (got != (ssize_t) hdr->length) {
+            printf("Frame %lu of file %lu no longer in %s\n", hdr->seq, r->file_id, r->path);
+            (*missing)++;
+            continue;
+        }
+
+        /*Compressed frames are compressed again, the same bytes give the same payload*/
+        payload = buf;
+        len = hdr->length;
+        if (hdr->flags & TM_HDR_RICE) {
+            len = rice_encode(buf, hdr->length, packed);
+            if (len > 0) {
+                payload = packed;
+            } else {
+                hdr->flags &= ~TM_HDR_RICE;
+                len = hdr->length;
+            }
+        }
+
+        /*The file checksum is not known here, the ground keeps the one it has*/
+        hdr->flags &= ~TM_HDR_CRC;
+        rc = framer_write_frame(fr, hdr, payload, len, NULL);
+        if (rc < 0) {
+            break;
+        }
+        index_frame(ix, r->path, hdr, hdr->length);
+        (*sent)++;
+    }
+
+    if (map != NULL) {
+        munmap(map, map_len);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return rc;
+}
+
+int index_resend(struct tm_index *ix, struct tm_framer *fr, const struct tm_roe_select *sel,
+        const char *list) {
+
+    struct resend_req *reqs;
+    unsigned char *buf, *packed;
+    unsigned long n, sent = 0, missing = 0;
+    int nreqs, k, rc;
+
+    nreqs = read_list(list, &reqs);
+    if (nreqs <= 0) {
+        return nreqs;
+    }
+
+    buf = malloc(fr->frame_size);
+    packed = malloc(fr->frame_size);
+    rc = (buf == NULL || packed == NULL) ? -1 : 0;
+
+    if (rc == 0) {
+        fflush(ix->fp);
+        rc = scan_index(ix, reqs, nreqs, 0);
+    }
+    for (k = 0; k < nreqs && rc == 0; k++) {
+        n = reqs[k].last - reqs[k].first + 1;
+        reqs[k].hdr = calloc(n, sizeof (*reqs[k].hdr));
+        reqs[k].found = calloc(n, 1);
+        if (reqs[k].hdr == NULL || reqs[k].found == NULL) {
+            printf("Unable to allocate %lu retransmit frames\n", n);
+            rc = -1;
+        }
+    }
+    if (rc == 0) {
+        rc = scan_index(ix, reqs, nreqs, 1);
+    }
+
+    for (k = 0; k < nreqs && rc == 0; k++) {
+        rc = resend_req(ix, fr, sel, &reqs[k], buf, packed, &sent, &missing);
+    }
+    if (rc == 0) {
+        rc = framer_end_file(fr);
+    }
+    if (rc == 0) {
+        index_sync(ix);
+        printf("Retransmitted %lu frames, %lu not found\n", sent, missing);
+    }
+
+    for (k = 0; k < nreqs; k++) {
+        free(reqs[k].path);
+        free(reqs[k].hdr);
+        free(reqs[k].found);
+    }
+    free(reqs);
+    free(buf);
+    free(packed);
+
+    return rc;
+}
@@ -0,0 +1,59 @@
+/********************************************************************************
+ * MOSES telemetry downlink frame index
+ *
+ * Every frame queued to the SyncLink is appended to an index file on disk, one
+ * line per frame:
+ *
+ *   <pass> <file_id> <seq> <offset> <length> <flags> <path>
+ *
+ * A pass is one run of sendTM. File IDs continue from the highest one in the
+ * index, so a (file_id, seq) pair names the same frame across passes. When
+ * the ground station uplinks a list of frames it did not receive, a later
+ * pass looks each one up and sends just those frames again, unchanged, in
+ * place of the whole file. The length is the file bytes a frame carries,
+ * before any compression.
+ *
+ * The retransmit list has one request per line, '#' starting a comment:
+ *
+ *   <file_id> <seq>            a single frame
+ *   <file_id> <first>-<last>   a run of frames
+ *   <file_id> <first>-*        every frame of the file from first on
+ *   <file_id> *                every frame of the file
+ *
+ ******************************************************************************/
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdio.h>
+
+#include "frame.h"
+#include "roe.h"
+
+/*Default index location, change with -x*/
+#define TM_INDEX_FILE "/tmp/sendTM.index"
+
+struct tm_index {
+    char *path;
+    FILE *fp;                   //opened for appending
+    unsigned long pass;         //this run's pass number
+    unsigned long next_id;      //first file ID not used by an earlier pass
+};
+
+/*Scan an existing index (or start a new one) and open it for appending*/
+int index_open(struct tm_index *ix, const char *path);
+void index_close(struct tm_index *ix);
+
+/*Record one frame just queued to the driver, carrying len bytes of the file*/
+int index_frame(struct tm_index *ix, const char *name, const struct tm_frame_hdr *hdr, size_t len);
+
+/*Make the records of a completed file durable*/
+int index_sync(struct tm_index *ix);
+
+/*Send again every frame named in the retransmit list, as last recorded. Frames of
+ *selected image channels need the selection they were sent with, in sel. Returns 0
+ *once each one found was queued, or the first write error*/
+int index_resend(struct tm_index *ix, struct tm_framer *fr, const struct tm_roe_select *sel,
+        const char *list);
+
+#endif /* INDEX_H */
@@ -0,0 +1,359 @@
+/********************************************************************************
+ * MOSES telemetry downlink library
+ *
+ * See libsendtm.h.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <limits.h>
+#include <memory.h>
+
+#include "libsendtm.h"
+#include "rt.h"
+
+int sendtm_init(struct tm_sender *s, struct tm_config *cfg) {
+
+    memset(s, 0, sizeof (*s));
+    s->cfg = cfg;
+    stats_init(&s->stats);
+    queue_init(&s->queue);
+
+    /* Number files on from the last pass, so the ground station can name any frame
+     * it missed by file ID and sequence number in a later retransmit list.
+     */
+    if (cfg->index != NULL && index_open(&s->index, cfg->index) == 0) {
+        s->indexed = &s->index;
+        queue_set_first_id(&s->queue, s->index.next_id);
+    } else {
+        printf("Continuing without a frame index\n");
+    }
+
+    /* Resumed files keep the IDs they first went down with, so new files are
+     * numbered past every ID in the journal.
+     */
+    if (cfg->checkpoint != NULL && checkpoint_open(&s->checkpoint, cfg->checkpoint) == 0) {
+        s->checkpointed = &s->checkpoint;
+        if (s->indexed == NULL || s->checkpoint.next_id > s->index.next_id) {
+            queue_set_first_id(&s->queue, s->checkpoint.next_id);
+        }
+    } else if (cfg->checkpoint != NULL) {
+        checkpoint_close(&s->checkpoint);
+        printf("Continuing without checkpoints\n");
+    }
+
+    if (cfg->filler != NULL && filler_init(&s->filler, cfg->filler) == 0) {
+        s->filling = &s->filler;
+    }
+
+    /*On unless turned off, so there is a timeline of any run that goes wrong*/
+    if (cfg->trace != NULL && trace_open(&s->trace, cfg->trace) == 0) {
+        s->tracing = &s->trace;
+        s->stats.trace = s->tracing;
+    } else if (cfg->trace != NULL) {
+        printf("Continuing without a trace\n");
+    }
+
+    return 0;
+}
+
+int sendtm_open(struct tm_sender *s, int skip_bad_files) {
+
+    struct tm_config *cfg = s->cfg;
+    struct tm_device *devs[TM_MAX_PORTS];
+    int fds[TM_MAX_PORTS];
+    int i, rc;
+
+    /* Forward error correction, off unless asked for since parity takes link time
+     * from the science data.
+     */
+    if (cfg->fec_k > 0) {
+        if (fec_code_init(&s->fec, cfg->fec_k, cfg->fec_m) < 0) {
+            return -1;
+        }
+        s->fec_ready = 1;
+    }
+
+    /* Allocate every transmit buffer once, up front, so memory use does not grow
+     * with the length of the downlink queue.
+     */
+    rc = pool_init(&s->pool, cfg->buffers, cfg->frame_size * cfg->chunk_frames);
+    if (rc < 0) {
+        printf("Unable to allocate %d transmit buffers\n", cfg->buffers);
+        return rc;
+    }
+    s->pool_ready = 1;
+
+    /* Configure the SyncLink once, every port of it when striping. It then stays
+     * configured, with the transmitter enabled, until sendtm_close().
+     */
+    for (i = 0; i < cfg->nports; i++) {
+        config_port(cfg, i, &s->port[i]);
+        rc = device_open(&s->port[i]); //The ground station's receiver has to match
+        if (rc < 0) {
+            return rc;
+        }
+        fds[i] = s->port[i].fd;
+
+        /*Log DCD, CTS and DSR changes as they happen*/
+        rc = link_start(&s->link[i], s->port[i].fd, s->port[i].name,
+                cfg->link_signal);
+        s->opened = i + 1;
+        if (rc < 0) {
+            return rc;
+        }
+        s->links[i] = &s->link[i];
+    }
+
+    /* Report throughput, write()/tcdrain() latency and the driver's own transmit
+     * counters every stats_interval seconds while the link runs.
+     */
+    rc = stats_start(&s->stats, fds, cfg->nports, cfg->stats_interval);
+    if (rc < 0) {
+        return rc;
+    }
+    s->stats_running = 1;
+
+    if (s->tracing != NULL && trace_start(s->tracing) < 0) {
+        return -1;
+    }
+
+    /*Journal checkpoints off the transmit thread*/
+    if (s->checkpointed != NULL && checkpoint_run(s->checkpointed) < 0) {
+        return -1;
+    }
+
+    /* Keep just enough frames queued in each driver to ride out USB hiccups*/
+    for (i = 0; i < cfg->nports; i++) {
+        flow_init(&s->flow[i], s->port[i].fd, s->port[i].params.clock_speed, cfg->frame_size);
+        flow_set_depth(&s->flow[i], cfg->flow_min, cfg->flow_max);
+        s->flow[i].trace = s->tracing;
+        s->flows[i] = cfg->flow ? &s->flow[i] : NULL;
+    }
+
+    /* The bit rate changes between chunks on request or, with rate_auto, as the
+     * driver's error counts allow.
+     */
+    for (i = 0; i < cfg->nports; i++) {
+        devs[i] = &s->port[i];
+    }
+    rate_init(&s->rate, devs, s->flows, cfg->nports, cfg->frame_size, cfg->rates, cfg->nrates,
+            cfg->rate_auto);
+    s->rate_ready = 1;
+
+    /* With more than one port, a writer thread per port takes each frame as its
+     * port frees up, so the ports run in parallel at their own rates.
+     */
+    if (cfg->nports > 1) {
+        rc = stripe_start(&s->stripe, cfg->nports, fds, s->flows, s->links,
+                HDLC_MAX_FRAME_SIZE, &s->stats);
+        if (rc < 0) {
+            return rc;
+        }
+        s->striping = 1;
+        if (cfg->rt_priority > 0) {
+            stripe_set_priority(&s->stripe, cfg->rt_priority);
+        }
+    }
+
+    /* A reader thread loads each file in chunks into a ring of buffers while a
+     * transmit thread sends the chunks to the device via write calls, so the
+     * link keeps running while the next chunk is read from disk.
+     */
+    s->pl.fd = s->port[0].fd;
+    s->pl.frame_size = cfg->frame_size;
+    s->pl.source = cfg->source;
+    s->pl.pool = &s->pool;
+    s->pl.queue = &s->queue;
+    s->pl.skip_bad_files = skip_bad_files;
+    s->pl.stats = &s->stats;
+    s->pl.flow = s->flows[0];
+    s->pl.stripe = s->striping ? &s->stripe : NULL;
+    s->pl.link = s->links[0];
+    s->pl.rt_priority = cfg->rt_priority;
+    s->pl.lock_memory = cfg->lock_memory;
+    s->pl.index = s->indexed;
+    s->pl.fec = s->fec_ready ? &s->fec : NULL;
+    s->pl.compress = cfg->compress;
+    s->pl.preview = cfg->preview;
+    s->pl.checkpoint = s->checkpointed;
+    s->pl.rate = &s->rate;
+    s->pl.filler = s->filling;
+    s->pl.trace = s->tracing;
+    s->pl.select = cfg->selected ? &cfg->select : NULL;
+
+    return 0;
+}
+
+static void *sender_thread(void *arg) {
+
+    struct tm_sender *s = arg;
+
+    s->rc = pipeline_run(&s->pl);
+
+    /*The whole queue is down, nothing is left to resume*/
+    if (s->rc == 0 && s->checkpointed != NULL) {
+        checkpoint_clear(s->checkpointed);
+    }
+    return NULL;
+}
+
+int sendtm_start(struct tm_sender *s) {
+
+    int rc;
+
+    rc = pthread_create(&s->thread, NULL, sender_thread, s);
+    if (rc != 0) {
+        printf("pthread_create(sender) error=%d %s\n", rc, strerror(rc));
+        return -1;
+    }
+    s->running = 1;
+    return 0;
+}
+
+unsigned long sendtm_enqueue_file(struct tm_sender *s, const char *name, int prio,
+        tm_file_done done, void *arg) {
+
+    if (prio < 0) {
+        prio = sched_classify(name);
+    }
+    return queue_push_async(&s->queue, name, NULL, TM_FILE_WHOLE, prio, sched_file_flags(name),
+            done, arg);
+}
+
+unsigned long sendtm_enqueue_buffer(struct tm_sender *s, const char *name,
+        const unsigned char *data, size_t len, int prio, int flags, tm_file_done done, void *arg) {
+
+    if (len > TM_FILE_MAX) {
+        printf("%s is too large to queue (%lu Bytes)\n", name, (unsigned long) len);
+        return 0;
+    }
+    if (prio < 0) {
+        prio = sched_classify(name);
+    }
+    return queue_push_async(&s->queue, name, data, (int) len, prio, flags, done, arg);
+}
+
+void sendtm_set_rate(struct tm_sender *s, unsigned long bps) {
+
+    if (s->rate_ready) {
+        rate_request(&s->rate, bps);
+    }
+}
+
+struct resume_ctx {
+    struct tm_sender *s;
+    int n;
+};
+
+static void resume_file(const char *path, void *arg) {
+
+    struct resume_ctx *ctx = arg;
+
+    if (sendtm_enqueue_file(ctx->s, path, -1, NULL, NULL) != 0) {
+        printf("Queued %s again to finish it\n", path);
+        ctx->n++;
+    }
+}
+
+int sendtm_resume(struct tm_sender *s) {
+
+    struct resume_ctx ctx = {s, 0};
+
+    if (s->checkpointed != NULL) {
+        checkpoint_unfinished(s->checkpointed, resume_file, &ctx);
+    }
+    return ctx.n;
+}
+
+int sendtm_resend(struct tm_sender *s, const char *list) {
+
+    struct tm_framer fr;
+    int rc;
+
+    if (s->indexed == NULL) {
+        printf("Resending needs the frame index\n");
+        return -1;
+    }
+
+    /* Retransmission pass: only the frames the ground station did not receive,
+     * with the headers they were first sent with.
+     */
+    rc = framer_init(&fr, s->pl.fd, s->pl.frame_size);
+    if (rc < 0) {
+        return rc;
+    }
+    fr.stats = s->pl.stats;
+    fr.flow = s->pl.flow;
+    fr.stripe = s->pl.stripe;
+    fr.link = s->pl.link;
+    if (s->pl.rt_priority > 0 && s->pl.stripe == NULL) {
+        rt_promote(pthread_self(), s->pl.rt_priority, "resend");
+    }
+    rc = index_resend(s->indexed, &fr, s->pl.select, list);
+    framer_destroy(&fr);
+
+    return rc;
+}
+
+int sendtm_wait(struct tm_sender *s) {
+
+    if (s->running) {
+        pthread_join(s->thread, NULL);
+        s->running = 0;
+    }
+    return s->rc;
+}
+
+int sendtm_stop(struct tm_sender *s) {
+
+    queue_close(&s->queue);
+    return sendtm_wait(s);
+}
+
+int sendtm_close(struct tm_sender *s) {
+
+    int i, rc = 0;
+
+    sendtm_stop(s);
+    if (s->striping) {
+        stripe_stop(&s->stripe);
+    }
+    if (s->stats_running) {
+        stats_stop(&s->stats); //Final STATS line
+    }
+    if (s->indexed != NULL) {
+        index_close(s->indexed);
+    }
+    if (s->checkpointed != NULL) {
+        checkpoint_close(s->checkpointed);
+    }
+    if (s->filling != NULL) {
+        filler_destroy(s->filling);
+    }
+    if (s->tracing != NULL) {
+        trace_close(s->tracing); //Every thread logging to it is stopped by now
+    }
+
+    for (i = 0; i < s->opened; i++) {
+        link_stop(&s->link[i]);
+        if (device_close(&s->port[i]) < 0) {
+            rc = -1;
+        }
+    }
+
+    /* Release the transmit buffers, calling back for any file never sent*/
+    stats_destroy(&s->stats);
+    if (s->fec_ready) {
+        fec_code_destroy(&s->fec);
+    }
+    if (s->rate_ready) {
+        rate_destroy(&s->rate);
+    }
+    if (s->pool_ready) {
+        pool_destroy(&s->pool);
+    }
+    queue_destroy(&s->queue);
+
+    return rc;
+}
@@ -0,0 +1,111 @@
+/********************************************************************************
+ * MOSES telemetry downlink library
+ *
+ * Everything sendTM does between its command line and the wire, for flight
+ * software that wants to downlink from its own process: device bring-up of
+ * every port, link watching, flow control, rate control, striping, the frame index, FEC,
+ * checkpoints, the idle filler, tracing, the buffer pool, the downlink queue and the
+ * pipeline threads. sendTM itself is a thin front end over it.
+ *
+ * Files are queued asynchronously, each with an optional callback run once it
+ * is on the wire or has been dropped. A buffer already in memory, such as an
+ * image straight off the camera, is queued the same way and framed in place,
+ * without first being written to and read back from the SD card.
+ *
+ * A sender goes through sendtm_init(), sendtm_open(), then sendtm_start() or
+ * sendtm_resend(), and finally sendtm_stop() and sendtm_close(). Anything that
+ * must start before the first thread, like watch_start(), goes between
+ * sendtm_init() and sendtm_open().
+ *
+ ******************************************************************************/
+
+#ifndef LIBSENDTM_H
+#define LIBSENDTM_H
+
+#include <pthread.h>
+
+#include "config.h"
+#include "device.h"
+#include "pipeline.h"
+#include "stripe.h"
+
+struct tm_sender {
+    struct tm_config *cfg;      //settings, kept by the caller for the sender's lifetime
+    struct tm_device port[TM_MAX_PORTS];
+    struct tm_link link[TM_MAX_PORTS];
+    struct tm_link *links[TM_MAX_PORTS];
+    struct tm_flow flow[TM_MAX_PORTS];
+    struct tm_flow *flows[TM_MAX_PORTS];
+    struct tm_stripe stripe;    //if cfg->nports > 1
+    struct tm_pool pool;
+    struct tm_queue queue;
+    struct tm_stats stats;
+    struct tm_index index;
+    struct tm_index *indexed;   //&index when the frame index is open, or NULL
+    struct tm_checkpoint checkpoint;
+    struct tm_checkpoint *checkpointed; //&checkpoint when the journal is open, or NULL
+    struct tm_fec_code fec;     //if cfg->fec_k > 0
+    struct tm_rate rate;        //bit rate of every port
+    struct tm_filler filler;
+    struct tm_filler *filling;  //&filler when cfg names a backlog, or NULL
+    struct tm_trace trace;
+    struct tm_trace *tracing;   //&trace when the trace file is open, or NULL
+    struct tm_pipeline pl;
+    pthread_t thread;           //runs the pipeline after sendtm_start()
+    int fec_ready;
+    int rate_ready;
+    int pool_ready;
+    int opened;                 //ports configured, as far as sendtm_open() got
+    int stats_running;
+    int striping;
+    int running;                //pipeline thread started and not yet joined
+    int rc;                     //result of the pipeline run
+};
+
+/*Create the queue and open the frame index, checkpoint journal, backlog and trace,
+ *if cfg names them. Starts no thread*/
+int sendtm_init(struct tm_sender *s, struct tm_config *cfg);
+
+/*Configure every port and allocate the buffers. skip_bad_files as in struct tm_pipeline*/
+int sendtm_open(struct tm_sender *s, int skip_bad_files);
+
+/*Send queued files from a thread of the sender's own until sendtm_stop()*/
+int sendtm_start(struct tm_sender *s);
+
+/* Queue a file to be sent whole. prio is a TM_PRIO_* class, or -1 to class it by
+ * name as sched_classify() does. done, if not NULL, is called with the file's
+ * TM_FILE_* status once it is sent or dropped. Returns the file ID, or 0.
+ */
+unsigned long sendtm_enqueue_file(struct tm_sender *s, const char *name, int prio,
+        tm_file_done done, void *arg);
+
+/* Queue len bytes at data to be sent as a file called name, with TM_FILE_* flags.
+ * data must stay unchanged until done is called, which it always is if this
+ * returns a file ID rather than 0.
+ */
+unsigned long sendtm_enqueue_buffer(struct tm_sender *s, const char *name,
+        const unsigned char *data, size_t len, int prio, int flags, tm_file_done done, void *arg);
+
+/* Queue again every file the run before this one left unfinished, for senders
+ * fed at runtime, whose files are not queued again by the caller. Returns the
+ * number of files queued.
+ */
+int sendtm_resume(struct tm_sender *s);
+
+/*Move every port to bps between two chunks, see rate.h. Any thread*/
+void sendtm_set_rate(struct tm_sender *s, unsigned long bps);
+
+/*Send again the frames in list from the index, in the calling thread, see index.h*/
+int sendtm_resend(struct tm_sender *s, const char *list);
+
+/*Wait for the pipeline to finish the queue once something else closes it, returning
+ *0 or the first error*/
+int sendtm_wait(struct tm_sender *s);
+
+/*Close the queue, then sendtm_wait()*/
+int sendtm_stop(struct tm_sender *s);
+
+/*Stop every thread and release the ports, buffers, index and journal*/
+int sendtm_close(struct tm_sender *s);
+
+#endif /* LIBSENDTM_H */
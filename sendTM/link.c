@@ -0,0 +1,285 @@
+/********************************************************************************
+ * MOSES telemetry downlink link waits and events
+ *
+ * See link.h.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <memory.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+
+#include "link.h"
+
+/*The wake signal's handler, shared by every watcher*/
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static int wake_users;
+static int wake_sig;
+static struct sigaction wake_old; //the application's, put back with the last watcher
+
+static void wake_handler(int sig) {
+
+    (void) sig;
+}
+
+/*Install the handler of sig, or count one more watcher using it. Returns 0 or -1*/
+static int wake_install(int sig) {
+
+    struct sigaction sa;
+    int rc = 0;
+
+    pthread_mutex_lock(&wake_lock);
+    if (wake_users > 0 && sig != wake_sig) {
+        printf("Link watchers already stop on signal %d, not %d\n", wake_sig, sig);
+        rc = -1;
+    } else if (wake_users == 0) {
+
+        /*No SA_RESTART, so the signal ends the watcher's wait with EINTR*/
+        memset(&sa, 0, sizeof (sa));
+        sa.sa_handler = wake_handler;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(sig, &sa, &wake_old) < 0) {
+            printf("sigaction(%d) error=%d %s\n", sig, errno, strerror(errno));
+            rc = -1;
+        }
+        wake_sig = sig;
+    }
+    if (rc == 0) {
+        wake_users++;
+    }
+    pthread_mutex_unlock(&wake_lock);
+
+    return rc;
+}
+
+/*Put the application's handler back once no watcher is left*/
+static void wake_release(void) {
+
+    pthread_mutex_lock(&wake_lock);
+    if (--wake_users == 0) {
+        sigaction(wake_sig, &wake_old, NULL);
+    }
+    pthread_mutex_unlock(&wake_lock);
+}
+
+/*MgslEvent_*Active bits for the inputs currently up*/
+static int read_signals(int fd) {
+
+    int sigs = 0, events = 0;
+
+    if (ioctl(fd, TIOCMGET, &sigs) < 0) {
+        return 0;
+    }
+    if (sigs & TIOCM_CAR) {
+        events |= MgslEvent_DcdActive;
+    }
+    if (sigs & TIOCM_CTS) {
+        events |= MgslEvent_CtsActive;
+    }
+    if (sigs & TIOCM_DSR) {
+        events |= MgslEvent_DsrActive;
+    }
+    return events;
+}
+
+static void log_signals(const struct tm_link *lk, int signals) {
+
+    printf("LINK port=%s dcd=%d cts=%d dsr=%d\n", lk->name,
+            (signals & MgslEvent_DcdActive) != 0, (signals & MgslEvent_CtsActive) != 0,
+            (signals & MgslEvent_DsrActive) != 0);
+}
+
+static void *link_thread(void *arg) {
+
+    struct tm_link *lk = arg;
+    int mask, signals, stop;
+    sigset_t set;
+
+    /*Even should the application block it everywhere else*/
+    sigemptyset(&set);
+    sigaddset(&set, lk->wake_signal);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+
+    for (;;) {
+        mask = TM_LINK_EVENTS;
+        if (ioctl(lk->fd, MGSL_IOCWAITEVENT, &mask) < 0) {
+            pthread_mutex_lock(&lk->lock);
+            stop = lk->stop;
+            pthread_mutex_unlock(&lk->lock);
+            if (errno == EINTR && !stop) {
+                continue;
+            }
+            if (errno != EINTR) {
+                printf("ioctl(MGSL_IOCWAITEVENT) error=%d %s\n", errno, strerror(errno));
+            }
+            break;
+        }
+
+        /*mask holds the events that occurred, the state now is read back*/
+        signals = read_signals(lk->fd);
+        pthread_mutex_lock(&lk->lock);
+        lk->signals = signals;
+        lk->changes++;
+        pthread_mutex_unlock(&lk->lock);
+        log_signals(lk, signals);
+    }
+
+    pthread_mutex_lock(&lk->lock);
+    lk->watching = 0;
+    pthread_mutex_unlock(&lk->lock);
+    return NULL;
+}
+
+int link_start(struct tm_link *lk, int fd, const char *name, int wake_signal) {
+
+    int mask = 0, rc;
+
+    memset(lk, 0, sizeof (*lk));
+    lk->fd = fd;
+    lk->name = name;
+    lk->wake_signal = wake_signal;
+    pthread_mutex_init(&lk->lock, NULL);
+
+    /*A zero mask returns at once on drivers that support the call*/
+    if (wake_signal == 0 || ioctl(fd, MGSL_IOCWAITEVENT, &mask) < 0) {
+        return 0;
+    }
+    if (wake_install(wake_signal) < 0) {
+        printf("Modem signals of %s not watched\n", name);
+        return 0;
+    }
+
+    lk->signals = read_signals(fd);
+    log_signals(lk, lk->signals);
+
+    lk->watching = 1;
+    rc = pthread_create(&lk->thread, NULL, link_thread, lk);
+    if (rc != 0) {
+        printf("pthread_create(link) error=%d %s\n", rc, strerror(rc));
+        lk->watching = 0;
+        wake_release();
+        return -1;
+    }
+    lk->started = 1;
+    return 0;
+}
+
+void link_stop(struct tm_link *lk) {
+
+    int watching = 1;
+
+    if (!lk->started) {
+        pthread_mutex_destroy(&lk->lock);
+        return;
+    }
+
+    pthread_mutex_lock(&lk->lock);
+    lk->stop = 1;
+    pthread_mutex_unlock(&lk->lock);
+
+    /*Repeated in case the signal lands just before the thread enters its wait*/
+    while (watching) {
+        pthread_kill(lk->thread, lk->wake_signal);
+        usleep(10000);
+        pthread_mutex_lock(&lk->lock);
+        watching = lk->watching;
+        pthread_mutex_unlock(&lk->lock);
+    }
+    pthread_join(lk->thread, NULL);
+    wake_release();
+    pthread_mutex_destroy(&lk->lock);
+}
+
+/*Sleep until fd has room for a frame, logging long waits*/
+static int wait_writable(struct tm_link *lk, int fd) {
+
+    struct pollfd pfd;
+    int waited = 0, signals, rc;
+
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    for (;;) {
+        rc = poll(&pfd, 1, TM_LINK_STALL_MS);
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rc < 0) {
+            printf("poll error=%d %s\n", errno, strerror(errno));
+            return -1;
+        }
+        if (rc > 0) {
+            return (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) ? -1 : 0;
+        }
+
+        waited += TM_LINK_STALL_MS;
+        if (lk != NULL) {
+            pthread_mutex_lock(&lk->lock);
+            signals = lk->signals;
+            pthread_mutex_unlock(&lk->lock);
+            printf("Transmitter on %s stalled for %d ms (dcd=%d cts=%d)\n", lk->name, waited,
+                    (signals & MgslEvent_DcdActive) != 0, (signals & MgslEvent_CtsActive) != 0);
+        } else {
+            printf("Transmitter stalled for %d ms\n", waited);
+        }
+    }
+}
+
+int link_write(struct tm_link *lk, int fd, const unsigned char *frame, size_t len) {
+
+    ssize_t rc;
+
+    for (;;) {
+        rc = write(fd, frame, len);
+        if (rc >= 0) {
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            printf("write error=%d %s\n", errno, strerror(errno));
+            return -1;
+        }
+        if (wait_writable(lk, fd) < 0) {
+            return -1;
+        }
+    }
+
+    /*N_HDLC accepts or rejects a frame as a whole*/
+    if ((size_t) rc != len) {
+        printf("short frame write (%d of %d bytes)\n", (int) rc, (int) len);
+        return -1;
+    }
+    return 0;
+}
+
+int link_drain(int fd, struct tm_flow *fl) {
+
+    unsigned long left;
+    int rc;
+
+    /*Done once the driver has counted every frame as sent, aborted or timed out*/
+    if (fl != NULL && fl->enabled) {
+        while ((left = flow_in_flight(fl)) > 0) {
+            usleep(fl->poll_us * 4 * left); //A frame time per frame still queued
+        }
+        if (fl->enabled) {
+            return 0;
+        }
+    }
+
+    /*A sink that is not a tty has nothing to drain*/
+    rc = tcdrain(fd);
+    if (rc < 0 && errno == ENOTTY) {
+        rc = 0;
+    }
+    if (rc < 0) {
+        printf("tcdrain error=%d %s\n", errno, strerror(errno));
+    }
+    return rc;
+}
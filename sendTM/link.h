@@ -0,0 +1,72 @@
+/********************************************************************************
+ * MOSES telemetry downlink link waits and events
+ *
+ * The SyncLink is left non-blocking from open() on. A frame that finds the
+ * driver's transmit buffers full gets EAGAIN, and the writer then sleeps in
+ * poll() until the driver has room, so write() never blocks. The end of a
+ * file no longer waits in tcdrain() either: with the driver's transmit
+ * counters available (see flow.h) the writer sleeps one frame time at a time
+ * until every frame written has been sent, and only falls back to tcdrain()
+ * on devices without them.
+ *
+ * A watcher thread per device sleeps in MGSL_IOCWAITEVENT for changes of the
+ * DCD, CTS and DSR inputs and logs each one,
+ *
+ *   LINK port=<dev> dcd=<0|1> cts=<0|1> dsr=<0|1>
+ *
+ * so a receiver dropping off the far end shows up in the log when it happens
+ * rather than as an unexplained stall. A writer that waits on the driver for
+ * more than TM_LINK_STALL_MS says so along with the last known signal state.
+ *
+ * Only a signal ends the watcher's wait, so stopping it takes one the
+ * application does not otherwise use, TM_LINK_WAKE_SIGNAL unless it picks
+ * another. Its handler is installed while any watcher runs, and the one it
+ * replaced is put back once the last watcher stops.
+ *
+ ******************************************************************************/
+
+#ifndef LINK_H
+#define LINK_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "flow.h"
+
+/*A wait for room in the driver longer than this is logged*/
+#define TM_LINK_STALL_MS 1000
+
+/*Default signal that ends a watcher's wait so it can stop*/
+#define TM_LINK_WAKE_SIGNAL (SIGRTMIN + 4)
+
+/*Modem signals watched*/
+#define TM_LINK_EVENTS (MgslEvent_Dcd | MgslEvent_Cts | MgslEvent_Dsr)
+
+struct tm_link {
+    int fd;                     //configured SyncLink device
+    const char *name;           //for the log
+    int signals;                //MgslEvent_*Active bits of the inputs as last seen
+    unsigned long changes;      //signal changes seen by the watcher
+    int wake_signal;            //delivered to the watcher to stop it
+    int started;                //watcher thread created
+    int watching;               //nonzero while the watcher thread runs
+    int stop;                   //under lock, like the rest
+    pthread_t thread;
+    pthread_mutex_t lock;
+};
+
+/* Start watching the modem signals of fd, stopping the watcher with wake_signal.
+ * Devices without MGSL_IOCWAITEVENT are not watched, which is not an error, and
+ * neither are any with wake_signal 0.
+ */
+int link_start(struct tm_link *lk, int fd, const char *name, int wake_signal);
+void link_stop(struct tm_link *lk);
+
+/*Write a whole frame, waiting in poll() while the driver is full. lk may be NULL*/
+int link_write(struct tm_link *lk, int fd, const unsigned char *frame, size_t len);
+
+/*Wait until every frame written to fd is on the wire. fl may be NULL*/
+int link_drain(int fd, struct tm_flow *fl);
+
+#endif /* LINK_H */
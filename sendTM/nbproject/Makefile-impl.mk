@@ -31,7 +31,7 @@ DEFAULTCONF=Debug
 CONF=${DEFAULTCONF}
 
 # All Configurations
-ALLCONFS=Debug Release fd 
+ALLCONFS=Debug Release fd Bench Lib Rcv Trace 
 
 
 # build
@@ -30,6 +30,38 @@ CND_ARTIFACT_PATH_fd=dist/fd/GNU-Linux-x86/sendtm
 CND_PACKAGE_DIR_fd=dist/fd/GNU-Linux-x86/package
 CND_PACKAGE_NAME_fd=sendtm.tar
 CND_PACKAGE_PATH_fd=dist/fd/GNU-Linux-x86/package/sendtm.tar
+# Bench configuration
+CND_PLATFORM_Bench=GNU-Linux-x86
+CND_ARTIFACT_DIR_Bench=dist/Bench/GNU-Linux-x86
+CND_ARTIFACT_NAME_Bench=sendtm-bench
+CND_ARTIFACT_PATH_Bench=dist/Bench/GNU-Linux-x86/sendtm-bench
+CND_PACKAGE_DIR_Bench=dist/Bench/GNU-Linux-x86/package
+CND_PACKAGE_NAME_Bench=sendtm.tar
+CND_PACKAGE_PATH_Bench=dist/Bench/GNU-Linux-x86/package/sendtm.tar
+# Lib configuration
+CND_PLATFORM_Lib=GNU-Linux-x86
+CND_ARTIFACT_DIR_Lib=dist/Lib/GNU-Linux-x86
+CND_ARTIFACT_NAME_Lib=libsendtm.a
+CND_ARTIFACT_PATH_Lib=dist/Lib/GNU-Linux-x86/libsendtm.a
+CND_PACKAGE_DIR_Lib=dist/Lib/GNU-Linux-x86/package
+CND_PACKAGE_NAME_Lib=sendtm.tar
+CND_PACKAGE_PATH_Lib=dist/Lib/GNU-Linux-x86/package/sendtm.tar
+# Rcv configuration
+CND_PLATFORM_Rcv=GNU-Linux-x86
+CND_ARTIFACT_DIR_Rcv=dist/Rcv/GNU-Linux-x86
+CND_ARTIFACT_NAME_Rcv=rcvtm
+CND_ARTIFACT_PATH_Rcv=dist/Rcv/GNU-Linux-x86/rcvtm
+CND_PACKAGE_DIR_Rcv=dist/Rcv/GNU-Linux-x86/package
+CND_PACKAGE_NAME_Rcv=sendtm.tar
+CND_PACKAGE_PATH_Rcv=dist/Rcv/GNU-Linux-x86/package/sendtm.tar
+# Trace configuration
+CND_PLATFORM_Trace=GNU-Linux-x86
+CND_ARTIFACT_DIR_Trace=dist/Trace/GNU-Linux-x86
+CND_ARTIFACT_NAME_Trace=tracetm
+CND_ARTIFACT_PATH_Trace=dist/Trace/GNU-Linux-x86/tracetm
+CND_PACKAGE_DIR_Trace=dist/Trace/GNU-Linux-x86/package
+CND_PACKAGE_NAME_Trace=sendtm.tar
+CND_PACKAGE_PATH_Trace=dist/Trace/GNU-Linux-x86/package/sendtm.tar
 #
 # include compiler specific variables
 #
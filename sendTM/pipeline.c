@@ -0,0 +1,1030 @@
+/********************************************************************************
+ * MOSES telemetry downlink read/transmit pipeline
+ *
+ * See pipeline.h. The reader thread is the only producer and the transmit
+ * thread the only consumer of the rings. Neither blocks on a single ring:
+ * each samples its event counter, scans every class in priority order, and
+ * sleeps only when no class can make progress. When the transmitter fails it
+ * sets stop, and the reader gives up at its next scan. The compression
+ * thread, when there is one, is the consumer of the reader's rings and the
+ * producer of the transmit rings, and follows the same rules.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "pipeline.h"
+#include "preview.h"
+#include "rt.h"
+
+/*Returned by the stream functions when the file could not be opened*/
+#define READ_OPEN_FAILED 1
+
+/*Returned by stream_fill() when no pool buffer is free yet*/
+#define READ_NO_BUFFER 2
+
+/*Returned by stream_open() for a file an earlier run already sent whole*/
+#define READ_SKIP 3
+
+/*Returned by compress_chunk() when no compression buffer is free yet*/
+#define COMP_NO_BUFFER 1
+
+/*A file the reader is part way through loading*/
+struct tm_stream {
+    struct tm_file *file;       //NULL when the class is idle
+    FILE *fp;                   //TM_SOURCE_READ
+    unsigned char *map;         //TM_SOURCE_MMAP, or a selected image
+    size_t map_len;
+    int borrowed;               //map is the caller's in-memory file, never unmapped
+    size_t size;                //bytes of the file to send, as found by fstat()
+    size_t len;                 //bytes of the selected stream of a selected image
+    int selected;               //samples are gathered from map into pool buffers
+    size_t off;                 //bytes queued so far
+    int queued;                 //nonzero once a chunk references the file
+    int previewed;              //a preview of it was queued ahead of it
+    unsigned int crc_start;     //checksum of the file up to where sending starts
+};
+
+/*Bytes of an open file to send: all of it, or the queued length if that is less*/
+static size_t send_size(const struct tm_file *file, const struct stat *st_buf) {
+
+    if (file->size == TM_FILE_WHOLE || (off_t) file->size > st_buf->st_size) { //Short file ends early
+        return st_buf->st_size;
+    }
+    return file->size;
+}
+
+/*Whether a file just opened has grown too large to send whole, see TM_FILE_MAX*/
+static int too_large(const struct tm_file *file, const struct stat *st_buf) {
+
+    if (file->size != TM_FILE_WHOLE || st_buf->st_size <= TM_FILE_MAX) {
+        return 0;
+    }
+    printf("%s is %lld Bytes, more than the %d a file can be, not sent\n", file->name,
+            (long long) st_buf->st_size, TM_FILE_MAX);
+    return 1;
+}
+
+static void free_preview(const struct tm_file *file, int status, void *arg) {
+
+    (void) file;
+    (void) status;
+    free(arg);
+}
+
+/* Queue the preview of an image just opened, ahead of the image itself. Comes from
+ * the stream's mapping if it has one, else from a mapping made just for this.
+ */
+static void queue_preview(struct tm_pipeline *pl, struct tm_stream *st, struct tm_file *file) {
+
+    char name[PATH_MAX];
+    const unsigned char *image = st->map;
+    unsigned char *map = NULL, *out;
+    size_t avail = (st->map != NULL) ? st->map_len : st->size;
+    size_t len = preview_len(pl->preview);
+    struct timespec t0;
+
+    if (avail < TM_ROE_IMAGE_BYTES) {
+        return;
+    }
+    if (image == NULL) {
+        map = mmap(NULL, TM_ROE_IMAGE_BYTES, PROT_READ, MAP_SHARED, fileno(st->fp), 0);
+        if (map == MAP_FAILED) {
+            printf("mmap(%s) error=%d %s\n", file->name, errno, strerror(errno));
+            return;
+        }
+        image = map;
+    }
+
+    out = malloc(len);
+    if (out == NULL) {
+        printf("Unable to allocate a %lu Byte preview\n", (unsigned long) len);
+    } else {
+        stats_now(&t0);
+        preview_make(image, pl->preview, file->id, out);
+        snprintf(name, sizeof (name), "%s" TM_PREVIEW_SUFFIX, file->name);
+        if (queue_push_derived(pl->queue, name, out, len, TM_PRIO_HK, TM_FILE_COMPRESS,
+                free_preview, out) != 0) {
+            printf("Preview of %s: %lu Bytes, binned %dx%d in %ld us\n", file->name,
+                    (unsigned long) len, pl->preview, pl->preview, stats_usec_since(&t0));
+            st->previewed = 1;
+        } else {
+            free(out);
+        }
+    }
+
+    if (map != NULL) {
+        munmap(map, TM_ROE_IMAGE_BYTES);
+    }
+}
+
+/* Carry on from where an earlier run got with a file just opened, under the file
+ * ID it went down with, by the checkpoint journal. The journal then has the file
+ * as started by this run.
+ */
+static int stream_resume(struct tm_pipeline *pl, struct tm_stream *st, struct tm_file *file,
+        const struct stat *st_buf) {
+
+    unsigned long id, off;
+    unsigned int crc;
+    int rc;
+
+    rc = checkpoint_lookup(pl->checkpoint, file->name, st_buf, pl->framer.frame_size, &id,
+            &off, &crc);
+    if (rc == TM_CKPT_DONE) {
+        printf("Skipping %s, sent whole before the restart\n", file->name);
+        if (st->fp != NULL) {
+            fclose(st->fp);
+        }
+        if (st->map != NULL) {
+            munmap(st->map, st->map_len);
+        }
+        memset(st, 0, sizeof (*st));
+        return READ_SKIP;
+    }
+    if (rc == TM_CKPT_PARTIAL && off <= st->size
+            && (st->fp == NULL || fseek(st->fp, (long) off, SEEK_SET) == 0)) {
+        printf("Resuming %s as file %lu at %lu Bytes\n", file->name, id, off);
+        file->id = id;
+        st->off = off;
+        st->crc_start = crc;
+    }
+
+    checkpoint_start(pl->checkpoint, file->id, file->name, st_buf, pl->framer.frame_size,
+            st->off, st->crc_start);
+    return 0;
+}
+
+/*Open a file for loading into the ring for its class*/
+static int stream_open(struct tm_pipeline *pl, struct tm_stream *st, struct tm_file *file) {
+
+    struct stat st_buf;
+    int fd, rc;
+
+    memset(st, 0, sizeof (*st));
+
+    /* Selected channels are gathered from all over the file, so they always come from
+     * a mapping of all of it. Anything short of a whole image is sent as it is.
+     */
+    st->selected = (pl->select != NULL && (file->flags & TM_FILE_SELECT));
+    if (file->data != NULL) {
+        st_buf.st_size = file->size;
+    }
+    if (st->selected && (file->data != NULL || stat(file->name, &st_buf) == 0)
+            && st_buf.st_size < TM_ROE_IMAGE_BYTES) {
+        printf("%s is not a whole ROE image, sending all of it\n", file->name);
+        st->selected = 0;
+    }
+
+    if (file->data != NULL) {
+
+        /*Already in memory, so it is sent from where it is, like a mapping*/
+        st->map = (unsigned char *) file->data;
+        st->map_len = st->size = file->size;
+        st->borrowed = 1;
+
+        if (st->selected) {
+            st->len = roe_stream_len(pl->select, st->map_len);
+            printf("Sending %d of %d Bytes of image %s\n", (int) st->len, (int) st->map_len,
+                    file->name);
+        }
+
+    } else if (pl->source == TM_SOURCE_MMAP || st->selected) {
+        fd = open(file->name, O_RDONLY);
+        if (fd < 0) {
+            printf("open(%s) error=%d %s\n", file->name, errno, strerror(errno));
+            return READ_OPEN_FAILED;
+        }
+
+        if (fstat(fd, &st_buf) < 0) {
+            printf("fstat(%s) error=%d %s\n", file->name, errno, strerror(errno));
+            close(fd);
+            return READ_OPEN_FAILED;
+        }
+
+        st->size = send_size(file, &st_buf);
+        if (too_large(file, &st_buf)) {
+            close(fd);
+            return READ_OPEN_FAILED;
+        }
+        st->map_len = st->selected ? (size_t) st_buf.st_size : st->size;
+
+        if (st->map_len > 0) {
+            st->map = mmap(NULL, st->map_len, PROT_READ, MAP_SHARED, fd, 0);
+            if (st->map == MAP_FAILED) {
+                printf("mmap(%s) error=%d %s\n", file->name, errno, strerror(errno));
+                close(fd);
+                return READ_OPEN_FAILED;
+            }
+
+            /*Pages are only read once, in order*/
+            madvise(st->map, st->map_len, MADV_SEQUENTIAL);
+        }
+        close(fd); //The mapping keeps the file open
+
+        if (st->selected) {
+            st->len = roe_stream_len(pl->select, st->map_len);
+            printf("Sending %d of %d Bytes of image %s\n", (int) st->len, (int) st->map_len,
+                    file->name);
+        }
+
+    } else {
+
+        /*Open image file for reading into a buffered stream*/
+        st->fp = fopen(file->name, "r+");
+        if (st->fp == NULL) {
+            printf("fopen(%s) error=%d %s\n", file->name, errno, strerror(errno));
+            return READ_OPEN_FAILED;
+        }
+
+        if (fstat(fileno(st->fp), &st_buf) < 0) {
+            printf("fstat(%s) error=%d %s\n", file->name, errno, strerror(errno));
+            fclose(st->fp);
+            return READ_OPEN_FAILED;
+        }
+        st->size = send_size(file, &st_buf);
+        if (too_large(file, &st_buf)) {
+            fclose(st->fp);
+            return READ_OPEN_FAILED;
+        }
+    }
+
+    st->crc_start = TM_CRC_INIT;
+    if (pl->checkpoint != NULL && file->data == NULL && !st->selected) {
+        rc = stream_resume(pl, st, file, &st_buf);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    st->file = file;
+    printf("New file: %s of size: %lu Bytes\n", file->name, (unsigned long) st->size);
+
+    if (pl->preview > 0 && (file->flags & TM_FILE_PREVIEW) && st->off == 0) {
+        queue_preview(pl, st, file);
+    }
+
+    return 0;
+}
+
+/*Load the next chunk of an open stream. Closes the stream after its last chunk*/
+static int stream_fill(struct tm_pipeline *pl, struct tm_stream *st, struct tm_chunk *chunk) {
+
+    size_t want, got;
+
+    memset(chunk, 0, sizeof (*chunk));
+    chunk->pool = pl->pool;
+    chunk->file = st->file;
+    chunk->file_off = st->off;
+    chunk->first = !st->queued;
+    chunk->crc_start = st->crc_start;
+
+    if (st->selected) {
+
+        /*Keep a buffer back for every more urgent class*/
+        chunk->buf = pool_tryget(pl->pool, st->file->prio);
+        if (chunk->buf == NULL) {
+            return READ_NO_BUFFER;
+        }
+
+        got = roe_gather(pl->select, st->map, st->map_len, st->off, chunk->buf,
+                pl->pool->buf_size);
+
+        chunk->data = chunk->buf;
+        chunk->len = got;
+        chunk->selected = 1;
+        st->off += got;
+        chunk->last = (st->off == st->len);
+
+        /*Samples of later chunks still come from the mapping*/
+        if (chunk->last && !st->borrowed) {
+            chunk->map = st->map;
+            chunk->map_len = st->map_len;
+        }
+
+    } else if (st->fp == NULL) {
+        got = st->map_len - st->off;
+        if (got > pl->pool->buf_size) {
+            got = pl->pool->buf_size;
+        }
+
+        /*Start reading this chunk from the SD card while earlier ones are on the wire*/
+        if (got > 0 && !st->borrowed) {
+            madvise(st->map + st->off, got, MADV_WILLNEED);
+        }
+
+        chunk->data = st->map + st->off;
+        chunk->len = got;
+        st->off += got;
+        chunk->last = (st->off == st->map_len);
+
+        /*The transmit thread unmaps after the last chunk of the file is sent*/
+        if (chunk->last && !st->borrowed) {
+            chunk->map = st->map;
+            chunk->map_len = st->map_len;
+        }
+
+    } else {
+
+        /*Keep a buffer back for every more urgent class*/
+        chunk->buf = pool_tryget(pl->pool, st->file->prio);
+        if (chunk->buf == NULL) {
+            return READ_NO_BUFFER;
+        }
+
+        want = st->size - st->off;
+        if (want > pl->pool->buf_size) {
+            want = pl->pool->buf_size;
+        }
+
+        got = fread(chunk->buf, 1, want, st->fp);
+        if (got < want && ferror(st->fp)) {
+            printf("Error reading in simulated image...\n");
+            pool_put(pl->pool, chunk->buf);
+            return -1;
+        }
+
+        chunk->data = chunk->buf;
+        chunk->len = got;
+        st->off += got;
+        chunk->last = (st->off == st->size || got < want); //Truncated while being sent
+
+        if (chunk->last) {
+            fclose(st->fp);
+        }
+    }
+
+    st->queued = 1;
+    if (chunk->last) {
+        st->file = NULL; //Class is free for its next file
+    }
+
+    return 0;
+}
+
+/*Drop a stream the reader will not finish. Once chunks of the file are queued the
+ *transmit thread may still be sending from them, so the file entry and mapping are
+ *left alone.*/
+static void stream_abandon(struct tm_stream *st) {
+
+    if (st->fp != NULL) {
+        fclose(st->fp);
+    }
+    if (!st->queued) {
+        if (st->map != NULL && !st->borrowed) {
+            munmap(st->map, st->map_len);
+        }
+        queue_free_file(st->file);
+    }
+    st->file = NULL;
+}
+
+/* Give back the page cache pages behind a chunk sent straight from a mapping, so
+ * the resident size of a mapped file stays at a few chunks however large it is.
+ * Only whole pages inside the chunk are dropped, the file data is untouched.
+ */
+static void drop_pages(const unsigned char *data, size_t len) {
+
+    uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t) data + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t) data + len) & ~(page - 1);
+
+    if (end > start) {
+        madvise((void *) start, end - start, MADV_DONTNEED);
+    }
+}
+
+/*Hand back whatever backs a chunk once it has been sent or discarded*/
+static void release_chunk(struct tm_pipeline *pl, struct tm_chunk *chunk) {
+
+    int mapped = (chunk->buf == NULL); //Sent straight from the file, not out of a pool buffer
+
+    if (chunk->buf != NULL) {
+        pool_put(chunk->pool, chunk->buf);
+        chunk->buf = NULL;
+
+        /*Behind a compression thread, releasing a transmit slot does not wake the reader*/
+        if (pl->compress && chunk->pool == pl->pool) {
+            event_signal(&pl->reader_ev);
+        }
+    }
+    if (chunk->map != NULL) {
+        munmap(chunk->map, chunk->map_len);
+        chunk->map = NULL;
+    } else if (mapped && chunk->len > 0 && chunk->file->data == NULL) {
+        drop_pages(chunk->data, chunk->len); //Would zero an in-memory file's anonymous pages
+    }
+    if (chunk->last) {
+        queue_free_file(chunk->file);
+    }
+}
+
+/*Reader thread: load queued files into the rings, most urgent class first*/
+static void *reader_thread(void *arg) {
+
+    struct tm_pipeline *pl = arg;
+    struct tm_stream streams[TM_NUM_PRIO];
+    struct tm_ring *rings = pl->compress ? pl->raw_ring : pl->ring;
+    struct tm_chunk *chunk;
+    struct tm_file *file;
+    struct timespec t0;
+    unsigned long seq;
+    int c, rc = 0;
+    int progress, busy;
+
+    memset(streams, 0, sizeof (streams));
+
+    while (!pl->stop && rc == 0) {
+        seq = event_seq(&pl->reader_ev);
+        progress = 0;
+        busy = 0;
+
+        for (c = 0; c < TM_NUM_PRIO && !progress; c++) {
+
+            /*Start the next file of an idle class*/
+            if (streams[c].file == NULL) {
+                file = queue_try_pop(pl->queue, c);
+                if (file == NULL) {
+                    continue;
+                }
+
+                stats_now(&t0);
+                rc = stream_open(pl, &streams[c], file);
+                if (rc == 0) {
+                    trace_event(pl->trace, TM_TRACE_OPEN, c, file->id, streams[c].size,
+                            stats_usec_since(&t0));
+                }
+                if (rc == READ_SKIP) {
+                    file->status = TM_FILE_SENT;
+                    queue_free_file(file);
+                    rc = 0;
+                    progress = 1;
+                    continue;
+                }
+                if (rc == READ_OPEN_FAILED) {
+                    queue_free_file(file); //Nothing of it was queued
+                    if (pl->skip_bad_files) {
+                        rc = 0;
+                        progress = 1; //Rescan from the most urgent class
+                        continue;
+                    }
+                }
+                if (rc != 0) {
+                    break;
+                }
+
+                /*Rescan, so the preview is started before the first chunk of its image*/
+                if (streams[c].previewed) {
+                    progress = 1;
+                    continue;
+                }
+            }
+            busy = 1;
+
+            chunk = ring_try_get_free(&rings[c]);
+            if (chunk == NULL) { //Class backed up, fill a less urgent one meanwhile
+                continue;
+            }
+
+            stats_now(&t0);
+            rc = stream_fill(pl, &streams[c], chunk);
+            if (rc == READ_NO_BUFFER) {
+                rc = 0;
+                continue;
+            }
+            if (rc != 0) {
+                break;
+            }
+            trace_event(pl->trace, TM_TRACE_READ, c, chunk->file->id, chunk->len,
+                    stats_usec_since(&t0));
+
+            /*Logged first, the chunk is the transmit side's once it is in the ring*/
+            trace_event(pl->trace, TM_TRACE_QUEUED, c, chunk->file->id, chunk->len,
+                    chunk->file_off);
+            ring_put(&rings[c]);
+            progress = 1;
+        }
+
+        if (rc != 0 || progress) {
+            continue;
+        }
+        if (!busy && queue_drained(pl->queue)) {
+            break;
+        }
+
+        /*Every class is empty: keep the link busy with the backlog, see filler.h*/
+        if (pl->filler != NULL && !busy && (rc = filler_next(pl->filler, pl->queue)) != 0) {
+            rc = (rc < 0) ? rc : 0;
+            continue;
+        }
+
+        /*Busy means every class with a file open is waiting for room*/
+        stats_now(&t0);
+        if (pl->filler != NULL) {
+            event_timedwait(&pl->reader_ev, seq, TM_FILLER_RESCAN_MS);
+        } else {
+            event_wait(&pl->reader_ev, seq);
+        }
+        trace_event(pl->trace, TM_TRACE_READER_WAIT, 0, 0, stats_usec_since(&t0), busy);
+    }
+
+    for (c = 0; c < TM_NUM_PRIO; c++) {
+        if (streams[c].file != NULL) {
+            stream_abandon(&streams[c]);
+        }
+    }
+
+    pl->reader_rc = rc;
+
+    /*Transmit thread drains what is left and exits*/
+    for (c = 0; c < TM_NUM_PRIO; c++) {
+        ring_close(&rings[c]);
+    }
+    return NULL;
+}
+
+/*Fill out with in, packed frame by frame if its file wants compression. The raw
+ *buffer goes straight back to the reader once packed*/
+static int compress_chunk(struct tm_pipeline *pl, struct tm_chunk *in, struct tm_chunk *out,
+        unsigned int *crc) {
+
+    unsigned char *buf;
+    unsigned int sum;
+    size_t used;
+
+    *out = *in;
+    if (!(in->file->flags & TM_FILE_COMPRESS) || in->len == 0) {
+        return 0;
+    }
+
+    buf = pool_tryget(&pl->comp_pool, 0);
+    if (buf == NULL) {
+        return COMP_NO_BUFFER;
+    }
+
+    /*The transmit thread cannot checksum what it sends, so the file's running checksum is kept here*/
+    sum = in->first ? in->crc_start : *crc;
+    used = rice_pack(in->data, in->len, pl->frame_size, buf, pl->comp_pool.buf_size, &sum);
+    if (used == 0) { //Records did not fit, send this chunk as it is
+        pool_put(&pl->comp_pool, buf);
+        return 0;
+    }
+    *crc = sum;
+
+    if (in->buf != NULL) {
+        pool_put(in->pool, in->buf);
+    }
+    out->buf = buf;
+    out->pool = &pl->comp_pool;
+    out->data = buf;
+    out->len = used;
+    out->packed = 1;
+    out->crc = sum;
+
+    return 0;
+}
+
+/*Compression thread: move chunks from the reader's rings to the transmit rings,
+ *most urgent class first*/
+static void *compress_thread(void *arg) {
+
+    struct tm_pipeline *pl = arg;
+    struct tm_chunk *in, *out;
+    unsigned int crc[TM_NUM_PRIO];
+    unsigned long seq;
+    int c, done, progress;
+
+    memset(crc, 0, sizeof (crc));
+
+    while (!pl->stop) {
+        seq = event_seq(&pl->comp_ev);
+        done = 1;
+        progress = 0;
+
+        for (c = 0; c < TM_NUM_PRIO && !progress; c++) {
+            in = ring_peek_full(&pl->raw_ring[c]);
+            if (in == NULL) {
+                if (!ring_done(&pl->raw_ring[c])) {
+                    done = 0;
+                }
+                continue;
+            }
+            done = 0;
+
+            out = ring_try_get_free(&pl->ring[c]);
+            if (out == NULL || compress_chunk(pl, in, out, &crc[c]) == COMP_NO_BUFFER) {
+                continue;
+            }
+            ring_put(&pl->ring[c]);
+            ring_release(&pl->raw_ring[c]);
+            progress = 1;
+        }
+
+        if (done) {
+            break;
+        }
+        if (!progress) {
+            event_wait(&pl->comp_ev, seq);
+        }
+    }
+
+    for (c = 0; c < TM_NUM_PRIO; c++) {
+        ring_close(&pl->ring[c]);
+    }
+    return NULL;
+}
+
+/*Queue the parity frames of a completed FEC group and start the next group*/
+static int send_parity(struct tm_pipeline *pl, struct tm_fec *fec) {
+
+    unsigned char *frame;
+    size_t len;
+    int j, rc;
+
+    for (j = 0; j < pl->fec->m; j++) {
+        len = fec_parity_frame(fec, j, &frame);
+        rc = framer_write_raw(&pl->framer, frame, len);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+    fec_reset(fec);
+
+    return 0;
+}
+
+/*Transmit thread: frame chunks out to the device, re-picking the most urgent class
+ *at every frame boundary*/
+static void *transmit_thread(void *arg) {
+
+    struct tm_pipeline *pl = arg;
+    struct tm_chunk *cur[TM_NUM_PRIO];
+    size_t off[TM_NUM_PRIO];
+    size_t raw_off[TM_NUM_PRIO]; //file bytes of the chunk sent, differs from off if packed
+    struct tm_chunk *chunk;
+    struct tm_frame_hdr hdr;
+    struct tm_rice_rec rec;
+    const unsigned char *payload;
+    int totalSize[TM_NUM_PRIO];
+    unsigned long long sent[TM_NUM_PRIO];
+    unsigned int crc[TM_NUM_PRIO]; //checksum of the file so far
+    size_t ckpt_off[TM_NUM_PRIO]; //end of the chunk before, the point known to be on the wire
+    unsigned int ckpt_crc[TM_NUM_PRIO];
+    int time_elapsed;
+    struct timeval time_begin[TM_NUM_PRIO], time_end;
+    struct timespec t0;
+    unsigned long seq;
+    size_t n, raw, step;
+    unsigned int flags;
+    int c, done, rc;
+
+    memset(cur, 0, sizeof (cur));
+    memset(&hdr, 0, sizeof (hdr));
+
+    for (;;) {
+        seq = event_seq(&pl->tx_ev);
+        done = 1;
+
+        for (c = 0; c < TM_NUM_PRIO; c++) {
+            if (cur[c] == NULL) {
+                cur[c] = ring_peek_full(&pl->ring[c]);
+                off[c] = 0;
+                raw_off[c] = 0;
+            }
+            if (cur[c] != NULL) {
+                break;
+            }
+            if (!ring_done(&pl->ring[c])) {
+                done = 0;
+            }
+        }
+
+        if (c == TM_NUM_PRIO) {
+            if (done) {
+                break;
+            }
+            stats_now(&t0);
+            event_wait(&pl->tx_ev, seq);
+            trace_event(pl->trace, TM_TRACE_TX_WAIT, 0, 0, stats_usec_since(&t0), 0);
+            continue;
+        }
+
+        chunk = cur[c];
+
+        if (chunk->first && off[c] == 0) {
+            totalSize[c] = 0;
+            sent[c] = 0;
+            crc[c] = chunk->crc_start;
+            ckpt_off[c] = chunk->file_off;
+            ckpt_crc[c] = chunk->crc_start;
+            printf("Sending data from memory...\n");
+            gettimeofday(&time_begin[c], NULL); //Determine elapsed time for file write to TM
+        }
+
+        /* Queue one frame without draining, then look for more urgent data. Chunks
+         * hold whole frames, so the sequence number follows from the file offset. An
+         * empty file still gets its one, empty, last frame. In a packed chunk each
+         * frame's payload comes with a record of the file bytes it stands for, and
+         * the compression thread has already folded those into the checksum.
+         */
+        if (chunk->packed && off[c] < chunk->len) {
+            memcpy(&rec, chunk->data + off[c], sizeof (rec));
+            payload = chunk->data + off[c] + sizeof (rec);
+            n = rec.len;
+            raw = rec.raw_len;
+            flags = rec.flags;
+            step = sizeof (rec) + n;
+        } else {
+            payload = chunk->data + off[c];
+            n = chunk->len - off[c];
+            if (n > pl->framer.frame_size) {
+                n = pl->framer.frame_size;
+            }
+            raw = n;
+            flags = 0;
+            step = n;
+        }
+        if (chunk->selected) {
+            flags |= TM_HDR_SELECT;
+        }
+        if (n > 0 || chunk->last) {
+            hdr.file_id = chunk->file->id;
+            hdr.offset = chunk->file_off + raw_off[c];
+            hdr.seq = hdr.offset / pl->framer.frame_size;
+            hdr.flags = flags;
+            if (chunk->last && off[c] + step == chunk->len) {
+                hdr.flags |= TM_HDR_LAST | TM_HDR_CRC;
+            }
+
+            if (chunk->packed) {
+                crc[c] = chunk->crc;
+                hdr.crc = crc[c];
+                rc = framer_write_frame(&pl->framer, &hdr, payload, n, NULL);
+            } else {
+                rc = framer_write_frame(&pl->framer, &hdr, payload, n, &crc[c]);
+            }
+            if (rc < 0) {
+                pl->tx_rc = rc;
+                break;
+            }
+            if (pl->index != NULL) {
+                index_frame(pl->index, chunk->file->name, &hdr, raw);
+            }
+            if (pl->stats != NULL) {
+                stats_payload(pl->stats, raw, n);
+            }
+
+            /*A file's last group may be short*/
+            if (pl->fec != NULL) {
+                fec_add(&pl->fec_group[c], hdr.file_id, hdr.seq, pl->framer.frame_buf,
+                        TM_HDR_SIZE + n + ((hdr.flags & TM_HDR_CRC) ? TM_CRC_SIZE : 0));
+                if (pl->fec_group[c].n == pl->fec->k || (hdr.flags & TM_HDR_LAST)) {
+                    rc = send_parity(pl, &pl->fec_group[c]);
+                    if (rc < 0) {
+                        pl->tx_rc = rc;
+                        break;
+                    }
+                }
+            }
+            off[c] += step;
+            raw_off[c] += raw;
+            totalSize[c] += raw;
+            sent[c] += n;
+        }
+        if (off[c] < chunk->len) {
+            continue;
+        }
+
+        if (chunk->last) {
+
+            /*The only point where the transmitter is drained*/
+            rc = framer_end_file(&pl->framer);
+            if (rc < 0) {
+                pl->tx_rc = rc;
+                break;
+            }
+            chunk->file->status = TM_FILE_SENT;
+            if (pl->index != NULL) {
+                index_sync(pl->index);
+            }
+            if (pl->checkpoint != NULL) {
+                checkpoint_done(pl->checkpoint, chunk->file->id);
+            }
+
+            gettimeofday(&time_end, NULL); //Timing
+            printf("all data sent\n");
+            printf("Sent %d bytes of data from file %s.\n", totalSize[c], chunk->file->name);
+            time_elapsed = 1000000 * ((long) (time_end.tv_sec) - (long) (time_begin[c].tv_sec))
+                    + (long) (time_end.tv_usec) - (long) (time_begin[c].tv_usec);
+            printf("Time elapsed: %-3.2f seconds.\n\n", (float) time_elapsed / (float) 1000000);
+            if (pl->stats != NULL) {
+                stats_file(pl->stats, chunk->file->name, totalSize[c], sent[c], time_elapsed);
+            }
+            trace_event(pl->trace, TM_TRACE_DONE, c, chunk->file->id, totalSize[c], time_elapsed);
+
+        } else if (pl->checkpoint != NULL) {
+
+            /* The driver may still hold this chunk's frames, but the one before is out
+             * by now, so that is as far as a restart may skip.
+             */
+            checkpoint_drained(pl->checkpoint, chunk->file->id, ckpt_off[c], ckpt_crc[c]);
+            ckpt_off[c] = chunk->file_off + raw_off[c];
+            ckpt_crc[c] = crc[c];
+        }
+
+        /*A new rate starts on an empty transmitter, see rate.h*/
+        if (pl->rate != NULL && rate_due(pl->rate)) {
+            rc = chunk->last ? 0 : framer_end_file(&pl->framer);
+            if (rc == 0) {
+                rc = rate_apply(pl->rate);
+            }
+            if (rc < 0) {
+                pl->tx_rc = rc;
+                break;
+            }
+        }
+
+        release_chunk(pl, chunk);
+        ring_release(&pl->ring[c]);
+        cur[c] = NULL;
+    }
+
+    if (pl->tx_rc != 0) { //Stops the reader if we bailed out early
+        pl->stop = 1;
+        event_signal(&pl->reader_ev);
+        event_signal(&pl->comp_ev);
+    }
+    return NULL;
+}
+
+/*Release what is still queued in a ring, then the ring itself*/
+static void drain_ring(struct tm_pipeline *pl, struct tm_ring *ring) {
+
+    struct tm_chunk *chunk;
+
+    while ((chunk = ring_peek_full(ring)) != NULL) {
+        release_chunk(pl, chunk);
+        ring_release(ring);
+    }
+    ring_destroy(ring);
+}
+
+int pipeline_run(struct tm_pipeline *pl) {
+
+    pthread_t reader, transmitter, compressor;
+    struct tm_ring *rings;
+    int c, nrings = 0, nraw = 0, rc;
+
+    pl->stop = 0;
+    pl->reader_rc = 0;
+    pl->tx_rc = 0;
+
+    /*Whole frames per buffer, so frames never straddle two chunks*/
+    if (pl->frame_size == 0 || pl->pool->buf_size % pl->frame_size != 0) {
+        printf("Pool buffers of %d bytes do not hold whole %d byte frames\n",
+                (int) pl->pool->buf_size, (int) pl->frame_size);
+        return -1;
+    }
+
+    /*Selected streams are gathered sample by sample, frames must start on a sample*/
+    if (pl->select != NULL && pl->frame_size % 2 != 0) {
+        printf("Frame size %d splits 16 bit samples\n", (int) pl->frame_size);
+        return -1;
+    }
+
+    /*Parity frames cover a whole data frame and carry a header of their own*/
+    if (pl->fec != NULL && 2 * TM_HDR_SIZE + pl->frame_size + TM_CRC_SIZE > HDLC_MAX_FRAME_SIZE) {
+        printf("Frame size %d leaves no room for FEC parity (at most %d bytes)\n",
+                (int) pl->frame_size, HDLC_MAX_FRAME_SIZE - 2 * TM_HDR_SIZE - TM_CRC_SIZE);
+        return -1;
+    }
+
+    rc = framer_init(&pl->framer, pl->fd, pl->frame_size);
+    if (rc < 0) {
+        return rc;
+    }
+    pl->framer.stats = pl->stats;
+    pl->framer.flow = pl->flow;
+    pl->framer.stripe = pl->stripe;
+    pl->framer.link = pl->link;
+
+    for (c = 0; c < TM_NUM_PRIO && pl->fec != NULL; c++) {
+        rc = fec_init(&pl->fec_group[c], pl->fec, TM_HDR_SIZE + pl->frame_size + TM_CRC_SIZE);
+        if (rc < 0) {
+            while (--c >= 0) {
+                fec_destroy(&pl->fec_group[c]);
+            }
+            framer_destroy(&pl->framer);
+            return rc;
+        }
+    }
+
+    event_init(&pl->reader_ev);
+    event_init(&pl->tx_ev);
+    event_init(&pl->comp_ev);
+
+    /*Room for a record per frame, so a packed chunk always fits even if nothing compresses*/
+    if (pl->compress) {
+        rc = pool_init(&pl->comp_pool, TM_RICE_BUFFERS, pl->pool->buf_size
+                + pl->pool->buf_size / pl->frame_size * sizeof (struct tm_rice_rec));
+        if (rc < 0) {
+            printf("Unable to allocate %d compression buffers\n", TM_RICE_BUFFERS);
+            goto out;
+        }
+    }
+
+    /*A class can queue as many chunks as there are pool buffers*/
+    for (nrings = 0; nrings < TM_NUM_PRIO; nrings++) {
+        rc = ring_init(&pl->ring[nrings], pl->pool->nbufs, &pl->tx_ev,
+                pl->compress ? &pl->comp_ev : &pl->reader_ev);
+        if (rc < 0) {
+            printf("Unable to allocate a ring of %d chunks\n", pl->pool->nbufs);
+            goto out;
+        }
+    }
+    for (nraw = 0; nraw < TM_NUM_PRIO && pl->compress; nraw++) {
+        rc = ring_init(&pl->raw_ring[nraw], pl->pool->nbufs, &pl->comp_ev, &pl->reader_ev);
+        if (rc < 0) {
+            printf("Unable to allocate a ring of %d chunks\n", pl->pool->nbufs);
+            goto out;
+        }
+    }
+    rings = pl->compress ? pl->raw_ring : pl->ring;
+
+    queue_set_notify(pl->queue, &pl->reader_ev);
+
+    /*Everything the transmit path touches is allocated by now*/
+    if (pl->lock_memory) {
+        rt_lock_memory();
+    }
+
+    rc = pthread_create(&transmitter, NULL, transmit_thread, pl);
+    if (rc != 0) {
+        printf("pthread_create(transmit) error=%d %s\n", rc, strerror(rc));
+        pl->tx_rc = -1;
+    } else {
+        /*With striping the port writers feed the link, see stripe_set_priority()*/
+        if (pl->rt_priority > 0 && pl->stripe == NULL) {
+            rt_promote(transmitter, pl->rt_priority, "transmit");
+        }
+        rc = pl->compress ? pthread_create(&compressor, NULL, compress_thread, pl) : 0;
+        if (rc != 0) {
+            printf("pthread_create(compress) error=%d %s\n", rc, strerror(rc));
+            pl->reader_rc = -1;
+            for (c = 0; c < TM_NUM_PRIO; c++) {
+                ring_close(&pl->ring[c]);
+            }
+        } else {
+            rc = pthread_create(&reader, NULL, reader_thread, pl);
+            if (rc != 0) {
+                printf("pthread_create(reader) error=%d %s\n", rc, strerror(rc));
+                pl->reader_rc = -1;
+                for (c = 0; c < TM_NUM_PRIO; c++) {
+                    ring_close(&rings[c]);
+                }
+            } else {
+                pthread_join(reader, NULL);
+            }
+            if (pl->compress) {
+                pthread_join(compressor, NULL);
+            }
+        }
+        pthread_join(transmitter, NULL);
+    }
+
+    queue_set_notify(pl->queue, NULL);
+    rc = (pl->tx_rc != 0) ? pl->tx_rc : pl->reader_rc;
+
+out:
+    /*Release buffers and mappings still queued if the transmitter stopped early*/
+    while (--nraw >= 0) {
+        drain_ring(pl, &pl->raw_ring[nraw]);
+    }
+    while (--nrings >= 0) {
+        drain_ring(pl, &pl->ring[nrings]);
+    }
+
+    if (pl->compress) {
+        pool_destroy(&pl->comp_pool);
+    }
+    event_destroy(&pl->reader_ev);
+    event_destroy(&pl->tx_ev);
+    event_destroy(&pl->comp_ev);
+    for (c = 0; c < TM_NUM_PRIO && pl->fec != NULL; c++) {
+        fec_destroy(&pl->fec_group[c]);
+    }
+    framer_destroy(&pl->framer);
+
+    return rc;
+}
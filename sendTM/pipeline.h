@@ -0,0 +1,92 @@
+/********************************************************************************
+ * MOSES telemetry downlink read/transmit pipeline
+ *
+ * A reader thread loads each file of the downlink queue in chunks into a ring
+ * of fixed-size buffers while a transmit thread writes the chunks to the
+ * SyncLink. Disk reads for the next chunk (and the next file) overlap the
+ * HDLC link instead of leaving it idle for the length of each fread().
+ *
+ * Each priority class has its own ring. The reader keeps one file open per
+ * class and always fills the most urgent ring with room first. The transmit
+ * thread re-picks the most urgent ring with data at every frame boundary.
+ * When every class runs dry while the queue is still open, the reader tops
+ * up the idle class from the filler's backlog, if there is one. Both threads
+ * log what they do, and how long they wait for each other, to the trace.
+ *
+ * With compression on, a third thread sits between the two: the reader fills
+ * a second set of rings, and the compression thread packs the chunks of
+ * TM_FILE_COMPRESS files frame by frame into buffers of its own pool before
+ * passing them on to the transmit rings. Other files pass through untouched.
+ *
+ ******************************************************************************/
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "ring.h"
+#include "frame.h"
+#include "bufpool.h"
+#include "queue.h"
+#include "sched.h"
+#include "stats.h"
+#include "index.h"
+#include "fec.h"
+#include "rice.h"
+#include "roe.h"
+#include "checkpoint.h"
+#include "rate.h"
+#include "filler.h"
+#include "trace.h"
+
+/*Frames held by each pool buffer. A buffer is also the unit of each read from the SD card*/
+#define TM_FRAMES_PER_CHUNK 16
+
+/*Number of pool buffers shared by the reader and transmit threads*/
+#define TM_POOL_BUFFERS 6
+
+/*Pool buffers the compression thread packs chunks into*/
+#define TM_RICE_BUFFERS 3
+
+/*Where the frames of each file come from*/
+#define TM_SOURCE_READ 0        //fread() into the ring buffers
+#define TM_SOURCE_MMAP 1        //frame straight out of a read-only mapping of the file
+
+struct tm_pipeline {
+    int fd;                     //configured SyncLink device
+    size_t frame_size;          //payload bytes per HDLC frame
+    int source;                 //TM_SOURCE_READ or TM_SOURCE_MMAP
+    struct tm_pool *pool;       //chunk buffers, created once at startup
+    struct tm_queue *queue;     //files to send, until the queue is closed and empty
+    int skip_bad_files;         //log and skip files that cannot be opened instead of stopping
+    struct tm_stats *stats;     //frame, file and latency counters, or NULL
+    struct tm_flow *flow;       //adaptive driver queue depth, or NULL
+    struct tm_stripe *stripe;   //ports to spread frames over instead of fd, or NULL
+    struct tm_link *link;       //signal state of fd, or NULL
+    int rt_priority;            //SCHED_FIFO priority of the transmit thread, or 0, see rt.h
+    int lock_memory;            //pin the process's pages before the threads start
+    struct tm_index *index;     //record of every frame sent, for retransmission, or NULL
+    struct tm_fec_code *fec;    //parity frames after every group of data frames, or NULL
+    int compress;               //run the compression thread for TM_FILE_COMPRESS files
+    struct tm_roe_select *select; //channels sent of TM_FILE_SELECT files, or NULL for all
+    int preview;                //bin of the preview sent ahead of TM_FILE_PREVIEW images, or 0
+    struct tm_checkpoint *checkpoint; //journal to resume files from and record progress in, or NULL
+    struct tm_rate *rate;       //bit rate changes between chunks, or NULL for a fixed rate
+    struct tm_filler *filler;   //backlog sent whenever the queue is empty, or NULL
+    struct tm_trace *trace;     //timeline of every stage, or NULL, see trace.h
+    struct tm_ring ring[TM_NUM_PRIO];
+    struct tm_ring raw_ring[TM_NUM_PRIO]; //reader to compression thread, if compress
+    struct tm_pool comp_pool;   //buffers of compressed chunks, if compress
+    struct tm_fec fec_group[TM_NUM_PRIO]; //parity of the group in progress in each class
+    struct tm_event reader_ev;  //queue push, ring slot freed, or stop
+    struct tm_event tx_ev;      //chunk queued or reader finished
+    struct tm_event comp_ev;    //raw chunk queued, transmit slot freed, or stop
+    struct tm_framer framer;
+    int stop;                   //set by the transmit thread when it gives up
+    int reader_rc;              //error reported by the reader thread
+    int tx_rc;                  //error reported by the transmit thread
+};
+
+/*Send every file in the queue, returning 0 or the first error encountered*/
+int pipeline_run(struct tm_pipeline *pl);
+
+#endif /* PIPELINE_H */
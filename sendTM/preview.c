@@ -0,0 +1,152 @@
+/********************************************************************************
+ * MOSES telemetry downlink image previews
+ *
+ * See preview.h. Samples are read as 16 bit words, so the image must be at
+ * least 2 byte aligned, as a mapping or a malloc()ed buffer always is.
+ *
+ ******************************************************************************/
+
+#include <stdint.h>
+#include <memory.h>
+
+#include "preview.h"
+#include "roe.h"
+
+/*The vector kernels hold one sample of each channel per vector*/
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && TM_ROE_CHANNELS == 4
+#include <arm_neon.h>
+#define PREVIEW_NEON
+#elif defined(__SSE2__) && TM_ROE_CHANNELS == 4
+#include <emmintrin.h>
+#define PREVIEW_SSE2
+#endif
+
+/*Samples in one row of an image*/
+#define ROW_SAMPLES (TM_ROE_WIDTH * TM_ROE_CHANNELS)
+
+int preview_bin_valid(int bin) {
+
+    return bin >= TM_PREVIEW_MIN_BIN && bin <= TM_PREVIEW_MAX_BIN && (bin & (bin - 1)) == 0;
+}
+
+size_t preview_len(int bin) {
+
+    return TM_PREVIEW_HDR_SIZE
+            + 2 * (size_t) TM_ROE_CHANNELS * (TM_ROE_WIDTH / bin) * (TM_ROE_HEIGHT / bin);
+}
+
+/*acc[i] += row[i] for a whole row*/
+static void add_row(uint32_t *acc, const uint16_t *row) {
+
+    int i;
+
+#if defined(PREVIEW_NEON)
+    uint16x8_t v;
+
+    for (i = 0; i < ROW_SAMPLES; i += 8) {
+        v = vld1q_u16(row + i);
+        vst1q_u32(acc + i, vaddw_u16(vld1q_u32(acc + i), vget_low_u16(v)));
+        vst1q_u32(acc + i + 4, vaddw_u16(vld1q_u32(acc + i + 4), vget_high_u16(v)));
+    }
+#elif defined(PREVIEW_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v, *a;
+
+    for (i = 0; i < ROW_SAMPLES; i += 8) {
+        v = _mm_loadu_si128((const __m128i *) (row + i));
+        a = (__m128i *) (acc + i);
+        _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), _mm_unpacklo_epi16(v, zero)));
+        _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), _mm_unpackhi_epi16(v, zero)));
+    }
+#else
+    for (i = 0; i < ROW_SAMPLES; i++) {
+        acc[i] += row[i];
+    }
+#endif
+}
+
+/*out[b] = mean of bin columns of acc, every channel, shift being log2 of bin * bin*/
+static void fold_row(const uint32_t *acc, int bin, int shift, uint16_t *out) {
+
+    int b, c;
+
+#if defined(PREVIEW_NEON)
+    const int32_t right = -shift;
+    uint32x4_t s;
+
+    for (b = 0; b < TM_ROE_WIDTH / bin; b++, acc += 4 * bin) {
+        s = vld1q_u32(acc);
+        for (c = 1; c < bin; c++) {
+            s = vaddq_u32(s, vld1q_u32(acc + 4 * c));
+        }
+        vst1_u16(out + 4 * b, vmovn_u32(vshlq_u32(s, vdupq_n_s32(right))));
+    }
+#elif defined(PREVIEW_SSE2)
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    const __m128i bias32 = _mm_set1_epi32(0x8000), bias16 = _mm_set1_epi16((short) 0x8000);
+    __m128i s;
+
+    for (b = 0; b < TM_ROE_WIDTH / bin; b++, acc += 4 * bin) {
+        s = _mm_loadu_si128((const __m128i *) acc);
+        for (c = 1; c < bin; c++) {
+            s = _mm_add_epi32(s, _mm_loadu_si128((const __m128i *) (acc + 4 * c)));
+        }
+
+        /*No unsigned 32 to 16 bit pack before SSE4.1, so means are biased into signed range*/
+        s = _mm_sub_epi32(_mm_srl_epi32(s, count), bias32);
+        s = _mm_packs_epi32(s, s);
+        _mm_storel_epi64((__m128i *) (out + 4 * b), _mm_add_epi16(s, bias16));
+    }
+#else
+    uint32_t s;
+    int ch;
+
+    for (b = 0; b < TM_ROE_WIDTH / bin; b++, acc += TM_ROE_CHANNELS * bin) {
+        for (ch = 0; ch < TM_ROE_CHANNELS; ch++) {
+            s = 0;
+            for (c = 0; c < bin; c++) {
+                s += acc[TM_ROE_CHANNELS * c + ch];
+            }
+            out[TM_ROE_CHANNELS * b + ch] = (uint16_t) (s >> shift);
+        }
+    }
+#endif
+}
+
+void preview_make(const unsigned char *image, int bin, unsigned long image_id,
+        unsigned char *out) {
+
+    uint32_t acc[ROW_SAMPLES];
+    const uint16_t *row = (const uint16_t *) image;
+    uint16_t *dst = (uint16_t *) (out + TM_PREVIEW_HDR_SIZE);
+    int width = TM_ROE_WIDTH / bin, height = TM_ROE_HEIGHT / bin;
+    int shift = 0, r, i;
+
+    while ((1 << shift) < bin * bin) {
+        shift++;
+    }
+
+    memset(out, 0, TM_PREVIEW_HDR_SIZE);
+    out[0] = TM_PREVIEW_MAGIC0;
+    out[1] = TM_PREVIEW_MAGIC1;
+    out[2] = TM_PREVIEW_VERSION;
+    out[3] = (unsigned char) bin;
+    out[4] = (unsigned char) (image_id >> 24);
+    out[5] = (unsigned char) (image_id >> 16);
+    out[6] = (unsigned char) (image_id >> 8);
+    out[7] = (unsigned char) image_id;
+    out[8] = (unsigned char) (width >> 8);
+    out[9] = (unsigned char) width;
+    out[10] = (unsigned char) (height >> 8);
+    out[11] = (unsigned char) height;
+    out[12] = TM_ROE_CHANNELS;
+
+    for (r = 0; r < height; r++) {
+        memset(acc, 0, sizeof (acc));
+        for (i = 0; i < bin; i++, row += ROW_SAMPLES) {
+            add_row(acc, row);
+        }
+        fold_row(acc, bin, shift, dst);
+        dst += width * TM_ROE_CHANNELS;
+    }
+}
@@ -0,0 +1,58 @@
+/********************************************************************************
+ * MOSES telemetry downlink image previews
+ *
+ * A whole .roe image takes some 13.5 s to go down, which is too long to wait
+ * before seeing whether the pointing is right. With previews on, each image is
+ * first binned bin x bin pixels at a time, every readout channel separately,
+ * and the preview is queued as a housekeeping file of its own so it goes down
+ * ahead of the full resolution frames. At a bin of 8 it is 256 kB, a fifth of
+ * a second of link time.
+ *
+ * A preview is a TM_PREVIEW_HDR_SIZE byte header, big-endian like the frame
+ * header, followed by the binned samples in the same order as a .roe image:
+ * row by row, and within a row, column by column, one sample of each channel
+ * in turn. Each sample is the mean of its bin, in the byte order of the image.
+ *
+ *   0  magic     'M' 'P'
+ *   2  version   TM_PREVIEW_VERSION
+ *   3  bin       pixels binned in each direction
+ *   4  image_id  u32, file ID of the full image
+ *   8  width     u16, columns of the preview
+ *  10  height    u16, rows of the preview
+ *  12  channels  u8
+ *  13  zero
+ *
+ * The binning kernel sums whole rows into 32 bit lanes, then folds each run of
+ * bin columns, four channels to a vector. It uses NEON or SSE2 where the
+ * target has it, and plain C otherwise.
+ *
+ ******************************************************************************/
+
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <stddef.h>
+
+#define TM_PREVIEW_HDR_SIZE 16
+#define TM_PREVIEW_MAGIC0 'M'
+#define TM_PREVIEW_MAGIC1 'P'
+#define TM_PREVIEW_VERSION 1
+
+/*Bins allowed, each a power of two dividing TM_ROE_WIDTH and TM_ROE_HEIGHT*/
+#define TM_PREVIEW_MIN_BIN 2
+#define TM_PREVIEW_MAX_BIN 16
+
+/*Appended to an image's name to name its preview*/
+#define TM_PREVIEW_SUFFIX ".preview"
+
+/*Nonzero if bin is a bin the kernel supports*/
+int preview_bin_valid(int bin);
+
+/*Bytes of the preview of a whole image, header included*/
+size_t preview_len(int bin);
+
+/*Bin the whole image at image into out, which holds preview_len(bin) bytes*/
+void preview_make(const unsigned char *image, int bin, unsigned long image_id,
+        unsigned char *out);
+
+#endif /* PREVIEW_H */
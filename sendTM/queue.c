@@ -0,0 +1,214 @@
+/********************************************************************************
+ * MOSES telemetry downlink file queue
+ *
+ * See queue.h.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <sys/stat.h>
+
+#include "queue.h"
+
+void queue_init(struct tm_queue *q) {
+
+    memset(q, 0, sizeof (*q));
+    q->next_id = 1;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+}
+
+void queue_destroy(struct tm_queue *q) {
+
+    struct tm_file *file;
+    int c;
+
+    for (c = 0; c < TM_NUM_PRIO; c++) {
+        while ((file = q->head[c]) != NULL) {
+            q->head[c] = file->next;
+            queue_free_file(file);
+        }
+    }
+
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+}
+
+/*Caller holds q->lock*/
+static void notify(struct tm_queue *q) {
+
+    pthread_cond_broadcast(&q->not_empty);
+    if (q->notify != NULL) {
+        event_signal(q->notify);
+    }
+}
+
+/*Caller holds q->lock and has checked the class is not empty*/
+static struct tm_file *unlink_head(struct tm_queue *q, int prio) {
+
+    struct tm_file *file = q->head[prio];
+
+    q->head[prio] = file->next;
+    if (q->head[prio] == NULL) {
+        q->tail[prio] = NULL;
+    }
+    q->count--;
+    file->next = NULL;
+
+    return file;
+}
+
+int queue_push(struct tm_queue *q, const char *name, int size, int prio, int flags) {
+
+    return (queue_push_async(q, name, NULL, size, prio, flags, NULL, NULL) != 0) ? 0 : -1;
+}
+
+/*Append an entry, even to a closed queue if derived*/
+static unsigned long push_entry(struct tm_queue *q, const char *name, const unsigned char *data,
+        int size, int prio, int flags, tm_file_done done, void *arg, int derived) {
+
+    struct tm_file *file;
+    unsigned long id;
+    struct stat st;
+
+    if (prio < 0 || prio >= TM_NUM_PRIO || (data != NULL && size < 0)) {
+        return 0;
+    }
+
+    /*Only a file sent whole can be too large, since size itself never is*/
+    if (data == NULL && size == TM_FILE_WHOLE && stat(name, &st) == 0
+            && st.st_size > TM_FILE_MAX) {
+        printf("%s is %lld Bytes, more than the %d a file can be, not queued\n", name,
+                (long long) st.st_size, TM_FILE_MAX);
+        return 0;
+    }
+
+    file = calloc(1, sizeof (*file));
+    if (file == NULL) {
+        return 0;
+    }
+
+    file->name = strdup(name);
+    if (file->name == NULL) {
+        free(file);
+        return 0;
+    }
+    file->size = size;
+    file->prio = prio;
+    file->flags = flags;
+    file->data = data;
+    file->status = TM_FILE_NOT_SENT;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->closed && !derived) {
+        pthread_mutex_unlock(&q->lock);
+        queue_free_file(file); //Not queued, so the caller hears so from the return value only
+        return 0;
+    }
+
+    /*The callback is only armed once the entry is really queued*/
+    file->done = done;
+    file->done_arg = arg;
+    file->id = id = q->next_id++;
+    if (q->tail[prio] != NULL) {
+        q->tail[prio]->next = file;
+    } else {
+        q->head[prio] = file;
+    }
+    q->tail[prio] = file;
+    q->count++;
+
+    notify(q);
+    pthread_mutex_unlock(&q->lock);
+
+    return id;
+}
+
+unsigned long queue_push_async(struct tm_queue *q, const char *name, const unsigned char *data,
+        int size, int prio, int flags, tm_file_done done, void *arg) {
+
+    return push_entry(q, name, data, size, prio, flags, done, arg, 0);
+}
+
+unsigned long queue_push_derived(struct tm_queue *q, const char *name, const unsigned char *data,
+        int size, int prio, int flags, tm_file_done done, void *arg) {
+
+    return push_entry(q, name, data, size, prio, flags, done, arg, 1);
+}
+
+void queue_set_first_id(struct tm_queue *q, unsigned long id) {
+
+    pthread_mutex_lock(&q->lock);
+    q->next_id = id;
+    pthread_mutex_unlock(&q->lock);
+}
+
+struct tm_file *queue_pop(struct tm_queue *q) {
+
+    struct tm_file *file = NULL;
+    int c;
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->closed) {
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+
+    for (c = 0; c < TM_NUM_PRIO && file == NULL; c++) {
+        if (q->head[c] != NULL) {
+            file = unlink_head(q, c);
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return file;
+}
+
+struct tm_file *queue_try_pop(struct tm_queue *q, int prio) {
+
+    struct tm_file *file = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->head[prio] != NULL) {
+        file = unlink_head(q, prio);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    return file;
+}
+
+void queue_close(struct tm_queue *q) {
+
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    notify(q);
+    pthread_mutex_unlock(&q->lock);
+}
+
+int queue_drained(struct tm_queue *q) {
+
+    int drained;
+
+    pthread_mutex_lock(&q->lock);
+    drained = q->closed && q->count == 0;
+    pthread_mutex_unlock(&q->lock);
+
+    return drained;
+}
+
+void queue_set_notify(struct tm_queue *q, struct tm_event *ev) {
+
+    pthread_mutex_lock(&q->lock);
+    q->notify = ev;
+    pthread_mutex_unlock(&q->lock);
+}
+
+void queue_free_file(struct tm_file *file) {
+
+    if (file->done != NULL) {
+        file->done(file, file->status, file->done_arg);
+    }
+    free(file->name);
+    free(file);
+}
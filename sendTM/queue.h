@@ -0,0 +1,104 @@
+/********************************************************************************
+ * MOSES telemetry downlink file queue
+ *
+ * Thread-safe FIFOs, one per priority class, of files waiting to go down the
+ * link. The flight software (or the directory watcher) pushes entries at
+ * runtime and the pipeline's reader thread pops them as soon as it has room
+ * for another file of that class.
+ *
+ ******************************************************************************/
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <pthread.h>
+#include <limits.h>
+
+#include "sched.h"
+
+/*Queued size of a file sent to its end, as long as it is when the pipeline opens it*/
+#define TM_FILE_WHOLE -1
+
+/* Most bytes of a file that can be sent. Sizes are ints here and offsets u32 in the
+ * frame header, see frame.h, so anything larger is refused when it is queued, and
+ * again if it has grown past this by the time the pipeline opens it.
+ */
+#define TM_FILE_MAX INT_MAX
+
+/*Status handed to a completion callback*/
+#define TM_FILE_SENT 0          //every frame is on the wire
+#define TM_FILE_NOT_SENT -1     //could not be opened, or the downlink stopped first
+
+struct tm_file;
+
+/*Called once per entry, from whichever thread is done with it, just before it is freed*/
+typedef void (*tm_file_done)(const struct tm_file *file, int status, void *arg);
+
+/*An entry of the downlink queue, owned by the pipeline once popped*/
+struct tm_file {
+    unsigned long id;           //file ID carried in every frame header
+    char *name;
+    int size;                   //bytes to send from the start of the file, or TM_FILE_WHOLE
+    int prio;                   //TM_PRIO_* class
+    int flags;                  //TM_FILE_* options
+    const unsigned char *data;  //size bytes sent in place of reading the file, or NULL
+    tm_file_done done;          //completion callback, or NULL
+    void *done_arg;
+    int status;                 //TM_FILE_SENT once the pipeline has sent it all
+    struct tm_file *next;
+};
+
+struct tm_queue {
+    struct tm_file *head[TM_NUM_PRIO];
+    struct tm_file *tail[TM_NUM_PRIO];
+    int count;
+    int closed;
+    unsigned long next_id;      //ID given to the next file pushed
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    struct tm_event *notify;    //also signalled on every push and on close, if set
+};
+
+void queue_init(struct tm_queue *q);
+void queue_destroy(struct tm_queue *q);
+
+/*Append a copy of name to its class under the next file ID. Returns -1 if out of memory,
+ *the queue is closed or the file is larger than TM_FILE_MAX*/
+int queue_push(struct tm_queue *q, const char *name, int size, int prio, int flags);
+
+/* As queue_push(), but with done called once the file is sent or dropped, and if data
+ * is not NULL, with its size bytes sent straight from memory under name. The caller
+ * keeps data unchanged until then. Returns the file ID, or 0 if it was not queued.
+ */
+unsigned long queue_push_async(struct tm_queue *q, const char *name, const unsigned char *data,
+        int size, int prio, int flags, tm_file_done done, void *arg);
+
+/* As queue_push_async(), for a file the sender makes out of one it is already
+ * sending, such as its preview. Accepted even once the queue is closed, since
+ * the queue cannot drain before the file it comes from is done.
+ */
+unsigned long queue_push_derived(struct tm_queue *q, const char *name, const unsigned char *data,
+        int size, int prio, int flags, tm_file_done done, void *arg);
+
+/*Number files from id on, e.g. to carry on from an earlier pass*/
+void queue_set_first_id(struct tm_queue *q, unsigned long id);
+
+/*Wait for the most urgent file. Returns NULL once the queue is closed and empty*/
+struct tm_file *queue_pop(struct tm_queue *q);
+
+/*Take the oldest file of one class without waiting, or NULL*/
+struct tm_file *queue_try_pop(struct tm_queue *q, int prio);
+
+/*No more files will be pushed; entries already queued are still handed out*/
+void queue_close(struct tm_queue *q);
+
+/*Nonzero once the queue is closed and every entry has been popped*/
+int queue_drained(struct tm_queue *q);
+
+/*Route push and close notifications to ev as well (NULL to stop)*/
+void queue_set_notify(struct tm_queue *q, struct tm_event *ev);
+
+/*Release an entry returned by queue_pop() or queue_try_pop(), after its callback*/
+void queue_free_file(struct tm_file *file);
+
+#endif /* QUEUE_H */
@@ -0,0 +1,231 @@
+/********************************************************************************
+ * MOSES telemetry downlink rate control
+ *
+ * See rate.h.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <memory.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+
+#include "rate.h"
+
+/*Finished and bad frames of every port, as the driver counts them*/
+static int read_counts(struct tm_rate *r, unsigned long *ok, unsigned long *bad) {
+
+    struct mgsl_icount icount;
+    int i;
+
+    *ok = *bad = 0;
+    for (i = 0; i < r->ndev; i++) {
+        if (ioctl(r->dev[i]->fd, MGSL_IOCGSTATS, &icount) < 0) {
+            return -1;
+        }
+        *ok += icount.txok;
+        *bad += (unsigned long) icount.txunder + icount.txabort + icount.txtimeout;
+    }
+    return 0;
+}
+
+/*Index of the highest listed rate at or below bps, 0 if all are above it*/
+static int rate_index(const struct tm_rate *r, unsigned long bps) {
+
+    int i;
+
+    for (i = r->nrates - 1; i > 0 && r->rates[i] > bps; i--) {
+    }
+    return (i < 0) ? 0 : i;
+}
+
+void rate_init(struct tm_rate *r, struct tm_device **dev, struct tm_flow **flow, int ndev,
+        size_t frame_size, const unsigned long *rates, int nrates, int autoselect) {
+
+    unsigned long t;
+    int i, j;
+
+    memset(r, 0, sizeof (*r));
+    pthread_mutex_init(&r->lock, NULL);
+    for (i = 0; i < ndev && i < TM_MAX_PORTS; i++) {
+        r->dev[i] = dev[i];
+        r->flow[i] = flow[i];
+    }
+    r->ndev = i;
+    r->frame_size = frame_size;
+    r->bps = dev[0]->params.clock_speed;
+    r->hold = 1;
+
+    /*Short lists, sorted in place*/
+    for (i = 0; i < nrates && i < TM_RATE_MAX; i++) {
+        t = rates[i];
+        for (j = i; j > 0 && r->rates[j - 1] > t; j--) {
+            r->rates[j] = r->rates[j - 1];
+        }
+        r->rates[j] = t;
+    }
+    r->nrates = i;
+    r->cur = rate_index(r, r->bps);
+
+    r->autoselect = autoselect && r->nrates > 1;
+    if (r->autoselect) {
+        r->counted = (read_counts(r, &r->ok, &r->bad) == 0);
+        if (!r->counted) {
+            printf("MGSL_IOCGSTATS not available, link rate not adapted\n");
+        }
+    }
+}
+
+void rate_destroy(struct tm_rate *r) {
+
+    pthread_mutex_destroy(&r->lock);
+}
+
+void rate_request(struct tm_rate *r, unsigned long bps) {
+
+    pthread_mutex_lock(&r->lock);
+    r->requested = bps;
+    pthread_mutex_unlock(&r->lock);
+}
+
+/*Settle on a step along the list from the last window of driver counters*/
+static void select_rate(struct tm_rate *r) {
+
+    unsigned long ok, bad, d_ok, d_bad;
+
+    if (read_counts(r, &ok, &bad) < 0) {
+        return;
+    }
+    d_ok = ok - r->ok;
+    d_bad = bad - r->bad;
+    if (d_ok + d_bad < TM_RATE_WINDOW) {
+        return;
+    }
+    r->ok = ok;
+    r->bad = bad;
+
+    if (d_bad * 1000 > TM_RATE_DOWN_PERMILLE * (d_ok + d_bad)) {
+        r->clean = 0;
+        if (r->stepped_up && r->hold < TM_RATE_MAX_HOLD) {
+            r->hold *= 2; //Only just too fast, wait longer before the next try
+        }
+        r->stepped_up = 0;
+        if (r->rates[r->cur] < r->bps || r->cur > 0) {
+            r->target = (r->rates[r->cur] < r->bps) ? r->rates[r->cur] : r->rates[r->cur - 1];
+            r->why = "down";
+        }
+        return;
+    }
+
+    if (d_bad > 0) {
+        r->clean = 0;
+        return;
+    }
+    r->clean += d_ok;
+    if (r->stepped_up && r->clean >= TM_RATE_UP_FRAMES) {
+        r->stepped_up = 0; //Held up, the next step up comes as soon again
+        r->hold = 1;
+    }
+    if (r->clean >= (unsigned long) r->hold * TM_RATE_UP_FRAMES && r->cur < r->nrates - 1) {
+        r->target = r->rates[r->cur + 1];
+        r->why = "up";
+    }
+}
+
+int rate_due(struct tm_rate *r) {
+
+    r->target = r->bps;
+
+    pthread_mutex_lock(&r->lock);
+    if (r->requested != 0) {
+        r->target = r->requested;
+        r->why = "request";
+        r->requested = 0;
+    }
+    pthread_mutex_unlock(&r->lock);
+
+    if (r->target == r->bps && r->autoselect && r->counted) {
+        select_rate(r);
+    }
+    return r->target != r->bps;
+}
+
+/* Put ports 0 to n, the last of them the one that failed, back to the rates in old.
+ * Returns 0, or -1 if the ports are left out of step
+ */
+static int roll_back(struct tm_rate *r, const unsigned long *old, int n) {
+
+    int i, rc = 0;
+
+    for (i = 0; i <= n; i++) {
+        if (device_set_clock(r->dev[i], old[i]) < 0) {
+            printf("Unable to change %s back to %lu bps\n", r->dev[i]->name, old[i]);
+            rc = -1;
+        } else if (r->flow[i] != NULL && i < n) {
+            flow_set_bitrate(r->flow[i], (long) old[i], r->frame_size);
+        }
+    }
+    return rc;
+}
+
+/*Take a rate a port refused off the list, so automatic selection never tries it again*/
+static void drop_rate(struct tm_rate *r, unsigned long bps) {
+
+    int i, j;
+
+    for (i = 0; i < r->nrates && r->rates[i] != bps; i++) {
+    }
+    if (i == r->nrates) {
+        return;
+    }
+    for (j = i; j < r->nrates - 1; j++) {
+        r->rates[j] = r->rates[j + 1];
+    }
+    r->nrates--;
+    r->cur = rate_index(r, r->bps);
+    if (r->nrates == 0) {
+        r->autoselect = 0;
+    }
+}
+
+int rate_apply(struct tm_rate *r) {
+
+    unsigned long old[TM_MAX_PORTS];
+    unsigned long was = r->bps;
+    unsigned long bps;
+    int i;
+
+    /*Striped ports keep their rates relative to port 0*/
+    for (i = 0; i < r->ndev; i++) {
+        old[i] = r->dev[i]->params.clock_speed;
+        bps = (was == 0) ? r->target : (unsigned long) ((unsigned long long) old[i] * r->target
+                / was);
+        if (device_set_clock(r->dev[i], bps) < 0) {
+            printf("Unable to change %s to %lu bps\n", r->dev[i]->name, bps);
+
+            /*Carry on at the old rate, unless the ports can no longer agree on one*/
+            if (roll_back(r, old, i) < 0) {
+                return -1;
+            }
+            printf("RATE bps=%lu refused=%lu why=%s\n", was, r->target, r->why);
+            drop_rate(r, r->target);
+            r->target = was;
+            r->clean = 0; //A fresh run before any other step up
+            return 0;
+        }
+        if (r->flow[i] != NULL) {
+            flow_set_bitrate(r->flow[i], (long) bps, r->frame_size);
+        }
+    }
+
+    r->bps = r->target;
+    r->cur = rate_index(r, r->bps);
+    r->clean = 0;
+    r->stepped_up = (strcmp(r->why, "up") == 0);
+    if (r->autoselect && r->counted) {
+        read_counts(r, &r->ok, &r->bad); //A fresh window at the new rate
+    }
+    printf("RATE bps=%lu was=%lu why=%s\n", r->bps, was, r->why);
+
+    return 0;
+}
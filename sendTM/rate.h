@@ -0,0 +1,101 @@
+/********************************************************************************
+ * MOSES telemetry downlink rate control
+ *
+ * Changes the bit rate of a running downlink without a restart. A new rate is
+ * asked for from any thread with rate_request(), e.g. by a "!rate <bps>" line
+ * on the FIFO, and the transmit thread takes it up at the next chunk
+ * boundary: it drains the transmitter, then reprograms every port with
+ * device_set_clock(), so no frame ever goes out half at one rate. Rates are
+ * those of port 0; striped ports keep their clock_speed relative to it.
+ *
+ * With automatic selection on, the transmit thread also reads the driver's
+ * transmit counters (MGSL_IOCGSTATS) of every port at chunk boundaries and
+ * moves along the configured rates, one step at a time:
+ *
+ *   down  when more than TM_RATE_DOWN_PERMILLE of the last TM_RATE_WINDOW
+ *         frames finished underrun, aborted or timed out
+ *   up    after TM_RATE_UP_FRAMES frames in a row went out clean
+ *
+ * A step up that has to be taken back doubles the clean run needed before
+ * the next one, up to TM_RATE_MAX_HOLD times, so a link at the edge of a
+ * rate does not keep bouncing over it. Every change is logged as
+ *
+ *   RATE bps=<new> was=<old> why=<request|down|up>
+ *
+ * and a rate a port refuses as
+ *
+ *   RATE bps=<kept> refused=<rate> why=<request|down|up>
+ *
+ * after which it is taken off the list for the rest of the run, so it is
+ * never tried again, nor the transmitter drained for it.
+ *
+ ******************************************************************************/
+
+#ifndef RATE_H
+#define RATE_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "device.h"
+#include "flow.h"
+#include "stripe.h"
+
+/*Rates automatic selection moves between*/
+#define TM_RATE_MAX 8
+
+/*Frames finished by the driver per decision*/
+#define TM_RATE_WINDOW 64
+
+/*Bad frames per thousand in a window that back the rate off*/
+#define TM_RATE_DOWN_PERMILLE 10
+
+/*Clean frames in a row before the next rate up is tried*/
+#define TM_RATE_UP_FRAMES 1024
+
+/*Most times TM_RATE_UP_FRAMES a link that failed a step up waits*/
+#define TM_RATE_MAX_HOLD 16
+
+struct tm_rate {
+    struct tm_device *dev[TM_MAX_PORTS]; //configured ports, port 0 at bps, the rest in proportion
+    struct tm_flow *flow[TM_MAX_PORTS]; //pacing of each port, or NULL
+    int ndev;
+    size_t frame_size;
+    unsigned long rates[TM_RATE_MAX]; //ascending
+    int nrates;
+    int cur;                    //index of the highest rate at or below bps
+    unsigned long bps;          //rate the ports run at
+    int autoselect;
+    int counted;                //the ports provide MGSL_IOCGSTATS
+    unsigned long ok, bad;      //counters at the start of the window
+    unsigned long clean;        //clean frames in a row
+    int hold;                   //TM_RATE_UP_FRAMES multiples needed for a step up
+    int stepped_up;             //last change was a step up not yet proven
+    unsigned long target;       //rate settled on by rate_due()
+    const char *why;            //and what for, for the log
+    pthread_mutex_t lock;
+    unsigned long requested;    //rate asked for by rate_request(), or 0
+};
+
+/* Start from the rate the ports were opened at. rates lists nrates rates for
+ * automatic selection, in any order, and may be empty if autoselect is off.
+ */
+void rate_init(struct tm_rate *r, struct tm_device **dev, struct tm_flow **flow, int ndev,
+        size_t frame_size, const unsigned long *rates, int nrates, int autoselect);
+void rate_destroy(struct tm_rate *r);
+
+/*Ask for the ports to run at bps from the next chunk boundary. Any thread*/
+void rate_request(struct tm_rate *r, unsigned long bps);
+
+/*Transmit thread, at a chunk boundary: nonzero if the rate is to change, in
+ *which case the caller drains the transmitter and calls rate_apply()*/
+int rate_due(struct tm_rate *r);
+
+/* Move every port to the rate rate_due() settled on. Should any port refuse it, the
+ * ports already moved go back to the old rate and the link carries on at that.
+ * Returns 0, or -1 if a port could not be put back, the ports then being out of
+ * step and the downlink to be stopped.
+ */
+int rate_apply(struct tm_rate *r);
+
+#endif /* RATE_H */
@@ -0,0 +1,513 @@
+/********************************************************************************
+ * MOSES telemetry ground reassembly
+ *
+ * See rcv.h.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "rcv.h"
+#include "rice.h"
+#include "synclink.h"
+
+static unsigned long get32(const unsigned char *p) {
+
+    uint32_t n;
+
+    memcpy(&n, p, sizeof (n));
+    return ntohl(n);
+}
+
+/*Make room for at least len bytes of buffer, keeping what it holds*/
+static int grow(unsigned char **buf, size_t *cap, size_t len) {
+
+    unsigned char *p;
+
+    if (len <= *cap) {
+        return 0;
+    }
+    p = realloc(*buf, len);
+    if (p == NULL) {
+        printf("Unable to allocate %lu bytes\n", (unsigned long) len);
+        return -1;
+    }
+    *buf = p;
+    *cap = len;
+    return 0;
+}
+
+static int is_seen(const struct tm_rcv_file *f, unsigned long seq) {
+
+    return seq < f->seen_cap && (f->seen[seq / 8] & (1 << (seq % 8)));
+}
+
+static int set_seen(struct tm_rcv_file *f, unsigned long seq) {
+
+    unsigned long cap;
+    unsigned char *p;
+
+    if (seq >= f->seen_cap) {
+        cap = f->seen_cap ? f->seen_cap : 1024;
+        while (cap <= seq) {
+            cap *= 2;
+        }
+        p = realloc(f->seen, cap / 8);
+        if (p == NULL) {
+            printf("Unable to allocate the frame map of file %lu\n", f->id);
+            return -1;
+        }
+        memset(p + f->seen_cap / 8, 0, (cap - f->seen_cap) / 8);
+        f->seen = p;
+        f->seen_cap = cap;
+    }
+    f->seen[seq / 8] |= 1 << (seq % 8);
+    return 0;
+}
+
+/*Drop the frames kept for FEC and any parity waiting*/
+static void free_window(struct tm_rcv_file *f) {
+
+    int i;
+
+    if (f->win != NULL) {
+        for (i = 0; i < TM_RCV_FEC_WINDOW; i++) {
+            free(f->win[i].frame);
+        }
+        free(f->win);
+        f->win = NULL;
+    }
+    for (i = 0; i < TM_FEC_MAX_M; i++) {
+        free(f->group.parity[i]);
+        f->group.parity[i] = NULL;
+        f->group.parity_cap[i] = 0;
+    }
+    f->group.k = 0;
+}
+
+/*Unmap the output file and cut it to the bytes that have arrived*/
+static void close_output(struct tm_rcv_file *f) {
+
+    if (f->map != NULL) {
+        munmap(f->map, f->map_len);
+        f->map = NULL;
+        f->map_len = 0;
+    }
+    if (f->fd >= 0) {
+        if (ftruncate(f->fd, f->end) < 0) {
+            printf("ftruncate(tm_%lu.dat) error=%d %s\n", f->id, errno, strerror(errno));
+        }
+        close(f->fd);
+        f->fd = -1;
+    }
+}
+
+/*Reserve and map the output file through at least len bytes*/
+static int reserve(struct tm_rcv_file *f, size_t len) {
+
+    size_t map_len;
+    void *map;
+    int rc;
+
+    if (len <= f->map_len) {
+        return 0;
+    }
+    map_len = (len + TM_RCV_RESERVE - 1) / TM_RCV_RESERVE * TM_RCV_RESERVE;
+
+    /*Blocks are found now, not on the page fault of each frame*/
+    rc = posix_fallocate(f->fd, 0, map_len);
+    if (rc != 0) {
+        printf("posix_fallocate(tm_%lu.dat) error=%d %s\n", f->id, rc, strerror(rc));
+        return -1;
+    }
+    map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+    if (map == MAP_FAILED) {
+        printf("mmap(tm_%lu.dat) error=%d %s\n", f->id, errno, strerror(errno));
+        return -1;
+    }
+    if (f->map != NULL) {
+        munmap(f->map, f->map_len);
+    }
+    f->map = map;
+    f->map_len = map_len;
+    return 0;
+}
+
+/*Output file of id, created on its first frame. Keeps the list in use order*/
+static struct tm_rcv_file *find_file(struct tm_rcv *rv, unsigned long id) {
+
+    struct tm_rcv_file *f, **link;
+    char path[PATH_MAX];
+    struct stat st;
+    int i;
+
+    for (link = &rv->files; (f = *link) != NULL; link = &f->next) {
+        if (f->id == id) {
+            *link = f->next;
+            f->next = rv->files;
+            rv->files = f;
+            return f;
+        }
+    }
+
+    f = calloc(1, sizeof (*f));
+    if (f == NULL) {
+        printf("Unable to allocate file %lu\n", id);
+        return NULL;
+    }
+    f->id = id;
+    f->last_seq = -1;
+    f->length = -1;
+    f->win = calloc(TM_RCV_FEC_WINDOW, sizeof (*f->win));
+    if (f->win == NULL) {
+        printf("Unable to allocate file %lu\n", id);
+        free(f);
+        return NULL;
+    }
+    for (i = 0; i < TM_RCV_FEC_WINDOW; i++) {
+        f->win[i].seq = -1;
+    }
+
+    snprintf(path, sizeof (path), "%s/tm_%lu.dat", rv->dir, id);
+    f->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (f->fd < 0) {
+        printf("open(%s) error=%d %s\n", path, errno, strerror(errno));
+        free(f->win);
+        free(f);
+        return NULL;
+    }
+
+    /*Whatever an earlier run put there stays*/
+    if (fstat(f->fd, &st) == 0) {
+        f->end = st.st_size;
+    }
+
+    f->next = rv->files;
+    rv->files = f;
+    return f;
+}
+
+/*Every frame through the last is in: check the checksum and release the file*/
+static void complete(struct tm_rcv *rv, struct tm_rcv_file *f) {
+
+    unsigned int crc;
+    const char *result = "none";
+
+    f->end = f->length;
+    if (f->has_crc) {
+        crc = crc32c(TM_CRC_INIT, f->map, f->end);
+        result = (crc == f->crc) ? "ok" : "bad";
+        rv->crc_bad += (crc != f->crc);
+    }
+    printf("FILE id=%lu bytes=%lu frames=%lu rebuilt=%lu dups=%lu crc=%s\n", f->id,
+            (unsigned long) f->end, f->frames, f->rebuilt, f->dups, result);
+
+    close_output(f);
+    free_window(f);
+    f->done = 1;
+    rv->completed++;
+}
+
+/*Put a data frame in place. The header was checked by the caller*/
+static int place(struct tm_rcv *rv, struct tm_rcv_file *f, const struct tm_frame_hdr *hdr,
+        const unsigned char *payload) {
+
+    size_t len = hdr->length, raw;
+    long n;
+
+    if (hdr->flags & TM_HDR_CRC) {
+        if (len < TM_CRC_SIZE) {
+            rv->bad++;
+            return 0;
+        }
+        len -= TM_CRC_SIZE;
+        f->crc = get32(payload + len);
+        f->has_crc = 1;
+    }
+
+    if (hdr->flags & TM_HDR_RICE) {
+        if (len < 2) {
+            rv->bad++;
+            return 0;
+        }
+        raw = ((size_t) payload[0] << 8) | payload[1];
+        if (reserve(f, hdr->offset + raw) < 0) {
+            return -1;
+        }
+        n = rice_decode(payload, len, f->map + hdr->offset, raw);
+        if (n != (long) raw) {
+            printf("Corrupt compressed frame %lu of file %lu\n", hdr->seq, f->id);
+            rv->bad++;
+            return 0;
+        }
+    } else {
+        raw = len;
+        if (reserve(f, hdr->offset + raw) < 0) {
+            return -1;
+        }
+        memcpy(f->map + hdr->offset, payload, raw);
+    }
+
+    if (set_seen(f, hdr->seq) < 0) {
+        return -1;
+    }
+    f->frames++;
+    if (hdr->seq >= f->next_seq) {
+        f->next_seq = hdr->seq + 1;
+    }
+    if (hdr->flags & TM_HDR_LAST) {
+        f->last_seq = hdr->seq;
+        f->length = hdr->offset + raw;
+    }
+    if (hdr->offset + raw > f->end) {
+        f->end = hdr->offset + raw;
+    }
+    rv->bytes += raw;
+
+    return 0;
+}
+
+static int take_data(struct tm_rcv *rv, struct tm_rcv_file *f, const struct tm_frame_hdr *hdr,
+        const unsigned char *frame, size_t len);
+
+/* Rebuild the lost data frames of the pending group once enough of it is in.
+ * Gives the group up if a frame it needs has already left the window.
+ */
+static int try_group(struct tm_rcv *rv, struct tm_rcv_file *f) {
+
+    struct tm_rcv_group *g = &f->group;
+    struct tm_rcv_slot *slot;
+    struct tm_frame_hdr hdr;
+    unsigned char *data[TM_FEC_MAX_K];
+    int have_data[TM_FEC_MAX_K];
+    int i, j, lost = 0, parity = 0, k = g->k;
+    size_t flen;
+
+    if (k == 0) {
+        return 0;
+    }
+    for (i = 0; i < k; i++) {
+        have_data[i] = is_seen(f, g->first_seq + i);
+        lost += !have_data[i];
+    }
+    for (j = 0; j < TM_FEC_MAX_M; j++) {
+        parity += g->have[j];
+    }
+    if (lost == 0) {
+        g->k = 0;
+        return 0;
+    }
+    if (parity < lost) {
+        return 0; //More parity may be on its way
+    }
+
+    if (grow(&rv->scratch, &rv->scratch_len, (size_t) k * g->len) < 0) {
+        return -1;
+    }
+    for (i = 0; i < k; i++) {
+        data[i] = rv->scratch + (size_t) i * g->len;
+        memset(data[i], 0, g->len);
+        if (!have_data[i]) {
+            continue;
+        }
+        slot = &f->win[(g->first_seq + i) % TM_RCV_FEC_WINDOW];
+        if (slot->seq != (long long) (g->first_seq + i) || slot->len > g->len) {
+            g->k = 0;
+            return 0;
+        }
+        memcpy(data[i], slot->frame, slot->len);
+    }
+    if (fec_recover(&rv->fec, k, data, g->parity, have_data, g->have, g->len) < 0) {
+        return 0;
+    }
+
+    /*Rebuilt frames finish the group, so they must not start on it again*/
+    g->k = 0;
+    for (i = 0; i < k; i++) {
+        if (have_data[i]) {
+            continue;
+        }
+        flen = TM_HDR_SIZE + (((size_t) data[i][16] << 8) | data[i][17]);
+        if (flen > g->len || frame_hdr_unpack(&hdr, data[i], flen) < 0
+                || hdr.file_id != f->id || hdr.seq != g->first_seq + i) {
+            rv->bad++;
+            continue;
+        }
+        f->rebuilt++; //Before it can complete the file
+        rv->rebuilt++;
+        if (take_data(rv, f, &hdr, data[i], flen) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*Keep a data frame for FEC, then put it in place*/
+static int take_data(struct tm_rcv *rv, struct tm_rcv_file *f, const struct tm_frame_hdr *hdr,
+        const unsigned char *frame, size_t len) {
+
+    struct tm_rcv_slot *slot;
+
+    if (f->done || is_seen(f, hdr->seq)) {
+        f->dups++;
+        return 0;
+    }
+
+    slot = &f->win[hdr->seq % TM_RCV_FEC_WINDOW];
+    if (grow(&slot->frame, &slot->cap, len) < 0) {
+        return -1;
+    }
+    memcpy(slot->frame, frame, len);
+    slot->len = len;
+    slot->seq = hdr->seq;
+
+    if (place(rv, f, hdr, frame + TM_HDR_SIZE) < 0) {
+        return -1;
+    }
+
+    if (f->group.k > 0 && hdr->seq >= f->group.first_seq
+            && hdr->seq < f->group.first_seq + f->group.k && try_group(rv, f) < 0) {
+        return -1;
+    }
+    if (!f->done && f->last_seq >= 0 && f->frames == (unsigned long) f->last_seq + 1) {
+        complete(rv, f);
+    }
+    return 0;
+}
+
+static int take_parity(struct tm_rcv *rv, struct tm_rcv_file *f, const struct tm_frame_hdr *hdr,
+        const unsigned char *frame) {
+
+    struct tm_rcv_group *g = &f->group;
+    unsigned int row = hdr->fec_row;
+    int j;
+
+    rv->parity++;
+    if (f->done) {
+        return 0;
+    }
+    if (hdr->fec_k < 1 || hdr->fec_k > TM_RCV_FEC_WINDOW || row >= TM_FEC_MAX_M
+            || hdr->length <= TM_HDR_SIZE) {
+        rv->bad++;
+        return 0;
+    }
+    if (!rv->fec_ready) {
+        if (fec_code_init(&rv->fec, TM_FEC_MAX_K, TM_FEC_MAX_M) < 0) {
+            return -1;
+        }
+        rv->fec_ready = 1;
+    }
+
+    /*A new group gives up on the last one*/
+    if (g->k == 0 || g->first_seq != hdr->seq || g->k != (int) hdr->fec_k || g->len != hdr->length) {
+        g->first_seq = hdr->seq;
+        g->k = hdr->fec_k;
+        g->len = hdr->length;
+        for (j = 0; j < TM_FEC_MAX_M; j++) {
+            g->have[j] = 0;
+        }
+    }
+    if (g->have[row]) {
+        return 0;
+    }
+    if (grow(&g->parity[row], &g->parity_cap[row], g->len) < 0) {
+        return -1;
+    }
+    memcpy(g->parity[row], frame + TM_HDR_SIZE, g->len);
+    g->have[row] = 1;
+
+    return try_group(rv, f);
+}
+
+int rcv_init(struct tm_rcv *rv, const char *dir) {
+
+    memset(rv, 0, sizeof (*rv));
+    rv->dir = strdup(dir);
+    if (rv->dir == NULL) {
+        return -1;
+    }
+    if (access(dir, W_OK) < 0) {
+        printf("access(%s) error=%d %s\n", dir, errno, strerror(errno));
+        free(rv->dir);
+        rv->dir = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void rcv_destroy(struct tm_rcv *rv) {
+
+    struct tm_rcv_file *f, *next;
+
+    for (f = rv->files; f != NULL; f = next) {
+        next = f->next;
+        close_output(f);
+        free_window(f);
+        free(f->seen);
+        free(f);
+    }
+    if (rv->fec_ready) {
+        fec_code_destroy(&rv->fec);
+    }
+    free(rv->scratch);
+    free(rv->dir);
+    memset(rv, 0, sizeof (*rv));
+}
+
+int rcv_frame(struct tm_rcv *rv, const unsigned char *frame, size_t len) {
+
+    struct tm_frame_hdr hdr;
+    struct tm_rcv_file *f;
+
+    rv->frames++;
+    if (len > HDLC_MAX_FRAME_SIZE || frame_hdr_unpack(&hdr, frame, len) < 0) {
+        rv->bad++;
+        return 0;
+    }
+
+    f = find_file(rv, hdr.file_id);
+    if (f == NULL) {
+        return -1;
+    }
+    if (hdr.flags & TM_HDR_PARITY) {
+        return take_parity(rv, f, &hdr, frame);
+    }
+    return take_data(rv, f, &hdr, frame, len);
+}
+
+int rcv_gaps(struct tm_rcv *rv, FILE *fp) {
+
+    struct tm_rcv_file *f;
+    unsigned long seq, first, end;
+    int n = 0;
+
+    for (f = rv->files; f != NULL; f = f->next) {
+        if (f->done) {
+            continue;
+        }
+        end = (f->last_seq >= 0) ? (unsigned long) f->last_seq + 1 : f->next_seq;
+        for (seq = 0; seq < end; seq++) {
+            if (is_seen(f, seq)) {
+                continue;
+            }
+            for (first = seq; seq + 1 < end && !is_seen(f, seq + 1); seq++) {
+            }
+            fprintf(fp, "%lu %lu-%lu\n", f->id, first, seq);
+            n++;
+        }
+        if (f->last_seq < 0) {
+            fprintf(fp, "%lu %lu-*\n", f->id, end);
+            n++;
+        }
+    }
+    return n;
+}
@@ -0,0 +1,119 @@
+/********************************************************************************
+ * MOSES telemetry ground reassembly
+ *
+ * The receiving end of the frame format in frame.h, for rcvTM. Each data
+ * frame is put in place by its header, straight into a shared mapping of its
+ * output file, <dir>/tm_<file_id>.dat. Output files are reserved with
+ * fallocate() TM_RCV_RESERVE bytes at a time, so the disk never has to find
+ * room mid-image, and cut to their length once complete. Compressed frames
+ * (TM_HDR_RICE) are decoded into the mapping in place.
+ *
+ * A file is complete once its last frame and every frame before it have
+ * arrived; its CRC-32C is then checked over the whole output file, so files
+ * sent across two runs of sendTM (see checkpoint.h) or patched up by a
+ * retransmission check the same way.
+ *
+ * Each open file keeps its last TM_RCV_FEC_WINDOW data frames as received, so
+ * with FEC on the link (see fec.h) a group with some of its frames lost is
+ * rebuilt as soon as enough of its parity frames are in. Rebuilt frames go
+ * in place like any other.
+ *
+ * Whatever is still missing goes in a retransmit list in the format
+ * index_resend() reads:
+ *
+ *   <file_id> <first>-<last>   a run of lost frames
+ *   <file_id> <first>-*        lost from first through the end of the file,
+ *                              when the last frame has not been seen
+ *
+ * State lives as long as the process. A restarted rcvTM adds frames to the
+ * existing output files without cutting them short, but no longer knows which
+ * frames they already hold, so a file it only sees part of is listed as
+ * missing the rest.
+ * Not thread safe: one thread feeds every frame.
+ *
+ ******************************************************************************/
+
+#ifndef RCV_H
+#define RCV_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "frame.h"
+#include "fec.h"
+#include "roe.h"
+
+/*Output files grow by this much at a time, one image*/
+#define TM_RCV_RESERVE ((size_t) TM_ROE_IMAGE_BYTES)
+
+/*Data frames of each file kept for rebuilding lost ones, at least a whole group*/
+#define TM_RCV_FEC_WINDOW TM_FEC_MAX_K
+
+/*Parity frames waiting for the rest of their group*/
+struct tm_rcv_group {
+    unsigned long first_seq;    //first data frame of the group
+    int k;                      //data frames in the group, 0 if none pending
+    size_t len;                 //length of each parity row
+    unsigned char *parity[TM_FEC_MAX_M]; //rows without their header, each room for len
+    size_t parity_cap[TM_FEC_MAX_M];
+    int have[TM_FEC_MAX_M];
+};
+
+/*One data frame kept as received, header and checksum included*/
+struct tm_rcv_slot {
+    unsigned char *frame;
+    size_t len;
+    size_t cap;
+    long long seq;              //-1 if empty
+};
+
+struct tm_rcv_file {
+    unsigned long id;
+    int fd;                     //-1 once complete
+    unsigned char *map;         //shared mapping of the whole reservation
+    size_t map_len;
+    size_t end;                 //bytes the output file holds, from an earlier run or arrived since
+    long long length;           //of the file, known from its last frame, or -1
+    unsigned char *seen;        //bit per frame received
+    unsigned long seen_cap;     //frames the bitmap covers
+    unsigned long frames;       //distinct frames received
+    unsigned long next_seq;     //one past the highest frame received
+    long long last_seq;         //frame flagged TM_HDR_LAST, or -1 until it arrives
+    unsigned int crc;           //sent with the last frame
+    int has_crc;
+    int done;
+    unsigned long dups;
+    unsigned long rebuilt;      //frames rebuilt from parity
+    struct tm_rcv_slot *win;    //TM_RCV_FEC_WINDOW slots, by seq
+    struct tm_rcv_group group;
+    struct tm_rcv_file *next;
+};
+
+struct tm_rcv {
+    char *dir;
+    struct tm_rcv_file *files;  //most recently used first
+    struct tm_fec_code fec;     //every group's coefficients, built on the first parity frame
+    int fec_ready;
+    unsigned char *scratch;     //a whole group being rebuilt
+    size_t scratch_len;
+    unsigned long long frames;  //frames taken, of any kind
+    unsigned long long bytes;   //file bytes put in place
+    unsigned long bad;          //not ours, or not parseable
+    unsigned long parity;
+    unsigned long rebuilt;
+    unsigned long completed;
+    unsigned long crc_bad;
+};
+
+int rcv_init(struct tm_rcv *rv, const char *dir);
+
+/*Cut every output file to its length and release it*/
+void rcv_destroy(struct tm_rcv *rv);
+
+/*Put one received frame of len bytes in place. Returns 0, or -1 on an output error*/
+int rcv_frame(struct tm_rcv *rv, const unsigned char *frame, size_t len);
+
+/*Write the retransmit list of every frame still missing. Returns the number of lines*/
+int rcv_gaps(struct tm_rcv *rv, FILE *fp);
+
+#endif /* RCV_H */
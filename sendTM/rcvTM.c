@@ -0,0 +1,543 @@
+/********************************************************************************
+ * MOSES telemetry ground receiver
+ *
+ * The ground station end of sendTM. Each input is a SyncLink port brought up
+ * with the same device settings as the flight side (the settings file and
+ * -o options of config.h), but with its receiver enabled and its clock taken
+ * from the line, or a capture of such a link, frames back to back as they
+ * were read. Frames are put back together into files by rcv.h.
+ *
+ * N_HDLC keeps only a few received frames per port, and drops any that
+ * arrive when all of them are full. So every port has its own reader thread,
+ * under SCHED_FIFO with -P, that does nothing but move frames out of the
+ * driver into a deep ring of preallocated slots: TM_RCV_SLOTS frames of read
+ * ahead, over a second of a 10 Mbps link. A single assembler thread drains
+ * every ring into the output files, so a slow disk only ever fills the rings.
+ * Should a ring fill anyway, the frame is still read, so the driver keeps
+ * up, and dropped. Capture files are read no faster than the assembler
+ * takes them, and never drop.
+ *
+ * Progress is logged every TM_RCV_REPORT_SECS seconds, once per input and
+ * once for the whole station:
+ *
+ *   RCV port=<name> frames=<n> bytes=<n> dropped=<n> link_errors=<n>
+ *   RCV frames=<n> bytes=<n> rate_bps=<x> bad=<n> dropped=<n> rebuilt=<n>
+ *       files=<n> crc_bad=<n>
+ *
+ * where link_errors counts the frames the driver threw away itself (bad
+ * CRC, aborted, too short or too long, or overrun), and rate_bps is the
+ * rate frames came in since the last report, over every input. At the same
+ * time the retransmit list of everything still missing is rewritten to be
+ * uplinked, see index.h.
+ *
+ * rcvTM runs until SIGINT or SIGTERM, or until every capture given has been
+ * read.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/types.h>
+
+#include "synclink.h"
+#include "config.h"
+#include "device.h"
+#include "bufpool.h"
+#include "ring.h"
+#include "sched.h"
+#include "rcv.h"
+#include "rt.h"
+
+/*Frames of read ahead per input, change with -n*/
+#define TM_RCV_SLOTS 256
+
+/*Seconds between progress reports and retransmit list updates*/
+#define TM_RCV_REPORT_SECS 5
+
+/*Retransmit list written in the output directory unless -g names another*/
+#define TM_RCV_LIST_NAME "resend.list"
+
+/*Read buffer of a capture file*/
+#define TM_RCV_CAPTURE_BUF (1 << 20)
+
+#define RCV_OPTIONS "F:o:d:g:n:P:"
+
+struct rcv_port {
+    const char *name;
+    struct tm_device dev;       //SyncLink port, or fd -1 for a capture
+    FILE *capture;
+    struct tm_pool pool;        //one buffer per slot
+    struct tm_ring ring;
+    unsigned char *spill;       //frame read with every slot full, then dropped
+    unsigned long long frames, bytes;
+    unsigned long dropped;
+    struct rcv_station *station;
+    pthread_t thread;
+};
+
+struct rcv_station {
+    struct rcv_port port[TM_MAX_PORTS];
+    int nports;
+    int nopen;                  //ports to close
+    int nthreads;               //readers to join
+    struct tm_event on_put;     //a frame to assemble, or an input closed
+    struct tm_event on_release; //a slot free again
+    struct tm_rcv rcv;
+    pthread_mutex_t lock;       //rcv and the port counters, shared with the reports
+    int stop;                   //readers finish up
+    int failed;                 //an output file could not be written
+    pthread_t main;
+    pthread_t assembler;
+};
+
+void display_usage(void) {
+    printf("Usage: rcvtm [-F conf] [-o key=value] [-d dir] [-g list] [-n slots] [-P prio]\n"
+            "             [input ...]\n"
+            "input   = SyncLink device or capture file to receive from (default the device and "
+            "port settings)\n"
+            "-F conf = read the link settings from conf instead of " TM_CONFIG_FILE
+            " (see config.h)\n"
+            "-o key=value = apply one setting as if it were a line of the file, after it\n"
+            "-d dir  = write received files to dir as tm_<file_id>.dat (default .)\n"
+            "-g list = keep the retransmit list in list (default <dir>/" TM_RCV_LIST_NAME ")\n"
+            "-n slots = frames of read ahead per input (default %d)\n"
+            "-P prio = run the device readers under SCHED_FIFO at prio, see rt.h (default off)\n",
+            TM_RCV_SLOTS);
+}
+
+static void lock_station(struct rcv_station *st) {
+
+    pthread_mutex_lock(&st->lock);
+}
+
+static void unlock_station(struct rcv_station *st) {
+
+    pthread_mutex_unlock(&st->lock);
+}
+
+/*Hand one frame in buf, checked out of the port's pool, to the assembler*/
+static void queue_frame(struct rcv_port *p, unsigned char *buf, size_t len) {
+
+    struct tm_chunk *chunk;
+
+    chunk = ring_try_get_free(&p->ring); //Never full, the pool has as many buffers as slots
+    memset(chunk, 0, sizeof (*chunk));
+    chunk->buf = buf;
+    chunk->pool = &p->pool;
+    chunk->data = buf;
+    chunk->len = len;
+    ring_put(&p->ring);
+}
+
+/*Move frames from a SyncLink into the ring until stopped*/
+static void *device_reader(void *arg) {
+
+    struct rcv_port *p = arg;
+    struct pollfd pfd;
+    unsigned char *buf;
+    ssize_t n;
+
+    pfd.fd = p->dev.fd;
+    pfd.events = POLLIN;
+
+    while (!p->station->stop) {
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+
+        /*Every frame the driver holds before polling again*/
+        for (;;) {
+            buf = pool_tryget(&p->pool, 0);
+            n = read(p->dev.fd, (buf != NULL) ? buf : p->spill, HDLC_MAX_FRAME_SIZE);
+            if (n <= 0) {
+                if (buf != NULL) {
+                    pool_put(&p->pool, buf);
+                }
+                break;
+            }
+            if (buf == NULL) {
+                lock_station(p->station);
+                p->dropped++;
+                unlock_station(p->station);
+                continue;
+            }
+            queue_frame(p, buf, n);
+        }
+        if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            printf("read(%s) error=%d %s\n", p->name, errno, strerror(errno));
+            break;
+        }
+    }
+
+    ring_close(&p->ring);
+    return NULL;
+}
+
+/*Split a capture into frames by their headers, as fast as the assembler takes them*/
+static void *capture_reader(void *arg) {
+
+    struct rcv_port *p = arg;
+    unsigned char *buf;
+    size_t len;
+
+    while (!p->station->stop) {
+        buf = pool_get(&p->pool);
+        if (fread(buf, 1, TM_HDR_SIZE, p->capture) != TM_HDR_SIZE) {
+            pool_put(&p->pool, buf);
+            break;
+        }
+        len = TM_HDR_SIZE + (((size_t) buf[16] << 8) | buf[17]);
+        if (buf[0] != TM_HDR_MAGIC0 || buf[1] != TM_HDR_MAGIC1 || len > HDLC_MAX_FRAME_SIZE
+                || fread(buf + TM_HDR_SIZE, 1, len - TM_HDR_SIZE, p->capture)
+                != len - TM_HDR_SIZE) {
+            printf("%s: not a capture of the downlink, or cut short\n", p->name);
+            pool_put(&p->pool, buf);
+            break;
+        }
+        queue_frame(p, buf, len);
+    }
+
+    ring_close(&p->ring);
+    return NULL;
+}
+
+/*Put every frame in place as it comes, in turn from each input*/
+static void *assembler(void *arg) {
+
+    struct rcv_station *st = arg;
+    struct rcv_port *p;
+    struct tm_chunk *chunk;
+    unsigned char *buf;
+    unsigned long seq;
+    int i, rc, busy, open;
+
+    for (;;) {
+        seq = event_seq(&st->on_put);
+        busy = 0;
+        open = 0;
+        for (i = 0; i < st->nports; i++) {
+            p = &st->port[i];
+            while ((chunk = ring_peek_full(&p->ring)) != NULL) {
+                lock_station(st);
+                rc = st->failed ? 0 : rcv_frame(&st->rcv, chunk->data, chunk->len);
+                p->frames++;
+                p->bytes += chunk->len;
+                if (rc < 0) {
+                    st->failed = 1;
+                    pthread_kill(st->main, SIGTERM); //Readers still go on until stopped
+                }
+                unlock_station(st);
+
+                /*The slot first, so a reader never has a buffer but no slot for it*/
+                buf = chunk->buf;
+                ring_release(&p->ring);
+                pool_put(&p->pool, buf);
+                busy = 1;
+            }
+            open += !ring_done(&p->ring);
+        }
+        if (open == 0) {
+            break;
+        }
+        if (!busy) {
+            event_wait(&st->on_put, seq);
+        }
+    }
+
+    pthread_kill(st->main, SIGTERM); //Nothing more will arrive
+    return NULL;
+}
+
+/*Frames the driver dropped on a port, or 0 for a capture*/
+static unsigned long link_errors(const struct rcv_port *p) {
+
+    struct mgsl_icount icount;
+
+    if (p->dev.fd < 0 || ioctl(p->dev.fd, MGSL_IOCGSTATS, &icount) < 0) {
+        return 0;
+    }
+    return (unsigned long) icount.rxshort + icount.rxlong + icount.rxabort + icount.rxover
+            + icount.rxcrc;
+}
+
+/*Rewrite the retransmit list so a reader never sees half of it*/
+static void write_list(struct rcv_station *st, const char *list) {
+
+    char tmp[PATH_MAX];
+    FILE *fp;
+
+    snprintf(tmp, sizeof (tmp), "%s.new", list);
+    fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        printf("fopen(%s) error=%d %s\n", tmp, errno, strerror(errno));
+        return;
+    }
+    lock_station(st);
+    rcv_gaps(&st->rcv, fp);
+    unlock_station(st);
+    if (fclose(fp) != 0 || rename(tmp, list) < 0) {
+        printf("rename(%s) error=%d %s\n", tmp, errno, strerror(errno));
+    }
+}
+
+static void report(struct rcv_station *st, unsigned long long *last_bytes, struct timespec *last) {
+
+    struct rcv_port *p;
+    struct timespec now;
+    unsigned long long bytes = 0;
+    unsigned long dropped = 0;
+    double sec;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    sec = (now.tv_sec - last->tv_sec) + (now.tv_nsec - last->tv_nsec) / 1e9;
+
+    lock_station(st);
+    for (i = 0; i < st->nports; i++) {
+        p = &st->port[i];
+        printf("RCV port=%s frames=%llu bytes=%llu dropped=%lu link_errors=%lu\n", p->name,
+                p->frames, p->bytes, p->dropped, link_errors(p));
+        bytes += p->bytes;
+        dropped += p->dropped;
+    }
+    printf("RCV frames=%llu bytes=%llu rate_bps=%.0f bad=%lu dropped=%lu rebuilt=%lu "
+            "files=%lu crc_bad=%lu\n", st->rcv.frames, st->rcv.bytes,
+            (sec > 0) ? (bytes - *last_bytes) * 8 / sec : 0.0, st->rcv.bad, dropped,
+            st->rcv.rebuilt, st->rcv.completed, st->rcv.crc_bad);
+    unlock_station(st);
+
+    *last_bytes = bytes;
+    *last = now;
+}
+
+/*Bring up one input: a SyncLink receiving with the settings of port n, or a capture*/
+static int open_port(struct rcv_station *st, const struct tm_config *cfg, int n,
+        const char *name, int slots) {
+
+    struct rcv_port *p = &st->port[n];
+    struct stat sb;
+    int rc;
+
+    p->dev.fd = -1;
+    p->name = name;
+    p->station = st;
+    config_port(cfg, (n < cfg->nports) ? n : 0, &p->dev);
+    p->dev.name = name;
+    p->dev.fd = -1;
+
+    if (stat(name, &sb) < 0) {
+        printf("stat(%s) error=%d %s\n", name, errno, strerror(errno));
+        return -1;
+    }
+    if (S_ISCHR(sb.st_mode)) {
+        p->dev.receive = 1;
+        p->dev.synth = TM_SYNTH_OFF; //The clock comes in on RXC
+        rc = device_open(&p->dev);
+        if (rc < 0) {
+            return rc;
+        }
+    } else {
+        p->capture = fopen(name, "r");
+        if (p->capture == NULL) {
+            printf("fopen(%s) error=%d %s\n", name, errno, strerror(errno));
+            return -1;
+        }
+        setvbuf(p->capture, NULL, _IOFBF, TM_RCV_CAPTURE_BUF);
+    }
+
+    p->spill = malloc(HDLC_MAX_FRAME_SIZE);
+    if (p->spill == NULL || pool_init(&p->pool, slots, HDLC_MAX_FRAME_SIZE) < 0
+            || ring_init(&p->ring, slots, &st->on_put, &st->on_release) < 0) {
+        printf("Unable to allocate %d frames of read ahead for %s\n", slots, name);
+        return -1;
+    }
+    return 0;
+}
+
+static void close_port(struct rcv_port *p) {
+
+    if (p->dev.fd >= 0) {
+        device_close(&p->dev);
+    }
+    if (p->capture != NULL) {
+        fclose(p->capture);
+    }
+    ring_destroy(&p->ring);
+    pool_destroy(&p->pool);
+    free(p->spill);
+}
+
+/*Program entry point*/
+int main(int argc, char **argv) {
+
+    struct rcv_station st;
+    struct tm_config cfg;
+    const char *names[TM_MAX_PORTS];
+    char *confname = TM_CONFIG_FILE;
+    int confrequired = 0;
+    char *dir = ".";
+    char *list = NULL;
+    char listbuf[PATH_MAX];
+    int slots = TM_RCV_SLOTS;
+    int rt_priority = 0;
+    int opt, i, rc = 0, sig;
+    unsigned long long last_bytes = 0;
+    struct timespec last, wait;
+    sigset_t mask;
+
+    /*The settings file goes under every other option, so find it first*/
+    while ((opt = getopt(argc, argv, RCV_OPTIONS)) != -1) {
+        if (opt == 'F') {
+            confname = optarg;
+            confrequired = 1;
+        } else if (opt == '?') {
+            display_usage();
+            return 1;
+        }
+    }
+
+    config_defaults(&cfg);
+    if (config_load(&cfg, confname, confrequired) < 0) {
+        return 1;
+    }
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, RCV_OPTIONS)) != -1) {
+        switch (opt) {
+            case 'F':
+                rc = 0;
+                break;
+            case 'o':
+                rc = config_set_option(&cfg, optarg);
+                break;
+            case 'd':
+                dir = optarg;
+                break;
+            case 'g':
+                list = optarg;
+                break;
+            case 'n':
+                slots = atoi(optarg);
+                rc = (slots > 0) ? 0 : -1;
+                break;
+            case 'P':
+                rt_priority = atoi(optarg);
+                rc = (rt_priority > 0) ? 0 : -1;
+                break;
+            default:
+                rc = -1;
+                break;
+        }
+        if (rc < 0) {
+            display_usage();
+            return 1;
+        }
+    }
+
+    /*Inputs on the command line, or the ports the flight side would send on*/
+    memset(&st, 0, sizeof (st));
+    if (optind < argc) {
+        if (argc - optind > TM_MAX_PORTS) {
+            printf("At most %d inputs\n", TM_MAX_PORTS);
+            return 1;
+        }
+        for (i = optind; i < argc; i++) {
+            names[st.nports++] = argv[i];
+        }
+    } else {
+        names[st.nports++] = cfg.device;
+        for (i = 1; i < cfg.nports; i++) {
+            names[st.nports++] = cfg.ports[i];
+        }
+    }
+    if (list == NULL) {
+        snprintf(listbuf, sizeof (listbuf), "%s/%s", dir, TM_RCV_LIST_NAME);
+        list = listbuf;
+    }
+
+    /*Signals are taken by this thread alone, the others are started with them blocked*/
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    if (rcv_init(&st.rcv, dir) < 0) {
+        return 1;
+    }
+    pthread_mutex_init(&st.lock, NULL);
+    event_init(&st.on_put);
+    event_init(&st.on_release);
+    st.main = pthread_self();
+
+    for (i = 0; i < st.nports && rc == 0; i++) {
+        st.nopen++;
+        rc = open_port(&st, &cfg, i, names[i], slots);
+    }
+    for (i = 0; i < st.nports && rc == 0; i++) {
+        rc = pthread_create(&st.port[i].thread, NULL,
+                (st.port[i].capture != NULL) ? capture_reader : device_reader, &st.port[i]);
+        if (rc != 0) {
+            printf("pthread_create error=%d %s\n", rc, strerror(rc));
+            rc = -1;
+            break;
+        }
+        st.nthreads++;
+        if (rt_priority > 0 && st.port[i].capture == NULL) {
+            rt_promote(st.port[i].thread, rt_priority, "receive");
+        }
+    }
+
+    if (rc == 0) {
+        printf("Receiving into %s, retransmit list %s\n", dir, list);
+        clock_gettime(CLOCK_MONOTONIC, &last);
+        pthread_create(&st.assembler, NULL, assembler, &st);
+
+        /*Report until stopped, or until the assembler has nothing left to read*/
+        for (;;) {
+            wait.tv_sec = TM_RCV_REPORT_SECS;
+            wait.tv_nsec = 0;
+            sig = sigtimedwait(&mask, NULL, &wait);
+            if (sig == SIGINT || sig == SIGTERM) {
+                break;
+            }
+            report(&st, &last_bytes, &last);
+            write_list(&st, list);
+        }
+    }
+
+    st.stop = 1;
+    for (i = 0; i < st.nthreads; i++) {
+        pthread_join(st.port[i].thread, NULL);
+    }
+    if (rc == 0) {
+        pthread_join(st.assembler, NULL); //Once whatever is left in the rings is in place
+        report(&st, &last_bytes, &last);
+        write_list(&st, list);
+    }
+    if (st.failed) {
+        printf("Unable to write every frame received\n");
+        rc = -1;
+    }
+
+    for (i = 0; i < st.nopen; i++) {
+        close_port(&st.port[i]);
+    }
+    rcv_destroy(&st.rcv);
+    event_destroy(&st.on_put);
+    event_destroy(&st.on_release);
+    pthread_mutex_destroy(&st.lock);
+    config_destroy(&cfg);
+
+    return (rc == 0) ? 0 : 1;
+}
@@ -0,0 +1,261 @@
+/********************************************************************************
+ * MOSES telemetry downlink lossless compression
+ *
+ * See rice.h.
+ *
+ ******************************************************************************/
+
+#include <memory.h>
+#include <stdint.h>
+
+#include "rice.h"
+#include "frame.h"
+
+/*MSB-first bit writer that never writes past end*/
+struct bitw {
+    unsigned char *p, *end;
+    uint32_t acc;
+    int nbits;                  //bits held in acc
+    int full;                   //set once a write has been dropped
+};
+
+static void put_bits(struct bitw *w, uint32_t v, int n) {
+
+    while (n > 0) {
+        int take = (n > 16) ? 16 : n;
+
+        n -= take;
+        w->acc = (w->acc << take) | ((v >> n) & ((1u << take) - 1));
+        w->nbits += take;
+        while (w->nbits >= 8) {
+            w->nbits -= 8;
+            if (w->p == w->end) {
+                w->full = 1;
+                return;
+            }
+            *w->p++ = (unsigned char) (w->acc >> w->nbits);
+        }
+    }
+}
+
+static void flush_bits(struct bitw *w) {
+
+    if (w->nbits > 0) {
+        put_bits(w, 0, 8 - w->nbits);
+    }
+}
+
+struct bitr {
+    const unsigned char *p, *end;
+    uint32_t acc;
+    int nbits;
+    int over;                   //set once a read ran past the end
+};
+
+static uint32_t get_bits(struct bitr *r, int n) {
+
+    uint32_t v = 0;
+
+    while (n > 0) {
+        int take = (n > 8) ? 8 : n;
+
+        while (r->nbits < take) {
+            r->acc = (r->acc << 8) | ((r->p < r->end) ? *r->p : 0);
+            if (r->p++ >= r->end) {
+                r->over = 1;
+            }
+            r->nbits += 8;
+        }
+        r->nbits -= take;
+        v = (v << take) | ((r->acc >> r->nbits) & ((1u << take) - 1));
+        n -= take;
+    }
+    return v;
+}
+
+/*Signed difference folded onto 0, 1, 2, ... for -0, -1, +1, ...*/
+static unsigned int zigzag(int d) {
+
+    return (d >= 0) ? 2u * d : 2u * -d - 1;
+}
+
+static int unzigzag(unsigned int m) {
+
+    return (m & 1) ? -(int) ((m + 1) / 2) : (int) (m / 2);
+}
+
+static unsigned int sample(const unsigned char *raw, size_t i) {
+
+    return raw[2 * i] | (raw[2 * i + 1] << 8);
+}
+
+/*Bits needed to code a block with parameter k*/
+static unsigned long block_cost(const unsigned int *m, int n, int k) {
+
+    unsigned long bits = 0;
+    unsigned int q;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        q = m[i] >> k;
+        bits += (q < TM_RICE_ESCAPE) ? q + 1 + k : TM_RICE_ESCAPE + 16;
+    }
+    return bits;
+}
+
+size_t rice_encode(const unsigned char *raw, size_t len, unsigned char *out) {
+
+    unsigned int m[TM_RICE_BLOCK];
+    unsigned long sum, cost, best_cost;
+    size_t nsamples = len / 2, i;
+    unsigned int prev, x, q;
+    int n, j, k, best;
+    struct bitw w;
+
+    if (len < 4 || len > 0xffff) {
+        return 0;
+    }
+
+    /*Output must come out smaller than raw, so that is all the room it gets*/
+    w.p = out + 2;
+    w.end = out + len - 1;
+    w.acc = 0;
+    w.nbits = 0;
+    w.full = 0;
+    out[0] = (unsigned char) (len >> 8);
+    out[1] = (unsigned char) len;
+
+    prev = sample(raw, 0);
+    put_bits(&w, prev, 16);
+
+    for (i = 1; i < nsamples && !w.full; i += n) {
+        n = (nsamples - i < TM_RICE_BLOCK) ? (int) (nsamples - i) : TM_RICE_BLOCK;
+
+        sum = 0;
+        for (j = 0; j < n; j++) {
+            x = sample(raw, i + j);
+            m[j] = zigzag((int16_t) (x - prev));
+            prev = x;
+            sum += m[j];
+        }
+
+        /*Start from log2 of the mean and look one step either side*/
+        for (k = 0; k < 14 && (sum >> (k + 1)) >= (unsigned long) n; k++) {
+        }
+        best = 15;
+        best_cost = 16UL * n;
+        for (j = (k > 0) ? k - 1 : 0; j <= k + 1 && j < 15; j++) {
+            cost = block_cost(m, n, j);
+            if (cost < best_cost) {
+                best_cost = cost;
+                best = j;
+            }
+        }
+
+        put_bits(&w, best, 4);
+        for (j = 0; j < n; j++) {
+            if (best == 15) {
+                put_bits(&w, m[j], 16);
+                continue;
+            }
+            q = m[j] >> best;
+            if (q < TM_RICE_ESCAPE) {
+                put_bits(&w, (1u << (q + 1)) - 2, q + 1); //q ones and a zero
+                put_bits(&w, m[j], best);
+            } else {
+                put_bits(&w, (1u << TM_RICE_ESCAPE) - 1, TM_RICE_ESCAPE);
+                put_bits(&w, m[j], 16);
+            }
+        }
+    }
+
+    if (len & 1) {
+        put_bits(&w, raw[len - 1], 8);
+    }
+    flush_bits(&w);
+
+    return w.full ? 0 : (size_t) (w.p - out);
+}
+
+long rice_decode(const unsigned char *in, size_t len, unsigned char *out, size_t max) {
+
+    size_t raw_len, nsamples, i;
+    unsigned int prev, m, q;
+    int j, n, k;
+    struct bitr r;
+
+    if (len < 2) {
+        return -1;
+    }
+    raw_len = (in[0] << 8) | in[1];
+    if (raw_len < 4 || raw_len > max) {
+        return -1;
+    }
+    nsamples = raw_len / 2;
+
+    r.p = in + 2;
+    r.end = in + len;
+    r.acc = 0;
+    r.nbits = 0;
+    r.over = 0;
+
+    prev = get_bits(&r, 16);
+    out[0] = (unsigned char) prev;
+    out[1] = (unsigned char) (prev >> 8);
+
+    for (i = 1; i < nsamples && !r.over; i += n) {
+        n = (nsamples - i < TM_RICE_BLOCK) ? (int) (nsamples - i) : TM_RICE_BLOCK;
+        k = get_bits(&r, 4);
+
+        for (j = 0; j < n; j++) {
+            if (k == 15) {
+                m = get_bits(&r, 16);
+            } else {
+                for (q = 0; q < TM_RICE_ESCAPE && get_bits(&r, 1); q++) {
+                }
+                m = (q < TM_RICE_ESCAPE) ? (q << k) | get_bits(&r, k) : get_bits(&r, 16);
+            }
+            prev = (prev + unzigzag(m)) & 0xffff;
+            out[2 * (i + j)] = (unsigned char) prev;
+            out[2 * (i + j) + 1] = (unsigned char) (prev >> 8);
+        }
+    }
+
+    if (raw_len & 1) {
+        out[raw_len - 1] = (unsigned char) get_bits(&r, 8);
+    }
+
+    return r.over ? -1 : (long) raw_len;
+}
+
+size_t rice_pack(const unsigned char *raw, size_t len, size_t frame_size,
+        unsigned char *out, size_t max, unsigned int *crc) {
+
+    struct tm_rice_rec rec;
+    size_t used = 0, off, n;
+
+    for (off = 0; off < len; off += n) {
+        n = (len - off < frame_size) ? len - off : frame_size;
+        if (used + sizeof (rec) + n > max) {
+            return 0;
+        }
+
+        /*Frame by frame, so the encoder finds the bytes still in cache*/
+        if (crc != NULL) {
+            *crc = crc32c(*crc, raw + off, n);
+        }
+
+        rec.raw_len = n;
+        rec.len = rice_encode(raw + off, n, out + used + sizeof (rec));
+        rec.flags = TM_HDR_RICE;
+        if (rec.len == 0) { //Incompressible, goes out as it is
+            memcpy(out + used + sizeof (rec), raw + off, n);
+            rec.len = n;
+            rec.flags = 0;
+        }
+        memcpy(out + used, &rec, sizeof (rec));
+        used += sizeof (rec) + rec.len;
+    }
+
+    return used;
+}
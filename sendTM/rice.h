@@ -0,0 +1,55 @@
+/********************************************************************************
+ * MOSES telemetry downlink lossless compression
+ *
+ * ROE images are 16 bit detector counts that change slowly from pixel to
+ * pixel. Each frame's payload is compressed on its own: every sample is
+ * replaced by its difference from the previous one, and the differences are
+ * Rice coded in blocks of TM_RICE_BLOCK samples with the best parameter per
+ * block. Since frames decode independently, a lost frame costs only its own
+ * pixels, and the header's offset still says where they go in the file.
+ *
+ * A compressed payload is a big-endian u16 raw length, then a bitstream
+ * (most significant bit first). The bitstream holds the first sample in 16
+ * bits, then for each block a 4 bit parameter k followed by its samples. For
+ * k < 15, each sample is a unary quotient and k low bits; a quotient of
+ * TM_RICE_ESCAPE ones is followed by the mapped difference in 16 bits. k = 15
+ * stores the block as raw 16 bit differences. An odd final byte follows in 8
+ * bits. Samples are read as little-endian, the byte order of the flight
+ * computer.
+ *
+ * The compression thread packs a chunk into records of struct tm_rice_rec,
+ * each followed by the payload of one frame, compressed (TM_HDR_RICE) or
+ * raw when compression would not make it smaller.
+ *
+ ******************************************************************************/
+
+#ifndef RICE_H
+#define RICE_H
+
+#include <stddef.h>
+
+#define TM_RICE_BLOCK 32
+#define TM_RICE_ESCAPE 24
+
+/*Header of each frame packed into a compressed chunk*/
+struct tm_rice_rec {
+    unsigned short len;         //payload bytes that follow
+    unsigned short raw_len;     //file bytes the payload decodes to
+    unsigned int flags;         //TM_HDR_RICE if compressed
+};
+
+/*Compress len bytes into out. Returns the payload length, or 0 if it would not be
+ *smaller than len (send the bytes raw instead)*/
+size_t rice_encode(const unsigned char *raw, size_t len, unsigned char *out);
+
+/*Decode a compressed payload into out, which has room for max bytes. Returns the
+ *raw length, or -1 if the payload is corrupt*/
+long rice_decode(const unsigned char *in, size_t len, unsigned char *out, size_t max);
+
+/*Pack len bytes of whole frames of frame_size into records in out, which has room
+ *for max bytes, folding the raw bytes into *crc unless crc is NULL. Returns the
+ *bytes used, or 0 if the chunk does not fit*/
+size_t rice_pack(const unsigned char *raw, size_t len, size_t frame_size,
+        unsigned char *out, size_t max, unsigned int *crc);
+
+#endif /* RICE_H */
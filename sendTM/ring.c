@@ -0,0 +1,111 @@
+/********************************************************************************
+ * MOSES telemetry downlink buffer ring
+ *
+ * See ring.h. One reader thread fills slots in order and one transmit thread
+ * drains them in the same order. Neither side blocks here: each waits on its
+ * event counter, which the other side signals, so a thread can wait on several
+ * rings (and the file queue) at once.
+ *
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <memory.h>
+
+#include "ring.h"
+#include "sched.h"
+
+int ring_init(struct tm_ring *ring, int nslots, struct tm_event *on_put,
+        struct tm_event *on_release) {
+
+    memset(ring, 0, sizeof (*ring));
+
+    ring->slots = calloc(nslots, sizeof (struct tm_chunk));
+    if (ring->slots == NULL) {
+        return -1;
+    }
+
+    ring->nslots = nslots;
+    ring->on_put = on_put;
+    ring->on_release = on_release;
+
+    pthread_mutex_init(&ring->lock, NULL);
+
+    return 0;
+}
+
+void ring_destroy(struct tm_ring *ring) {
+
+    if (ring->slots != NULL) {
+        free(ring->slots);
+        ring->slots = NULL;
+
+        pthread_mutex_destroy(&ring->lock);
+    }
+}
+
+struct tm_chunk *ring_try_get_free(struct tm_ring *ring) {
+
+    struct tm_chunk *chunk = NULL;
+
+    pthread_mutex_lock(&ring->lock);
+    if (ring->count < ring->nslots && !ring->closed) {
+        chunk = &ring->slots[ring->tail];
+    }
+    pthread_mutex_unlock(&ring->lock);
+
+    return chunk;
+}
+
+void ring_put(struct tm_ring *ring) {
+
+    pthread_mutex_lock(&ring->lock);
+    ring->tail = (ring->tail + 1) % ring->nslots;
+    ring->count++;
+    pthread_mutex_unlock(&ring->lock);
+
+    event_signal(ring->on_put);
+}
+
+struct tm_chunk *ring_peek_full(struct tm_ring *ring) {
+
+    struct tm_chunk *chunk = NULL;
+
+    pthread_mutex_lock(&ring->lock);
+    if (ring->count > 0) {
+        chunk = &ring->slots[ring->head]; //Drain what is left even after close
+    }
+    pthread_mutex_unlock(&ring->lock);
+
+    return chunk;
+}
+
+void ring_release(struct tm_ring *ring) {
+
+    pthread_mutex_lock(&ring->lock);
+    ring->head = (ring->head + 1) % ring->nslots;
+    ring->count--;
+    pthread_mutex_unlock(&ring->lock);
+
+    event_signal(ring->on_release);
+}
+
+void ring_close(struct tm_ring *ring) {
+
+    pthread_mutex_lock(&ring->lock);
+    ring->closed = 1;
+    pthread_mutex_unlock(&ring->lock);
+
+    event_signal(ring->on_put);
+    event_signal(ring->on_release);
+}
+
+int ring_done(struct tm_ring *ring) {
+
+    int done;
+
+    pthread_mutex_lock(&ring->lock);
+    done = ring->closed && ring->count == 0;
+    pthread_mutex_unlock(&ring->lock);
+
+    return done;
+}
@@ -0,0 +1,70 @@
+/********************************************************************************
+ * MOSES telemetry downlink buffer ring
+ *
+ * Bounded single-producer/single-consumer ring of chunk descriptors shared by
+ * the reader thread and the transmit thread, so the reader can load the next
+ * chunk (and the next file) while the current one is on the wire. The chunk
+ * data itself lives in buffers checked out of the buffer pool, or in a file
+ * mapping. There is one ring per priority class.
+ *
+ ******************************************************************************/
+
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+struct tm_file;
+struct tm_event;
+struct tm_pool;
+
+/*One chunk of a file on its way to the SyncLink*/
+struct tm_chunk {
+    unsigned char *buf;         //pool buffer to return once sent, or NULL
+    struct tm_pool *pool;       //pool buf came from
+    unsigned char *data;        //start of the payload to send
+    size_t len;                 //payload length in bytes
+    int packed;                 //data holds struct tm_rice_rec records, not raw frames
+    unsigned int crc;           //if packed, file checksum through the end of this chunk
+    int selected;               //data and file_off are of the selected channels of an image
+    size_t file_off;            //file offset of data[0]
+    struct tm_file *file;       //file this chunk belongs to
+    int first;                  //nonzero on the first chunk of a file
+    unsigned int crc_start;     //if first, file checksum through file_off
+    int last;                   //nonzero on the final chunk of a file
+    void *map;                  //file mapping to release once this chunk is sent
+    size_t map_len;
+};
+
+struct tm_ring {
+    struct tm_chunk *slots;
+    int nslots;
+    int head;                   //next slot handed to the consumer
+    int tail;                   //next slot handed to the producer
+    int count;                  //slots currently holding data
+    int closed;
+    pthread_mutex_t lock;
+    struct tm_event *on_put;    //signalled when a chunk is queued or the ring closes
+    struct tm_event *on_release; //signalled when a slot frees up or the ring closes
+};
+
+int ring_init(struct tm_ring *ring, int nslots, struct tm_event *on_put,
+        struct tm_event *on_release);
+void ring_destroy(struct tm_ring *ring);
+
+/*Producer side: take an empty slot (NULL if full or closed), fill it, then commit it*/
+struct tm_chunk *ring_try_get_free(struct tm_ring *ring);
+void ring_put(struct tm_ring *ring);
+
+/*Consumer side: look at the oldest full slot (NULL if empty), send it, then hand it back*/
+struct tm_chunk *ring_peek_full(struct tm_ring *ring);
+void ring_release(struct tm_ring *ring);
+
+/*No more chunks will be queued; what is already queued can still be drained*/
+void ring_close(struct tm_ring *ring);
+
+/*Nonzero once the ring is closed and empty*/
+int ring_done(struct tm_ring *ring);
+
+#endif /* RING_H */
@@ -0,0 +1,160 @@
+/********************************************************************************
+ * MOSES telemetry downlink ROE channel selection
+ *
+ * See roe.h.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include "roe.h"
+
+#define ROW_BYTES (TM_ROE_IMAGE_BYTES / TM_ROE_HEIGHT)
+
+/*Parse first-last, or a single value, within [0, limit)*/
+static int parse_range(const char *s, char **end, int limit, int *first, int *last) {
+
+    long a, b;
+
+    a = strtol(s, end, 10);
+    b = a;
+    if (*end != s && **end == '-') {
+        s = *end + 1;
+        b = strtol(s, end, 10);
+    }
+    if (*end == s || a < 0 || b < a || b >= limit) {
+        return -1;
+    }
+
+    *first = (int) a;
+    *last = (int) b;
+    return 0;
+}
+
+int roe_parse_select(struct tm_roe_select *sel, const char *spec) {
+
+    const char *p = spec;
+    char *end;
+    int a, b, c;
+
+    memset(sel, 0, sizeof (*sel));
+    sel->row1 = TM_ROE_HEIGHT;
+    sel->col1 = TM_ROE_WIDTH;
+
+    /*Channels, e.g. 0,2-3*/
+    for (;;) {
+        if (parse_range(p, &end, TM_ROE_CHANNELS, &a, &b) < 0) {
+            goto bad;
+        }
+        for (c = a; c <= b; c++) {
+            sel->channels |= 1u << c;
+        }
+        p = end;
+        if (*p != ',') {
+            break;
+        }
+        p++;
+    }
+
+    if (*p == ':') {
+        if (parse_range(p + 1, &end, TM_ROE_HEIGHT, &a, &b) < 0) {
+            goto bad;
+        }
+        sel->row0 = a;
+        sel->row1 = b + 1;
+        p = end;
+    }
+    if (*p == ':') {
+        if (parse_range(p + 1, &end, TM_ROE_WIDTH, &a, &b) < 0) {
+            goto bad;
+        }
+        sel->col0 = a;
+        sel->col1 = b + 1;
+        p = end;
+    }
+    if (*p != '\0') {
+        goto bad;
+    }
+
+    for (c = 0; c < TM_ROE_CHANNELS; c++) {
+        if (sel->channels & (1u << c)) {
+            sel->nchannels++;
+        }
+    }
+
+    return 0;
+
+bad:
+    printf("Bad channel selection \"%s\", expected <channels>[:<rows>[:<columns>]]\n", spec);
+    return -1;
+}
+
+/*Selected bytes of one row*/
+static size_t row_len(const struct tm_roe_select *sel) {
+
+    return 2 * (size_t) sel->nchannels * (sel->col1 - sel->col0);
+}
+
+size_t roe_stream_len(const struct tm_roe_select *sel, size_t file_len) {
+
+    size_t rows = file_len / ROW_BYTES;
+
+    if (rows > (size_t) sel->row1) {
+        rows = sel->row1;
+    }
+    if (rows <= (size_t) sel->row0) {
+        return 0;
+    }
+
+    return (rows - sel->row0) * row_len(sel);
+}
+
+size_t roe_gather(const struct tm_roe_select *sel, const unsigned char *file, size_t file_len,
+        size_t off, unsigned char *out, size_t len) {
+
+    size_t total = roe_stream_len(sel, file_len);
+    size_t ncols = sel->col1 - sel->col0;
+    size_t done, s, rem, row, col, n, i;
+    const unsigned char *src;
+    int ch, k;
+
+    if (off >= total) {
+        return 0;
+    }
+    if (len > total - off) {
+        len = total - off;
+    }
+    len &= ~(size_t) 1; //Whole samples only
+
+    /*One run of a channel's columns at a time, each sample a channel stride apart*/
+    for (done = 0; done < len; done += 2 * n) {
+        s = (off + done) / 2;
+        row = sel->row0 + s / (row_len(sel) / 2);
+        rem = s % (row_len(sel) / 2);
+        col = rem % ncols;
+
+        /*rem / ncols-th selected channel*/
+        k = (int) (rem / ncols);
+        for (ch = 0; ch < TM_ROE_CHANNELS; ch++) {
+            if ((sel->channels & (1u << ch)) && k-- == 0) {
+                break;
+            }
+        }
+
+        n = ncols - col;
+        if (n > (len - done) / 2) {
+            n = (len - done) / 2;
+        }
+
+        src = file + row * ROW_BYTES + 2 * ((sel->col0 + col) * TM_ROE_CHANNELS + ch);
+        for (i = 0; i < n; i++) {
+            out[done + 2 * i] = src[0];
+            out[done + 2 * i + 1] = src[1];
+            src += 2 * TM_ROE_CHANNELS;
+        }
+    }
+
+    return done;
+}
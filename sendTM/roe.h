@@ -0,0 +1,56 @@
+/********************************************************************************
+ * MOSES telemetry downlink ROE channel selection
+ *
+ * A .roe image is what the readout electronics clocked out of the CCDs: for
+ * each of TM_ROE_HEIGHT rows and TM_ROE_WIDTH columns, one 16 bit sample
+ * from each of the TM_ROE_CHANNELS readout channels in turn, 16 MB in all.
+ * Not every channel is wanted on the ground, and the fourth in particular
+ * costs a quarter of the link time for no science.
+ *
+ * A selection names the channels to send and, optionally, a rectangle of
+ * rows and columns. The reader gathers just those samples out of a mapping
+ * of the file, so excluded pixels never reach the link and excluded rows are
+ * never read from the SD card. The frames of a selected file carry
+ * TM_HDR_SELECT, and their offsets count bytes of the selected stream rather
+ * than of the file. The stream runs row by row and, within a row, sends the
+ * columns of each selected channel in turn, lowest channel first, which also
+ * puts neighbouring pixels of one CCD next to each other for compression.
+ * The ground station needs the same selection to put the pixels back. A file
+ * too short to hold a whole image is sent as it is.
+ *
+ * Selections are written as <channels>[:<rows>[:<columns>]], where each part
+ * is a comma separated list (channels) or a range first-last (rows and
+ * columns), e.g. "0-2" or "0,1,2:256-767".
+ *
+ ******************************************************************************/
+
+#ifndef ROE_H
+#define ROE_H
+
+#include <stddef.h>
+
+/*Geometry of a MOSES readout*/
+#define TM_ROE_CHANNELS 4
+#define TM_ROE_WIDTH 2048
+#define TM_ROE_HEIGHT 1024
+#define TM_ROE_IMAGE_BYTES (2 * TM_ROE_CHANNELS * TM_ROE_WIDTH * TM_ROE_HEIGHT)
+
+struct tm_roe_select {
+    unsigned int channels;      //bit n set to send channel n
+    int nchannels;              //bits set in channels
+    int row0, row1;             //rows [row0, row1)
+    int col0, col1;             //columns [col0, col1)
+};
+
+/*Parse a selection. Returns -1 and prints why if spec is malformed*/
+int roe_parse_select(struct tm_roe_select *sel, const char *spec);
+
+/*Bytes of the selected stream of a file of file_len bytes*/
+size_t roe_stream_len(const struct tm_roe_select *sel, size_t file_len);
+
+/*Copy up to len bytes of the selected stream, starting at the even offset off, from
+ *the mapped file into out. Returns the bytes copied, short only at the end*/
+size_t roe_gather(const struct tm_roe_select *sel, const unsigned char *file, size_t file_len,
+        size_t off, unsigned char *out, size_t len);
+
+#endif /* ROE_H */
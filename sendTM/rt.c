@@ -0,0 +1,41 @@
+/********************************************************************************
+ * MOSES telemetry downlink real-time scheduling
+ *
+ * See rt.h.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <memory.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "rt.h"
+
+int rt_promote(pthread_t thread, int priority, const char *name) {
+
+    struct sched_param param;
+    int rc;
+
+    memset(&param, 0, sizeof (param));
+    param.sched_priority = priority;
+    rc = pthread_setschedparam(thread, SCHED_FIFO, &param);
+    if (rc != 0) {
+        printf("pthread_setschedparam(%s) error=%d %s, keeping normal priority\n",
+                name, rc, strerror(rc));
+        return -1;
+    }
+
+    printf("Running %s thread at SCHED_FIFO priority %d\n", name, priority);
+    return 0;
+}
+
+int rt_lock_memory(void) {
+
+    if (mlockall(MCL_CURRENT) < 0) {
+        printf("mlockall error=%d %s\n", errno, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,30 @@
+/********************************************************************************
+ * MOSES telemetry downlink real-time scheduling
+ *
+ * On the flight computer sendTM shares one ARM9 core with the camera
+ * software, and a transmit thread that is kept off the CPU for longer than
+ * the driver's queued frames last lets the link underrun. The thread that
+ * feeds the SyncLink can therefore run under SCHED_FIFO, ahead of every
+ * normal task, while the reader and compression threads stay at normal
+ * priority so disk reads and packing only ever use the time left over. The
+ * transmit thread sleeps in poll() whenever the driver is full, so it does not
+ * hold the CPU between frames.
+ *
+ * Memory locking pins every page mapped when the pipeline starts, the buffer
+ * pool, rings and frame buffers included, so the write path never waits on a
+ * page fault. File mappings made later are not pinned.
+ *
+ ******************************************************************************/
+
+#ifndef RT_H
+#define RT_H
+
+#include <pthread.h>
+
+/*Run thread under SCHED_FIFO at priority. Without the privilege it stays as it was*/
+int rt_promote(pthread_t thread, int priority, const char *name);
+
+/*Pin every page currently mapped into memory*/
+int rt_lock_memory(void);
+
+#endif /* RT_H */
@@ -0,0 +1,107 @@
+/********************************************************************************
+ * MOSES telemetry downlink priority scheduling
+ *
+ * See sched.h. The scheduling decisions themselves are made by the pipeline
+ * threads; this file holds the pieces they share.
+ *
+ ******************************************************************************/
+
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#include "sched.h"
+
+void event_init(struct tm_event *ev) {
+
+    ev->seq = 0;
+    pthread_mutex_init(&ev->lock, NULL);
+    pthread_cond_init(&ev->cond, NULL);
+}
+
+void event_destroy(struct tm_event *ev) {
+
+    pthread_mutex_destroy(&ev->lock);
+    pthread_cond_destroy(&ev->cond);
+}
+
+unsigned long event_seq(struct tm_event *ev) {
+
+    unsigned long seq;
+
+    pthread_mutex_lock(&ev->lock);
+    seq = ev->seq;
+    pthread_mutex_unlock(&ev->lock);
+
+    return seq;
+}
+
+void event_wait(struct tm_event *ev, unsigned long seq) {
+
+    pthread_mutex_lock(&ev->lock);
+    while (ev->seq == seq) {
+        pthread_cond_wait(&ev->cond, &ev->lock);
+    }
+    pthread_mutex_unlock(&ev->lock);
+}
+
+void event_timedwait(struct tm_event *ev, unsigned long seq, int ms) {
+
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline); //The condition variable's clock
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&ev->lock);
+    while (ev->seq == seq) {
+        if (pthread_cond_timedwait(&ev->cond, &ev->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ev->lock);
+}
+
+void event_signal(struct tm_event *ev) {
+
+    pthread_mutex_lock(&ev->lock);
+    ev->seq++;
+    pthread_cond_broadcast(&ev->cond);
+    pthread_mutex_unlock(&ev->lock);
+}
+
+int sched_classify(const char *name) {
+
+    const char *ext = strrchr(name, '.');
+
+    if (ext == NULL) {
+        return TM_PRIO_BULK;
+    }
+
+    /*Image index and housekeeping logs are small and wanted on the ground first*/
+    if (strcmp(ext, ".xml") == 0 || strcmp(ext, ".log") == 0 || strcmp(ext, ".hk") == 0) {
+        return TM_PRIO_HK;
+    }
+
+    if (strcmp(ext, ".roe") == 0) {
+        return TM_PRIO_SCIENCE;
+    }
+
+    return TM_PRIO_BULK;
+}
+
+int sched_file_flags(const char *name) {
+
+    const char *ext = strrchr(name, '.');
+
+    /*Detector counts compress well, the small text files are not worth the time*/
+    if (ext != NULL && strcmp(ext, ".roe") == 0) {
+        return TM_FILE_COMPRESS | TM_FILE_SELECT | TM_FILE_PREVIEW;
+    }
+
+    return 0;
+}
@@ -0,0 +1,58 @@
+/********************************************************************************
+ * MOSES telemetry downlink priority scheduling
+ *
+ * Telemetry is split into priority classes. The transmit thread picks the
+ * most urgent class with data ready at every HDLC frame boundary, so a small
+ * housekeeping or index file preempts a 16 MB image within one frame time
+ * instead of waiting for the whole image. Preemption never happens inside a
+ * frame. Within a class, files go out in the order they were queued.
+ *
+ * The idle class only gets the link when no other class has a frame ready,
+ * so backlog kept there (see filler.h) fills time the link would otherwise
+ * spend sending idle flags, and gives way within a frame to anything else.
+ *
+ ******************************************************************************/
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <pthread.h>
+
+/*Priority classes, most urgent first*/
+#define TM_PRIO_HK 0            //housekeeping and the image index
+#define TM_PRIO_SCIENCE 1       //science images
+#define TM_PRIO_BULK 2          //bulk data and retransmissions
+#define TM_PRIO_IDLE 3          //backlog, only while nothing else is ready
+#define TM_NUM_PRIO 4
+
+/*Per-file options*/
+#define TM_FILE_COMPRESS 0x01   //lossless compression, if the pipeline runs it
+#define TM_FILE_SELECT 0x02     //ROE image, send only the selected channels if set
+#define TM_FILE_PREVIEW 0x04    //ROE image, send a binned preview first if the pipeline makes them
+
+/* Event counter: a waiter samples the count, checks its conditions without
+ * holding any shared lock, and sleeps only if nothing changed since the sample.
+ * Lets one thread wait on the queue, the rings and the pool at once.
+ */
+struct tm_event {
+    unsigned long seq;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+void event_init(struct tm_event *ev);
+void event_destroy(struct tm_event *ev);
+unsigned long event_seq(struct tm_event *ev);
+void event_wait(struct tm_event *ev, unsigned long seq);
+
+/*As event_wait(), giving up after ms milliseconds*/
+void event_timedwait(struct tm_event *ev, unsigned long seq, int ms);
+void event_signal(struct tm_event *ev);
+
+/*Class for a queued file, chosen from its name*/
+int sched_classify(const char *name);
+
+/*TM_FILE_* options for a queued file, chosen from its name*/
+int sched_file_flags(const char *name);
+
+#endif /* SCHED_H */
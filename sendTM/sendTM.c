@@ -63,7 +63,11 @@
  * Testing revealed that the code was correctly sending chars, but other bytes were being replaced 
  * by random data. This problem was rectified by using the function fread() to parse the buffer in a 
  * binary fashion.
- * 
+ *
+ * Beyond the timings above, every run appends a timeline of each pipeline stage
+ * to the trace file (trace in the settings file, see trace.h). traceTM prints
+ * it and sums up which stage held back the link.
+ *
  *
  ******************************************************************************/
 
@@ -71,20 +75,21 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <memory.h>
-#include <fcntl.h>
 #include <unistd.h>
-#include <sys/ioctl.h>
-#include <linux/types.h>
-#include <termios.h>
 #include <errno.h>
-#include <sys/time.h>
-#include <sys/wait.h>
+#include <sys/stat.h>
 
 #include "synclink.h"
+#include "libsendtm.h"
+#include "watch.h"
+#include "shmring.h"
+#include "config.h"
 
-#ifndef N_HDLC
-#define N_HDLC 13
-#endif
+/*Pathname FIFO used by daemon mode when no -w or -f is given*/
+#define TM_DAEMON_FIFO "/tmp/sendTM.fifo"
+
+/*Every option, so both passes over the command line parse it the same way*/
+#define SENDTM_OPTIONS "F:o:dw:f:b:x:r:e:zp:C:c:"
 
 #ifndef BUFSIZ
 #define BUFSIZ 4096
@@ -92,29 +97,75 @@
 
 /*Function to demonstrate correct command line input*/
 void display_usage(void) {
-    printf("Usage: sendTM <devname> \n"
+    printf("Usage: sendTM [-F conf] [-o key=value] [-d] [-w dir] [-f fifo] [-b dir] [-x index]\n"
+            "              [-r list] [-e k,m] [-z] [-p bin] [-C sel] [-c 16|32] <devname>\n"
             "devname = device name (optional) (e.g. /dev/ttyUSB2 etc. "
-            "Default is /dev/ttyUSB0)\n");
+            "Default is /dev/ttyUSB0)\n"
+            "-F conf = read settings from conf instead of " TM_CONFIG_FILE " (see config.h)\n"
+            "-o key=value = apply one setting as if it were a line of the file, after it\n"
+            "-d      = run in the background, keeping the link configured until SIGTERM "
+            "(pathnames are read from " TM_DAEMON_FIFO " unless -w or -f is given)\n"
+            "-w dir  = send each file as soon as it is written into dir\n"
+            "-f fifo = send each pathname written (one per line) to fifo, or change the bit rate "
+            "on a line \"!rate <bps>\"\n"
+            "-b dir  = send the files in dir, oldest first, whenever nothing else is queued\n"
+            "-x index = record every frame sent in index (default " TM_INDEX_FILE ")\n"
+            "-r list = send again only the frames in list, as uplinked by the ground station, "
+            "then exit\n"
+            "-e k,m  = follow every k data frames of a file with m FEC parity frames, so the "
+            "ground can rebuild up to m lost frames per group\n"
+            "-z      = compress .roe images losslessly before they go down the link\n"
+            "-p bin  = send a preview of each .roe image, binned bin x bin (2, 4, 8 or 16), "
+            "ahead of the image\n"
+            "-C sel  = send only the selected readout channels of .roe images, as "
+            "<channels>[:<rows>[:<columns>]], e.g. 0-2 (also needed with -r for such frames)\n"
+            "-c 16|32 = HDLC frame check sequence, CRC-16 (default) or CRC-32 CCITT\n"
+            "Options are applied in order over the settings file\n"
+            "Without -d, -w, -f or file settings the built-in test image queue is sent\n");
+}
+
+/*Queue a file named in the settings, to be sent whole*/
+static int push_file(struct tm_sender *s, const char *name) {
+
+    struct stat st;
+
+    if (stat(name, &st) < 0) {
+        printf("stat(%s) error=%d %s\n", name, errno, strerror(errno));
+        return -1;
+    }
+    return (sendtm_enqueue_file(s, name, -1, NULL, NULL) != 0) ? 0 : -1;
+}
+
+/*A command written to the FIFO, see watch.h. Only "rate <bps>" for now*/
+static int run_command(const char *cmd, void *arg) {
+
+    unsigned long bps;
+    char end;
+
+    if (sscanf(cmd, "rate %lu %c", &bps, &end) == 1 && bps > 0) {
+        printf("Changing to %lu bps\n", bps);
+        sendtm_set_rate(arg, bps);
+        return 0;
+    }
+    return -1;
 }
 
 /*Program entry point*/
-int main() {
+int main(int argc, char **argv) {
 
-    int fd, rc;
+    int rc;
     int j;
-    int sigs;
-    int idle;
-    int ldisc = N_HDLC;
-    FILE *image_fp = NULL;
-    MGSL_PARAMS params;
-    unsigned int * databuf;
-    int totalSize = 0;
-    int sz;
-    unsigned char endbuf[] = "smart"; //Used this string as end-frame to terminate seperate files
-    char *devname;
+    int prio;
     char *imagename;
-    int time_elapsed;
-    struct timeval time_begin, time_end;
+    char *confname = TM_CONFIG_FILE;
+    int confrequired = 0;
+    char *resendlist = NULL;
+    int watching;
+    struct tm_shm_intake shm;
+    int opt;
+    struct tm_config cfg;
+    struct tm_watch watch;
+    struct tm_sender sender;
 
     char* xmlfile = "/home/moses/roysmart/images/imageindex.xml";
     char* image0 = "/home/moses/roysmart/images/080206120404.roe";
@@ -129,233 +180,197 @@ int main() {
     char* images[] = {image0, image1, image2, image3, image4, image5, image6};
     int imageAmount = 14;
 
-
-
-    /*Check for correct arguments*/
-    //if (argc > 2 || argc < 1) {
-    //printf("Incorrect number of arguments\n");
-    //display_usage();
-    //return 1;
-    //}
-
-    /*Set device name, either from command line or use default value*/
-    //if (argc == 3)
-    //devname = argv[1];
-    //else
-    devname = "/dev/ttyUSB0"; //Set the default name of the SyncLink device
-
-    /* Fork and exec the fsynth program to set the clock source on the SyncLink
-     * to use the synthesized 20 MHz clock from the onboard frequency synthesizer
-     * chip, for accurate generation of a 10 Mbps datastream. fsynth needs to be
-     * in the PATH. 
-     */
-
-    pid_t pid = fork();
-    printf("forking process\n");
-    if (pid == -1) {
-        perror("Fork failure");
-        exit(EXIT_FAILURE);
+    /*The settings file goes under every other option, so find it first*/
+    while ((opt = getopt(argc, argv, SENDTM_OPTIONS)) != -1) {
+        if (opt == 'F') {
+            confname = optarg;
+            confrequired = 1;
+        } else if (opt == '?') {
+            display_usage();
+            return 1;
+        }
     }
 
-    if (pid == 0) {
-        execlp("fsynth", "fsynth", devname, (char *) NULL); //fsynth was compiled with 20MHz
-        perror("execlp"); //selected in code
-        _exit(EXIT_FAILURE); //Child should die after exec call. If it gets
-        //here then the exec failed
-    } else if (pid > 0) {
-        wait(0); //Wait for child to finish
+    config_defaults(&cfg);
+    if (config_load(&cfg, confname, confrequired) < 0) {
+        return 1;
     }
 
-    printf("send HDLC data on %s\n", devname);
-
-    /* open serial device with O_NONBLOCK to ignore DCD input */
-    fd = open(devname, O_RDWR | O_NONBLOCK, 0);
-    if (fd < 0) {
-        printf("open error=%d %s\n", errno, strerror(errno));
-        return fd;
-    } else printf("device opened on %s\n", devname);
-
-    /*
-     * set N_HDLC line discipline						//Change this to N_TTY?
-     *
-     * A line discipline is a software layer between a tty device driver
-     * and user application that performs intermediate processing,
-     * formatting, and buffering of data.
-     */
-    rc = ioctl(fd, TIOCSETD, &ldisc);
-    if (rc < 0) {
-        printf("set  2line discipline error=%d %s\n",
-                errno, strerror(errno));
-        return rc;
+    /*Check for correct arguments*/
+    optind = 1;
+    while ((opt = getopt(argc, argv, SENDTM_OPTIONS)) != -1) {
+        switch (opt) {
+            case 'F':
+                rc = 0;
+                break;
+            case 'o':
+                rc = config_set_option(&cfg, optarg);
+                break;
+            case 'd':
+                rc = config_set(&cfg, "daemon", "on");
+                break;
+            case 'w':
+                rc = config_set(&cfg, "watch", optarg);
+                break;
+            case 'f':
+                rc = config_set(&cfg, "fifo", optarg);
+                break;
+            case 'b':
+                rc = config_set(&cfg, "filler", optarg);
+                break;
+            case 'x':
+                rc = config_set(&cfg, "index", optarg);
+                break;
+            case 'r':
+                resendlist = optarg;
+                rc = 0;
+                break;
+            case 'e':
+                rc = config_set(&cfg, "fec", optarg);
+                break;
+            case 'z':
+                rc = config_set(&cfg, "compress", "on");
+                break;
+            case 'p':
+                rc = config_set(&cfg, "preview", optarg);
+                break;
+            case 'C':
+                rc = config_set(&cfg, "select", optarg);
+                break;
+            case 'c':
+                rc = config_set(&cfg, "crc", optarg);
+                break;
+            default:
+                rc = -1;
+                break;
+        }
+        if (rc < 0) {
+            display_usage();
+            return 1;
+        }
     }
-
-    /* get current device parameters */
-    rc = ioctl(fd, MGSL_IOCGPARAMS, &params);
-    if (rc < 0) {
-        printf("ioctl(MGSL_IOCGPARAMS) error=%d %s\n",
-                errno, strerror(errno));
-        return rc;
+    if (resendlist != NULL && (cfg.daemonize || cfg.watch_dir != NULL || cfg.fifo != NULL
+            || cfg.shm != NULL || cfg.filler != NULL)) {
+        printf("-r cannot be combined with -d, -w, -f, -b or shm\n");
+        display_usage();
+        return 1;
     }
-
-    /*
-     * modify device parameters
-     *
-     * HDLC/SDLC mode, loopback disabled (external loopback connector), NRZIs encoding
-     * Data transmit clock sourced from BRG
-     * Output 10000000bps clock on auxclk output
-     * No hardware CRC
-     */
-
-    params.mode = MGSL_MODE_HDLC;                       //N_TTY?
-    params.loopback = 0;
-    params.flags = HDLC_FLAG_RXC_RXCPIN + HDLC_FLAG_TXC_BRG;
-    params.encoding = HDLC_ENCODING_NRZ;
-    params.clock_speed = 10000000;
-    params.crc_type = HDLC_CRC_16_CCITT;
-    params.preamble = HDLC_PREAMBLE_PATTERN_ONES;               //Remove?
-    params.preamble_length = HDLC_PREAMBLE_LENGTH_16BITS;
-
-    /* set current device parameters */
-    rc = ioctl(fd, MGSL_IOCSPARAMS, &params);
-    if (rc < 0) {
-        printf("ioctl(MGSL_IOCSPARAMS) error=%d %s\n",
-                errno, strerror(errno));
-        return rc;
+    if (argc - optind > 1) {
+        printf("Incorrect number of arguments\n");
+        display_usage();
+        return 1;
     }
 
-    /* set transmit idle pattern (sent between frames) */
-    idle = HDLC_TXIDLE_FLAGS; //Change? consult email stream
-    rc = ioctl(fd, MGSL_IOCSTXIDLE, idle);
-    if (rc < 0) {
-        printf("ioctl(MGSL_IOCSTXIDLE) error=%d %s\n",
-                errno, strerror(errno));
-        return rc;
+    /*Set device name, either from command line or the settings (default /dev/ttyUSB0)*/
+    if (optind < argc && config_set(&cfg, "device", argv[optind]) < 0) {
+        return 1;
     }
-
-
-
-    /* set device to blocking mode for reads and writes */
-    //int blk = fcntl(fd, F_GETFL);
-    //blk = (blk | O_NONBLOCK);
-    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
-
-    printf("Turn on RTS and DTR serial outputs\n\n");
-    sigs = TIOCM_RTS + TIOCM_DTR;
-    rc = ioctl(fd, TIOCMBIS, &sigs);
-    if (rc < 0) {
-        printf("assert DTR/RTS error=%d %s\n",
-                errno, strerror(errno));
-        return rc;
+    if (cfg.flow_min > cfg.flow_max) {
+        printf("flow_min %d is above flow_max %d\n", cfg.flow_min, cfg.flow_max);
+        return 1;
     }
+    config_print(&cfg);
 
-    /*enable transmitter*/
-    int enable = 1;
-    rc = ioctl(fd, MGSL_IOCTXENABLE, enable);
-
-    /* Write imagefile to TM. This requires reading the entire image in chunks of 4096 bytes
-     * from the file into the data buffer, then sending the each chunk to the device 
-     * via a write call.
+    /* Detach before any thread is started. stdout is kept so the log can be
+     * redirected to a file by whatever starts the daemon.
      */
-
-    for (j = 0; j < imageAmount; j++) {
-        totalSize = 0;
-
-        if (j % 2 == 0) { //If we are on an odd loop send an image
-            sz = 16777200 / 4;
-            //            itr = 4096 / 2;
-            imagename = images[j / 2];
-
-        } else {
-            sz = 28165 / 4;
-            //            itr = 8 / 2;
-            imagename = xmlfile; //otherwise send an xml file
-        }
-
-        databuf = malloc(sz*4);
-
-        /*Open image file for reading into a buffered stream*/
-        image_fp = fopen(imagename, "r+");
-        if (image_fp == NULL) {
-            printf("fopen(%s) error=%d %s\n", imagename, errno, strerror(errno));
+    if (cfg.daemonize) {
+        if (cfg.watch_dir == NULL && cfg.fifo == NULL && cfg.shm == NULL
+                && config_set(&cfg, "fifo", TM_DAEMON_FIFO) < 0) {
             return 1;
         }
-
-        printf("New file: %s of size: %d Bytes\n", imagename, (int) sz);
-
-        rc = fread(databuf, sizeof (int), sz, image_fp);
-        
-        if (rc < 0) {
-            printf("Error reading in simulated image...\n");
-            return rc; //Finishes the write error handling after the break
+        if (daemon(1, 1) < 0) {
+            printf("daemon error=%d %s\n", errno, strerror(errno));
+            return 1;
         }
+        setvbuf(stdout, NULL, _IOLBF, 0);
+    }
 
+    /* Fill the downlink queue. With a watched directory, a FIFO or a shared memory
+     * ring, files are queued at runtime as the camera writer finishes them, until
+     * SIGINT or SIGTERM. The intake thread has to start before any other thread.
+     */
+    sendtm_init(&sender, &cfg);
+    if (resendlist != NULL && sender.indexed == NULL) {
+        printf("-r needs the frame index\n");
+        return 1;
+    }
 
-        printf("image: %s read into memory\n", imagename);
-        printf("Sending data from memory...\n");
+    watching = (cfg.watch_dir != NULL || cfg.fifo != NULL || cfg.shm != NULL);
+    if (resendlist != NULL) {
+        queue_close(&sender.queue); //Frames come straight from the index
+    } else if (watching) {
+        sendtm_resume(&sender); //Files the last run was part way through go first
 
-        gettimeofday(&time_begin, NULL); //Determine elapsed time for file write to TM
-        
-        rc = write(fd, databuf, sz * 4);
+        rc = watch_start(&watch, &sender.queue, cfg.watch_dir, cfg.fifo, run_command,
+                &sender);
         if (rc < 0) {
-            printf("write error handling...\n");
-            return rc; //Finishes the write error handling after the break
+            return rc;
         }
 
-        /*flush library buffer*/
-        rc = tcdrain(fd);
-        if (rc < 0) {
-            printf("write error handling...\n");
-            return rc; //Finishes the write error handling after the break
+        /*Images straight from the acquisition process, not read back off the SD card*/
+        if (cfg.shm != NULL) {
+            rc = shm_intake_start(&shm, &sender.queue, cfg.shm, cfg.shm_slots,
+                    cfg.shm_slot_size, cfg.archive_dir);
+            if (rc < 0) {
+                return rc;
+            }
         }
-
-        fclose(image_fp);
-        
-        /*write terminating characters*/
-        rc = write(fd, endbuf, 5);
-        if (rc < 0) {
-            printf("write error=%d %s\n", errno, strerror(errno));
-            break;
+    } else if (cfg.nfiles > 0) {
+        for (j = 0; j < cfg.nfiles; j++) {
+            if (push_file(&sender, cfg.files[j]) < 0) {
+                printf("Unable to queue %s\n", cfg.files[j]);
+            }
         }
+        queue_close(&sender.queue); //Batch from the settings
+    } else {
+        for (j = 0; j < imageAmount; j++) {
 
-        /*block until all data sent*/
-        rc = tcdrain(fd);
-        if (rc < 0) {
-            printf("endbuf write error=%d %s\n", errno, strerror(errno));
-            break;
-        }
+            if (j % 2 == 0) { //If we are on an odd loop send an image
+                imagename = images[j / 2];
+                prio = TM_PRIO_SCIENCE;
 
-        gettimeofday(&time_end, NULL); //Timing
-        printf("all data sent\n");
-        printf("Sent %d bytes of data from file %s.\n", totalSize, imagename);
-        time_elapsed = 1000000 * ((long) (time_end.tv_sec) - (long) (time_begin.tv_sec))
-                + (long) (time_end.tv_usec) - (long) (time_begin.tv_usec);
-        printf("Time elapsed: %-3.2f seconds.\n\n", (float) time_elapsed / (float) 1000000);
+            } else {
+                imagename = xmlfile; //otherwise send an xml file
+                prio = TM_PRIO_HK; //the index goes ahead of any image still in progress
+            }
 
+            /*Every byte of the file, however long fstat() finds it when it is opened*/
+            sendtm_enqueue_file(&sender, imagename, prio, NULL, NULL);
+        }
+        queue_close(&sender.queue); //Fixed batch
     }
-    /*
-     * keep auxclk clock output active for 2 seconds to give remote receiver
-     * clock cycles for internal processing of received data.
-     * If an external device supplies data clocks, this is not needed.
-     */
-    sleep(2);
 
-    /* Check last entries in databuf to get an idea of the data sent from the image
-     * file.
+    /* Configure every port and allocate the buffers. In daemon mode the SyncLink
+     * then stays configured, with the transmitter enabled, for as long as payloads
+     * keep arriving.
      */
-
-    //    printf("Bytes from the 10th write printed (as ASCII characters): %s\n", temp);
-
-    printf("Turn off RTS and DTR\n");
-    sigs = TIOCM_RTS + TIOCM_DTR;
-    rc = ioctl(fd, TIOCMBIC, &sigs);
-    if (rc < 0) {
-        printf("negate DTR/RTS error=%d %s\n", errno, strerror(errno));
+    rc = sendtm_open(&sender, watching);
+    if (rc == 0 && resendlist != NULL) {
+        rc = sendtm_resend(&sender, resendlist);
+    } else if (rc == 0) {
+        rc = sendtm_start(&sender);
+        if (rc == 0) {
+            rc = sendtm_wait(&sender); //Until the batch is sent or the intake closes the queue
+        }
+    }
+    if (cfg.shm != NULL && resendlist == NULL) {
+        shm_intake_stop(&shm);
+    }
+    if (watching) {
+        watch_stop(&watch);
+    }
+    if (sendtm_close(&sender) < 0 && rc == 0) {
+        rc = -1;
+    }
+    if (cfg.shm != NULL && resendlist == NULL) {
+        shm_intake_destroy(&shm); //After the queue, which may still hold its slots
+    }
+    config_destroy(&cfg);
+    if (rc != 0) {
+        printf("Downlink stopped early\n");
         return rc;
     }
 
-    /* Close the device and the image file*/
-    close(fd);
-    //close(fp);
-
     return 0;
 }
@@ -0,0 +1,424 @@
+/********************************************************************************
+ * MOSES telemetry downlink shared-memory intake
+ *
+ * See shmring.h.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmring.h"
+#include "sched.h"
+
+/*Take the ring lock, taking over from a process that died holding it*/
+static void ring_lock(struct tm_shm_header *h) {
+
+    if (pthread_mutex_lock(&h->lock) == EOWNERDEAD) {
+        pthread_mutex_consistent(&h->lock);
+    }
+}
+
+static void ring_wait(struct tm_shm_header *h) {
+
+    if (pthread_cond_wait(&h->changed, &h->lock) == EOWNERDEAD) {
+        pthread_mutex_consistent(&h->lock);
+    }
+}
+
+static int ring_map(struct tm_shm_ring *r, const char *name, int fd, size_t len, int owner) {
+
+    r->hdr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); //The mapping keeps the object open
+    if (r->hdr == MAP_FAILED) {
+        printf("mmap(%s) error=%d %s\n", name, errno, strerror(errno));
+        r->hdr = NULL;
+        return -1;
+    }
+    r->name = strdup(name);
+    r->len = len;
+    r->owner = owner;
+    return 0;
+}
+
+int shmring_create(struct tm_shm_ring *r, const char *name, int nslots, size_t slot_size) {
+
+    struct tm_shm_header *h;
+    pthread_mutexattr_t ma;
+    pthread_condattr_t ca;
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t data_off, len;
+    int fd;
+
+    memset(r, 0, sizeof (*r));
+    if (nslots < 1 || nslots > TM_SHM_MAX_SLOTS || slot_size == 0 || slot_size > INT_MAX) {
+        printf("Cannot make a ring of %d slots of %lu Bytes\n", nslots, (unsigned long) slot_size);
+        return -1;
+    }
+
+    /*Slots start on a page, so a producer can read() straight into one*/
+    data_off = (sizeof (*h) + page - 1) & ~(page - 1);
+    slot_size = (slot_size + page - 1) & ~(page - 1);
+    len = data_off + nslots * slot_size;
+
+    /*Left behind by a run that did not exit cleanly, producers reattach to the new one*/
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0660);
+    if (fd < 0) {
+        printf("shm_open(%s) error=%d %s\n", name, errno, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, len) < 0) {
+        printf("ftruncate(%s) error=%d %s\n", name, errno, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    if (ring_map(r, name, fd, len, 1) < 0) {
+        shm_unlink(name);
+        return -1;
+    }
+
+    h = r->hdr;
+    h->nslots = nslots;
+    h->slot_size = slot_size;
+    h->data_off = data_off;
+
+    pthread_mutexattr_init(&ma);
+    pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&h->lock, &ma);
+    pthread_mutexattr_destroy(&ma);
+
+    pthread_condattr_init(&ca);
+    pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&h->changed, &ca);
+    pthread_condattr_destroy(&ca);
+
+    __sync_synchronize(); //Everything above is visible before the magic
+    h->magic = TM_SHM_MAGIC;
+
+    printf("Shared memory ring %s: %d slots of %lu Bytes\n", name, nslots,
+            (unsigned long) slot_size);
+    return 0;
+}
+
+int shmring_attach(struct tm_shm_ring *r, const char *name) {
+
+    struct stat st;
+    int fd;
+
+    memset(r, 0, sizeof (*r));
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        printf("shm_open(%s) error=%d %s\n", name, errno, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof (struct tm_shm_header)) {
+        printf("%s is not a downlink ring\n", name);
+        close(fd);
+        return -1;
+    }
+    if (ring_map(r, name, fd, st.st_size, 0) < 0) {
+        return -1;
+    }
+    if (r->hdr->magic != TM_SHM_MAGIC) {
+        printf("%s is not a downlink ring\n", name);
+        shmring_detach(r);
+        return -1;
+    }
+    return 0;
+}
+
+void shmring_detach(struct tm_shm_ring *r) {
+
+    if (r->hdr != NULL) {
+        if (r->owner) {
+            pthread_cond_destroy(&r->hdr->changed);
+            pthread_mutex_destroy(&r->hdr->lock);
+        }
+        munmap(r->hdr, r->len);
+        r->hdr = NULL;
+    }
+    if (r->owner && r->name != NULL) {
+        shm_unlink(r->name);
+    }
+    free(r->name);
+    r->name = NULL;
+}
+
+unsigned char *shmring_data(const struct tm_shm_ring *r, int n) {
+
+    return (unsigned char *) r->hdr + r->hdr->data_off + n * r->hdr->slot_size;
+}
+
+int shmring_acquire(struct tm_shm_ring *r) {
+
+    struct tm_shm_header *h = r->hdr;
+    int n;
+
+    ring_lock(h);
+    for (;;) {
+        if (h->closed) {
+            pthread_mutex_unlock(&h->lock);
+            return -1;
+        }
+        for (n = 0; n < h->nslots; n++) {
+            if (h->slot[n].state == TM_SHM_FREE) {
+                h->slot[n].state = TM_SHM_FILLING;
+                pthread_mutex_unlock(&h->lock);
+                return n;
+            }
+        }
+        ring_wait(h);
+    }
+}
+
+int shmring_publish(struct tm_shm_ring *r, int n, const char *name, size_t len) {
+
+    struct tm_shm_header *h = r->hdr;
+    struct tm_shm_slot *s = &h->slot[n];
+
+    if (len > h->slot_size || strlen(name) >= TM_SHM_NAME_MAX) {
+        printf("%s does not fit a %lu Byte slot\n", name, (unsigned long) h->slot_size);
+        return -1;
+    }
+
+    ring_lock(h);
+    strcpy(s->name, name);
+    s->len = len;
+    s->seq = h->next_seq++;
+    s->state = TM_SHM_READY;
+    pthread_cond_broadcast(&h->changed);
+    pthread_mutex_unlock(&h->lock);
+
+    return 0;
+}
+
+void shmring_cancel(struct tm_shm_ring *r, int n) {
+
+    ring_lock(r->hdr);
+    r->hdr->slot[n].state = TM_SHM_FREE;
+    pthread_cond_broadcast(&r->hdr->changed);
+    pthread_mutex_unlock(&r->hdr->lock);
+}
+
+/*One consumer is done with a busy slot*/
+static void slot_release(struct tm_shm_intake *in, int n) {
+
+    struct tm_shm_header *h = in->ring.hdr;
+
+    ring_lock(h);
+    if (--h->slot[n].users == 0) {
+        h->slot[n].state = TM_SHM_FREE;
+        pthread_cond_broadcast(&h->changed);
+    }
+    pthread_mutex_unlock(&h->lock);
+}
+
+/*Queue callback: the downlink is done with the slot, sent or not*/
+static void slot_sent(const struct tm_file *file, int status, void *arg) {
+
+    struct tm_shm_ref *ref = arg;
+
+    (void) file;
+    (void) status;
+    slot_release(ref->intake, ref->slot);
+}
+
+/*Oldest published slot, or -1. Caller holds the lock*/
+static int oldest_ready(const struct tm_shm_header *h) {
+
+    int n, best = -1;
+
+    for (n = 0; n < h->nslots; n++) {
+        if (h->slot[n].state == TM_SHM_READY
+                && (best < 0 || (long) (h->slot[n].seq - h->slot[best].seq) < 0)) {
+            best = n;
+        }
+    }
+    return best;
+}
+
+static void *intake_thread(void *arg) {
+
+    struct tm_shm_intake *in = arg;
+    struct tm_shm_header *h = in->ring.hdr;
+    struct tm_shm_slot *s;
+    char name[TM_SHM_NAME_MAX];
+    size_t len;
+    int n;
+
+    ring_lock(h);
+    for (;;) {
+        while ((n = oldest_ready(h)) < 0 && !h->closed) {
+            ring_wait(h);
+        }
+        if (h->closed) {
+            break; //Anything still published is counted as lost by shm_intake_stop()
+        }
+
+        /*From here the slot's data stays put until every consumer has released it*/
+        s = &h->slot[n];
+        s->state = TM_SHM_BUSY;
+        s->users = 1;
+        if (in->archive_dir != NULL) {
+            s->users++;
+            s->archive = 1;
+            pthread_cond_broadcast(&h->changed);
+        }
+        memcpy(name, s->name, sizeof (name));
+        len = s->len;
+        pthread_mutex_unlock(&h->lock);
+
+        if (queue_push_async(in->queue, name, shmring_data(&in->ring, n), (int) len,
+                sched_classify(name), sched_file_flags(name), slot_sent, &in->ref[n]) == 0) {
+            printf("Unable to queue %s from shared memory\n", name);
+            slot_release(in, n);
+        }
+        ring_lock(h);
+    }
+    pthread_mutex_unlock(&h->lock);
+
+    return NULL;
+}
+
+/*Write one slot out as a file in the archive directory*/
+static void archive_slot(struct tm_shm_intake *in, int n, const char *name, size_t len) {
+
+    const unsigned char *data = shmring_data(&in->ring, n);
+    const char *base = strrchr(name, '/');
+    char path[PATH_MAX];
+    FILE *fp;
+
+    snprintf(path, sizeof (path), "%s/%s", in->archive_dir, base != NULL ? base + 1 : name);
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        printf("fopen(%s) error=%d %s\n", path, errno, strerror(errno));
+        return;
+    }
+    if (fwrite(data, 1, len, fp) != len) {
+        printf("Error archiving %s\n", path);
+    }
+    if (fclose(fp) != 0) {
+        printf("fclose(%s) error=%d %s\n", path, errno, strerror(errno));
+    }
+}
+
+/*Archiver thread: copy every busy slot to the SD card alongside the downlink*/
+static void *archive_thread(void *arg) {
+
+    struct tm_shm_intake *in = arg;
+    struct tm_shm_header *h = in->ring.hdr;
+    char name[TM_SHM_NAME_MAX];
+    size_t len;
+    int n;
+
+    ring_lock(h);
+    for (;;) {
+        for (n = 0; n < h->nslots && !h->slot[n].archive; n++) {
+        }
+        if (n == h->nslots) {
+            if (h->closed) {
+                break; //Finishes what was taken before stopping
+            }
+            ring_wait(h);
+            continue;
+        }
+
+        memcpy(name, h->slot[n].name, sizeof (name));
+        len = h->slot[n].len;
+        pthread_mutex_unlock(&h->lock);
+
+        archive_slot(in, n, name, len);
+
+        ring_lock(h);
+        h->slot[n].archive = 0;
+        pthread_mutex_unlock(&h->lock);
+        slot_release(in, n);
+        ring_lock(h);
+    }
+    pthread_mutex_unlock(&h->lock);
+
+    return NULL;
+}
+
+int shm_intake_start(struct tm_shm_intake *in, struct tm_queue *q, const char *name,
+        int nslots, size_t slot_size, const char *archive_dir) {
+
+    int n, rc;
+
+    memset(in, 0, sizeof (*in));
+    in->queue = q;
+    for (n = 0; n < TM_SHM_MAX_SLOTS; n++) {
+        in->ref[n].intake = in;
+        in->ref[n].slot = n;
+    }
+    if (archive_dir != NULL) {
+        in->archive_dir = strdup(archive_dir);
+    }
+
+    if (shmring_create(&in->ring, name, nslots, slot_size) < 0) {
+        free(in->archive_dir);
+        return -1;
+    }
+
+    rc = pthread_create(&in->thread, NULL, intake_thread, in);
+    if (rc != 0) {
+        printf("pthread_create(shm intake) error=%d %s\n", rc, strerror(rc));
+        shmring_detach(&in->ring);
+        free(in->archive_dir);
+        return -1;
+    }
+
+    if (in->archive_dir != NULL) {
+        rc = pthread_create(&in->archiver, NULL, archive_thread, in);
+        if (rc != 0) {
+            printf("pthread_create(archiver) error=%d %s\n", rc, strerror(rc));
+            free(in->archive_dir);
+            in->archive_dir = NULL;
+            shm_intake_stop(in);
+            shm_intake_destroy(in);
+            return -1;
+        }
+        printf("Archiving shared memory images to %s\n", in->archive_dir);
+    }
+
+    return 0;
+}
+
+void shm_intake_stop(struct tm_shm_intake *in) {
+
+    struct tm_shm_header *h = in->ring.hdr;
+    int n, lost = 0;
+
+    ring_lock(h);
+    h->closed = 1;
+    pthread_cond_broadcast(&h->changed);
+    pthread_mutex_unlock(&h->lock);
+
+    pthread_join(in->thread, NULL);
+    if (in->archive_dir != NULL) {
+        pthread_join(in->archiver, NULL);
+    }
+
+    for (n = 0; n < h->nslots; n++) {
+        lost += (h->slot[n].state == TM_SHM_READY);
+    }
+    if (lost > 0) {
+        printf("%d images in shared memory were never queued\n", lost);
+    }
+}
+
+void shm_intake_destroy(struct tm_shm_intake *in) {
+
+    shmring_detach(&in->ring);
+    free(in->archive_dir);
+}
@@ -0,0 +1,124 @@
+/********************************************************************************
+ * MOSES telemetry downlink shared-memory intake
+ *
+ * A POSIX shared memory ring the acquisition process writes images straight
+ * into, so they reach the link without a round trip through the SD card.
+ * sendTM creates the ring, the acquisition process attaches to it, takes a
+ * free slot with shmring_acquire(), reads the image out into it and hands it
+ * over with shmring_publish(). The intake thread queues each published slot
+ * as an in-memory file, framed in place from the shared mapping, and the slot
+ * comes free again once its last frame is on the wire.
+ *
+ * Archiving to the SD card is an optional second consumer: with an archive
+ * directory set, an archiver thread writes every slot out to it while the
+ * downlink sends it, and the slot is only freed once both are done.
+ *
+ * The lock and condition variable live in the ring itself, shared between the
+ * processes. The lock is robust, so a producer dying while holding it does
+ * not stall sendTM.
+ *
+ ******************************************************************************/
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "queue.h"
+
+/*Identifies an initialised ring, written last by shmring_create()*/
+#define TM_SHM_MAGIC 0x4d534852
+
+/*Default ring: two whole ROE images, one filling while the other goes down*/
+#define TM_SHM_SLOTS 2
+#define TM_SHM_MAX_SLOTS 16
+
+/*Longest file name a producer can give a slot, with its terminator*/
+#define TM_SHM_NAME_MAX 128
+
+/*Slot states*/
+#define TM_SHM_FREE 0           //can be taken by a producer
+#define TM_SHM_FILLING 1        //a producer is writing it
+#define TM_SHM_READY 2          //published, waiting for the intake thread
+#define TM_SHM_BUSY 3           //being sent and, if archiving, archived
+
+struct tm_shm_slot {
+    int state;                  //TM_SHM_*
+    int users;                  //consumers still reading a TM_SHM_BUSY slot
+    int archive;                //waiting for the archiver
+    unsigned long seq;          //publication order
+    size_t len;                 //bytes published
+    char name[TM_SHM_NAME_MAX]; //file name it is queued and archived under
+};
+
+/*Start of the shared mapping. The slots' data follows at data_off*/
+struct tm_shm_header {
+    unsigned int magic;
+    int nslots;
+    size_t slot_size;
+    size_t data_off;
+    int closed;                 //sendTM is shutting down, producers get no more slots
+    unsigned long next_seq;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     //any slot changed state, or closed
+    struct tm_shm_slot slot[TM_SHM_MAX_SLOTS];
+};
+
+struct tm_shm_ring {
+    char *name;
+    int owner;                  //created it, so unlinks it on detach
+    struct tm_shm_header *hdr;
+    size_t len;                 //of the whole mapping
+};
+
+/*Completion callback argument of a queued slot*/
+struct tm_shm_ref {
+    struct tm_shm_intake *intake;
+    int slot;
+};
+
+struct tm_shm_intake {
+    struct tm_shm_ring ring;
+    struct tm_queue *queue;
+    char *archive_dir;          //NULL when not archiving
+    struct tm_shm_ref ref[TM_SHM_MAX_SLOTS];
+    pthread_t thread;
+    pthread_t archiver;
+};
+
+/*Create (or re-create) the ring called name, of nslots slots of slot_size bytes each*/
+int shmring_create(struct tm_shm_ring *r, const char *name, int nslots, size_t slot_size);
+
+/*Attach to a ring sendTM has created, from the acquisition process*/
+int shmring_attach(struct tm_shm_ring *r, const char *name);
+
+/*Unmap the ring, and remove it if this process created it*/
+void shmring_detach(struct tm_shm_ring *r);
+
+/*Data of slot n*/
+unsigned char *shmring_data(const struct tm_shm_ring *r, int n);
+
+/*Wait for a free slot and take it for filling. Returns its number, or -1 once closed*/
+int shmring_acquire(struct tm_shm_ring *r);
+
+/*Hand the first len bytes of a filled slot to sendTM as a file called name*/
+int shmring_publish(struct tm_shm_ring *r, int n, const char *name, size_t len);
+
+/*Give back a slot taken with shmring_acquire() without publishing it*/
+void shmring_cancel(struct tm_shm_ring *r, int n);
+
+/* Create the ring and start queueing every published slot in q, also writing
+ * it into archive_dir unless that is NULL. Must be called after watch_start()
+ * if both are used.
+ */
+int shm_intake_start(struct tm_shm_intake *in, struct tm_queue *q, const char *name,
+        int nslots, size_t slot_size, const char *archive_dir);
+
+/*Close the ring to producers, let the archiver finish and stop both threads*/
+void shm_intake_stop(struct tm_shm_intake *in);
+
+/*Remove the ring. Call once the queue it fed is destroyed, so no callback is left*/
+void shm_intake_destroy(struct tm_shm_intake *in);
+
+#endif /* SHMRING_H */
@@ -0,0 +1,251 @@
+/********************************************************************************
+ * MOSES telemetry downlink statistics
+ *
+ * See stats.h. The transmit thread takes the lock once per frame, which is
+ * noise next to a 50 ms frame time at 10 Mbps.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+
+#include "stats.h"
+
+void stats_init(struct tm_stats *st) {
+
+    memset(st, 0, sizeof (*st));
+    pthread_mutex_init(&st->lock, NULL);
+    pthread_cond_init(&st->wake, NULL);
+}
+
+void stats_destroy(struct tm_stats *st) {
+
+    free(st->fd);
+    free(st->base);
+    free(st->delta);
+    pthread_mutex_destroy(&st->lock);
+    pthread_cond_destroy(&st->wake);
+}
+
+void stats_now(struct timespec *t) {
+
+    clock_gettime(CLOCK_MONOTONIC, t);
+}
+
+long stats_usec_since(const struct timespec *t0) {
+
+    struct timespec t;
+
+    stats_now(&t);
+    return (t.tv_sec - t0->tv_sec) * 1000000L + (t.tv_nsec - t0->tv_nsec) / 1000;
+}
+
+/*Caller holds st->lock*/
+static void hist_add(struct tm_hist *h, long usec) {
+
+    int b = 0;
+
+    while (b < TM_HIST_BUCKETS - 1 && (usec >> (b + 1)) > 0) {
+        b++;
+    }
+    h->count[b]++;
+    if (usec > h->max_us) {
+        h->max_us = usec;
+    }
+}
+
+void stats_frame(struct tm_stats *st, size_t len, long usec) {
+
+    pthread_mutex_lock(&st->lock);
+    st->bytes += len;
+    st->frames++;
+    hist_add(&st->write_us, usec);
+    pthread_mutex_unlock(&st->lock);
+    trace_event(st->trace, TM_TRACE_WRITE, 0, 0, len, usec);
+}
+
+void stats_drain(struct tm_stats *st, long usec) {
+
+    pthread_mutex_lock(&st->lock);
+    hist_add(&st->drain_us, usec);
+    pthread_mutex_unlock(&st->lock);
+    trace_event(st->trace, TM_TRACE_DRAIN, 0, 0, 0, usec);
+}
+
+void stats_payload(struct tm_stats *st, size_t raw, size_t payload) {
+
+    pthread_mutex_lock(&st->lock);
+    st->raw_bytes += raw;
+    st->payload_bytes += payload;
+    pthread_mutex_unlock(&st->lock);
+}
+
+void stats_file(struct tm_stats *st, const char *name, unsigned long long bytes,
+        unsigned long long sent, long usec) {
+
+    pthread_mutex_lock(&st->lock);
+    st->files++;
+    pthread_mutex_unlock(&st->lock);
+
+    printf("FILE name=%s bytes=%llu sent=%llu ratio=%.2f usec=%ld rate_bps=%llu\n", name,
+            bytes, sent, sent > 0 ? (double) bytes / sent : 1.0, usec,
+            usec > 0 ? bytes * 8ULL * 1000000ULL / usec : 0ULL);
+}
+
+int stats_read_icount(int fd, struct mgsl_icount *icount) {
+
+    if (fd < 0 || ioctl(fd, MGSL_IOCGSTATS, icount) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void print_hist(const char *key, const struct tm_hist *h) {
+
+    int b;
+
+    printf(" %s=", key);
+    for (b = 0; b < TM_HIST_BUCKETS; b++) {
+        printf(b ? ",%lu" : "%lu", h->count[b]);
+    }
+    printf(" %s_max=%ld", key, h->max_us);
+}
+
+/*Emit one STATS line covering everything since the last one*/
+static void report(struct tm_stats *st) {
+
+    struct tm_stats snap;
+    struct mgsl_icount *icount, sum;
+    struct timespec now;
+    long usec;
+    unsigned long long rate;
+    int i, n;
+
+    stats_now(&now);
+
+    pthread_mutex_lock(&st->lock);
+    snap = *st;
+    usec = (now.tv_sec - st->last_time.tv_sec) * 1000000L
+            + (now.tv_nsec - st->last_time.tv_nsec) / 1000;
+    st->last_bytes = st->bytes;
+    st->last_time = now;
+    pthread_mutex_unlock(&st->lock);
+
+    rate = usec > 0 ? (snap.bytes - snap.last_bytes) * 8ULL * 1000000ULL / usec : 0ULL;
+
+    printf("STATS time=%ld.%03ld frames=%lu bytes=%llu files=%lu rate_bps=%llu ratio=%.2f",
+            (long) now.tv_sec, now.tv_nsec / 1000000, snap.frames, snap.bytes,
+            snap.files, rate,
+            snap.payload_bytes > 0 ? (double) snap.raw_bytes / snap.payload_bytes : 1.0);
+    print_hist("write_us", &snap.write_us);
+    print_hist("drain_us", &snap.drain_us);
+
+    /*Deltas of each port, then their sum. Only one report runs at a time*/
+    icount = snap.delta;
+    memset(&sum, 0, sizeof (sum));
+    n = snap.have_icount ? snap.nfds : 0;
+    for (i = 0; i < n; i++) {
+        if (stats_read_icount(snap.fd[i], &icount[i]) < 0) {
+            break;
+        }
+        icount[i].txok -= snap.base[i].txok;
+        icount[i].txunder -= snap.base[i].txunder;
+        icount[i].txabort -= snap.base[i].txabort;
+        icount[i].txtimeout -= snap.base[i].txtimeout;
+        sum.txok += icount[i].txok;
+        sum.txunder += icount[i].txunder;
+        sum.txabort += icount[i].txabort;
+        sum.txtimeout += icount[i].txtimeout;
+    }
+    if (n > 0 && i == n) {
+        printf(" txok=%u txunder=%u txabort=%u txtimeout=%u", sum.txok, sum.txunder,
+                sum.txabort, sum.txtimeout);
+        for (i = 0; i < n && n > 1; i++) {
+            printf(" port%d=%u/%u/%u/%u", i, icount[i].txok, icount[i].txunder,
+                    icount[i].txabort, icount[i].txtimeout);
+        }
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+static void *stats_thread(void *arg) {
+
+    struct tm_stats *st = arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&st->lock);
+    while (st->running) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += st->interval;
+        if (pthread_cond_timedwait(&st->wake, &st->lock, &deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&st->lock);
+            report(st);
+            pthread_mutex_lock(&st->lock);
+        }
+    }
+    pthread_mutex_unlock(&st->lock);
+
+    return NULL;
+}
+
+int stats_start(struct tm_stats *st, const int *fds, int nfds, int interval) {
+
+    int i, rc;
+
+    st->fd = calloc(nfds, sizeof (*st->fd));
+    st->base = calloc(nfds, sizeof (*st->base));
+    st->delta = calloc(nfds, sizeof (*st->delta));
+    if (st->fd == NULL || st->base == NULL || st->delta == NULL) {
+        printf("Unable to allocate the counters of %d ports\n", nfds);
+        return -1;
+    }
+    st->nfds = nfds;
+    st->interval = interval;
+    st->have_icount = (nfds > 0);
+    for (i = 0; i < nfds; i++) {
+        st->fd[i] = fds[i];
+        if (stats_read_icount(fds[i], &st->base[i]) < 0) {
+            st->have_icount = 0;
+        }
+    }
+    if (!st->have_icount) {
+        printf("MGSL_IOCGSTATS not available, reporting without driver counters\n");
+    }
+    stats_now(&st->last_time);
+    st->last_bytes = st->bytes;
+
+    if (interval <= 0) {
+        return 0;
+    }
+
+    st->running = 1;
+    rc = pthread_create(&st->thread, NULL, stats_thread, st);
+    if (rc != 0) {
+        printf("pthread_create(stats) error=%d %s\n", rc, strerror(rc));
+        st->running = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+void stats_stop(struct tm_stats *st) {
+
+    int was_running;
+
+    pthread_mutex_lock(&st->lock);
+    was_running = st->running;
+    st->running = 0;
+    pthread_cond_signal(&st->wake);
+    pthread_mutex_unlock(&st->lock);
+
+    if (was_running) {
+        pthread_join(st->thread, NULL);
+    }
+
+    report(st);
+}
@@ -0,0 +1,94 @@
+/********************************************************************************
+ * MOSES telemetry downlink statistics
+ *
+ * Counts bytes and frames queued to the driver, keeps log2 latency
+ * histograms of every write() and tcdrain(), and reports per-file bit rates.
+ * A reporting thread merges in the driver's own mgsl_icount counters from
+ * MGSL_IOCGSTATS and prints one machine-readable line every interval:
+ *
+ *   STATS time=<s> frames=<n> bytes=<n> files=<n> rate_bps=<n> ratio=<r>
+ *         write_us=<h0,h1,...> drain_us=<h0,h1,...>
+ *         txok=<n> txunder=<n> txabort=<n> txtimeout=<n>
+ *         port<i>=<txok>/<txunder>/<txabort>/<txtimeout> ...
+ *
+ * Histogram bucket 0 counts calls under 2 us and bucket i calls taking
+ * [2^i, 2^(i+1)) us. Driver counters are deltas since reporting started,
+ * summed over every port; with frames striped over several ports each port's
+ * own follow, so an underrunning port shows up as itself.
+ * ratio is file bytes over payload bytes sent for them, above 1 once
+ * compression is saving link time. Every completed file also produces a FILE
+ * line with its own byte counts, duration and bit rate.
+ *
+ ******************************************************************************/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <time.h>
+#include <pthread.h>
+
+#include "synclink.h"
+#include "trace.h"
+
+#define TM_HIST_BUCKETS 24      //up to ~16 s per call
+
+/*Seconds between STATS lines*/
+#define TM_STATS_INTERVAL 10
+
+struct tm_hist {
+    unsigned long count[TM_HIST_BUCKETS];
+    long max_us;
+};
+
+struct tm_stats {
+    pthread_mutex_t lock;
+    unsigned long long bytes;   //bytes queued to the driver, frame headers included
+    unsigned long frames;
+    unsigned long files;
+    unsigned long long raw_bytes; //file bytes carried by data frames
+    unsigned long long payload_bytes; //the same data as sent, after compression
+    struct tm_hist write_us;
+    struct tm_hist drain_us;
+    struct tm_trace *trace;     //every write() and tcdrain() logged to, or NULL
+
+    /*Periodic reporting*/
+    int *fd;                    //devices polled with MGSL_IOCGSTATS, one per port
+    int nfds;
+    int interval;
+    int running;
+    pthread_t thread;
+    pthread_cond_t wake;
+    int have_icount;            //zero if a device does not support MGSL_IOCGSTATS
+    struct mgsl_icount *base;   //driver counters of each port when reporting started
+    struct mgsl_icount *delta;  //since then, for the report under way
+    unsigned long long last_bytes;
+    struct timespec last_time;
+};
+
+void stats_init(struct tm_stats *st);
+void stats_destroy(struct tm_stats *st);
+
+/*Current CLOCK_MONOTONIC time, and microseconds elapsed since t0*/
+void stats_now(struct timespec *t);
+long stats_usec_since(const struct timespec *t0);
+
+/*Record one frame written to the driver, or one tcdrain()*/
+void stats_frame(struct tm_stats *st, size_t len, long usec);
+void stats_drain(struct tm_stats *st, long usec);
+
+/*Record the payload of a data frame: raw file bytes sent as payload bytes*/
+void stats_payload(struct tm_stats *st, size_t raw, size_t payload);
+
+/*Record a completed file of bytes, sent as sent payload bytes, and print its FILE line*/
+void stats_file(struct tm_stats *st, const char *name, unsigned long long bytes,
+        unsigned long long sent, long usec);
+
+/*Read the driver counters. Returns -1 if the device does not provide them*/
+int stats_read_icount(int fd, struct mgsl_icount *icount);
+
+/*Start or stop the reporting thread, polling the nfds devices at fds. stats_stop()
+ *prints a final STATS line*/
+int stats_start(struct tm_stats *st, const int *fds, int nfds, int interval);
+void stats_stop(struct tm_stats *st);
+
+#endif /* STATS_H */
@@ -0,0 +1,235 @@
+/********************************************************************************
+ * MOSES telemetry downlink striping across several SyncLink ports
+ *
+ * See stripe.h.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include "stripe.h"
+#include "rt.h"
+
+/*Write one frame, outside the lock*/
+static int port_write(struct tm_port *p, const unsigned char *frame, size_t len) {
+
+    struct timespec t0;
+
+    if (p->flow != NULL) {
+        flow_wait(p->flow);
+    }
+
+    stats_now(&t0);
+    if (link_write(p->link, p->fd, frame, len) < 0) {
+        printf("Port %d failed\n", (int) (p - p->stripe->port));
+        return -1;
+    }
+
+    if (p->flow != NULL) {
+        flow_sent(p->flow);
+    }
+    if (p->stripe->stats != NULL) {
+        stats_frame(p->stripe->stats, len, stats_usec_since(&t0));
+    }
+    return 0;
+}
+
+static void *port_thread(void *arg) {
+
+    struct tm_port *p = arg;
+    struct tm_stripe *st = p->stripe;
+    int rc;
+
+    pthread_mutex_lock(&st->lock);
+    for (;;) {
+        while (p->count == 0 && !st->stop) {
+            pthread_cond_wait(&st->wake, &st->lock);
+        }
+        if (p->count == 0) {
+            break;
+        }
+
+        /*The slot stays ours until count drops, so it can be written unlocked*/
+        pthread_mutex_unlock(&st->lock);
+        rc = st->rc == 0 ? port_write(p, p->slot[p->head], p->slot_len[p->head]) : -1;
+        pthread_mutex_lock(&st->lock);
+
+        if (rc < 0 && st->rc == 0) {
+            st->rc = -1;
+        }
+        p->head = (p->head + 1) % TM_STRIPE_SLOTS;
+        p->count--;
+        p->frames++;
+        pthread_cond_broadcast(&st->wake);
+    }
+    pthread_mutex_unlock(&st->lock);
+
+    return NULL;
+}
+
+int stripe_start(struct tm_stripe *st, int nports, const int *fds, struct tm_flow **flows,
+        struct tm_link **links, size_t max_len, struct tm_stats *stats) {
+
+    struct tm_port *p;
+    int i, j, rc;
+
+    if (nports < 1 || nports > TM_MAX_PORTS) {
+        printf("Cannot stripe over %d ports, at most %d\n", nports, TM_MAX_PORTS);
+        return -1;
+    }
+
+    memset(st, 0, sizeof (*st));
+    st->nports = nports;
+    st->stats = stats;
+    pthread_mutex_init(&st->lock, NULL);
+    pthread_cond_init(&st->wake, NULL);
+
+    for (i = 0; i < nports; i++) {
+        p = &st->port[i];
+        p->fd = fds[i];
+        p->flow = (flows != NULL) ? flows[i] : NULL;
+        p->link = (links != NULL) ? links[i] : NULL;
+        p->stripe = st;
+        for (j = 0; j < TM_STRIPE_SLOTS; j++) {
+            p->slot[j] = malloc(max_len);
+            if (p->slot[j] == NULL) {
+                printf("Unable to allocate a %d byte frame slot\n", (int) max_len);
+                goto fail;
+            }
+        }
+    }
+
+    for (i = 0; i < nports; i++) {
+        rc = pthread_create(&st->port[i].thread, NULL, port_thread, &st->port[i]);
+        if (rc != 0) {
+            printf("pthread_create(port %d) error=%d %s\n", i, rc, strerror(rc));
+            st->nports = i;
+            stripe_stop(st);
+            return -1;
+        }
+    }
+
+    printf("Striping frames over %d ports\n", nports);
+    return 0;
+
+fail:
+    for (i = 0; i < nports; i++) {
+        for (j = 0; j < TM_STRIPE_SLOTS; j++) {
+            free(st->port[i].slot[j]);
+        }
+    }
+    pthread_mutex_destroy(&st->lock);
+    pthread_cond_destroy(&st->wake);
+    return -1;
+}
+
+void stripe_set_priority(struct tm_stripe *st, int priority) {
+
+    char name[16];
+    int i;
+
+    for (i = 0; i < st->nports; i++) {
+        snprintf(name, sizeof (name), "port %d", i);
+        rt_promote(st->port[i].thread, priority, name);
+    }
+}
+
+void stripe_stop(struct tm_stripe *st) {
+
+    int i, j;
+
+    pthread_mutex_lock(&st->lock);
+    st->stop = 1;
+    pthread_cond_broadcast(&st->wake);
+    pthread_mutex_unlock(&st->lock);
+
+    for (i = 0; i < st->nports; i++) {
+        pthread_join(st->port[i].thread, NULL);
+        printf("Port %d sent %lu frames\n", i, st->port[i].frames);
+    }
+    for (i = 0; i < TM_MAX_PORTS; i++) {
+        for (j = 0; j < TM_STRIPE_SLOTS; j++) {
+            free(st->port[i].slot[j]);
+        }
+    }
+    pthread_mutex_destroy(&st->lock);
+    pthread_cond_destroy(&st->wake);
+}
+
+/*Port with a free slot and the fewest frames waiting, or NULL. Caller holds st->lock*/
+static struct tm_port *pick_port(struct tm_stripe *st) {
+
+    struct tm_port *best = NULL, *p;
+    int i;
+
+    for (i = 0; i < st->nports; i++) {
+        p = &st->port[(st->next + i) % st->nports];
+        if (p->count < TM_STRIPE_SLOTS && (best == NULL || p->count < best->count)) {
+            best = p;
+        }
+    }
+    return best;
+}
+
+int stripe_write(struct tm_stripe *st, const unsigned char *frame, size_t len) {
+
+    struct tm_port *p;
+    int s;
+
+    pthread_mutex_lock(&st->lock);
+    while (st->rc == 0 && (p = pick_port(st)) == NULL) {
+        pthread_cond_wait(&st->wake, &st->lock);
+    }
+    if (st->rc != 0) {
+        pthread_mutex_unlock(&st->lock);
+        return -1;
+    }
+
+    s = (p->head + p->count) % TM_STRIPE_SLOTS;
+    memcpy(p->slot[s], frame, len);
+    p->slot_len[s] = len;
+    p->count++;
+    st->next = (int) (p - st->port + 1) % st->nports;
+    pthread_cond_broadcast(&st->wake);
+    pthread_mutex_unlock(&st->lock);
+
+    return 0;
+}
+
+int stripe_drain(struct tm_stripe *st) {
+
+    struct timespec t0;
+    int i, busy, rc;
+
+    pthread_mutex_lock(&st->lock);
+    do {
+        busy = 0;
+        for (i = 0; i < st->nports; i++) {
+            busy |= st->port[i].count;
+        }
+        if (busy && st->rc == 0) {
+            pthread_cond_wait(&st->wake, &st->lock);
+        }
+    } while (busy && st->rc == 0);
+    rc = st->rc;
+    pthread_mutex_unlock(&st->lock);
+    if (rc < 0) {
+        return rc;
+    }
+
+    /*Every port's transmitter empties in parallel, so this waits for the slowest*/
+    stats_now(&t0);
+    for (i = 0; i < st->nports; i++) {
+        rc = link_drain(st->port[i].fd, st->port[i].flow);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+    if (st->stats != NULL) {
+        stats_drain(st->stats, stats_usec_since(&t0));
+    }
+
+    return 0;
+}
@@ -0,0 +1,77 @@
+/********************************************************************************
+ * MOSES telemetry downlink striping across several SyncLink ports
+ *
+ * A GT2 or GT4 adapter, or several single-port adapters, give as many links
+ * as ports. With a stripe set the framer no longer writes frames itself: each
+ * frame is copied into a free slot of the port with the fewest frames waiting
+ * (round robin between equals) and that port's writer thread writes it to its
+ * device, paced by the port's own flow control. A faster port drains its
+ * slots sooner and so takes a larger share, and aggregate throughput is the
+ * sum of the port rates.
+ *
+ * Frames of a file then reach the ground out of order across the links. The
+ * ground side already places each frame by file ID, sequence number and
+ * offset, so it only has to merge the received streams, and must not take
+ * the TM_HDR_LAST frame as meaning every earlier frame is in.
+ *
+ ******************************************************************************/
+
+#ifndef STRIPE_H
+#define STRIPE_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "stats.h"
+#include "flow.h"
+#include "link.h"
+
+/*Ports of the largest adapter, a SyncLink GT4*/
+#define TM_MAX_PORTS 4
+
+/*Frames each port can have waiting for its writer thread*/
+#define TM_STRIPE_SLOTS 2
+
+struct tm_port {
+    int fd;                     //configured SyncLink device
+    struct tm_flow *flow;       //paces this port's writes, or NULL
+    struct tm_link *link;       //signal state of this port, or NULL
+    unsigned char *slot[TM_STRIPE_SLOTS];
+    size_t slot_len[TM_STRIPE_SLOTS];
+    int head;                   //oldest waiting frame
+    int count;                  //frames waiting, including the one being written
+    unsigned long frames;       //frames written to this port
+    pthread_t thread;
+    struct tm_stripe *stripe;
+};
+
+struct tm_stripe {
+    int nports;
+    struct tm_port port[TM_MAX_PORTS];
+    int next;                   //where the round robin between equally loaded ports resumes
+    int stop;
+    int rc;                     //first write error of any port
+    struct tm_stats *stats;     //write() and tcdrain() timings, if set
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        //frame queued, frame written, error or stop
+};
+
+/*Start a writer thread for each of nports devices. flows and links may be NULL, or
+ *hold an entry (or NULL) per port. max_len is the largest frame, header included*/
+int stripe_start(struct tm_stripe *st, int nports, const int *fds, struct tm_flow **flows,
+        struct tm_link **links, size_t max_len, struct tm_stats *stats);
+
+/*Run every writer thread under SCHED_FIFO at priority, see rt.h*/
+void stripe_set_priority(struct tm_stripe *st, int priority);
+
+/*Write the remaining frames and stop the writer threads*/
+void stripe_stop(struct tm_stripe *st);
+
+/*Queue a frame on the least loaded port, waiting for a free slot. Returns -1 once
+ *any port has failed*/
+int stripe_write(struct tm_stripe *st, const unsigned char *frame, size_t len);
+
+/*Block until every queued frame is on the wire on every port*/
+int stripe_drain(struct tm_stripe *st);
+
+#endif /* STRIPE_H */
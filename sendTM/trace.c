@@ -0,0 +1,299 @@
+/********************************************************************************
+ * MOSES telemetry downlink trace recorder
+ *
+ * See trace.h. A slot's stamp works like a sequence lock: the writer clears
+ * it, fills in the event, then sets it to the event's index plus one, and the
+ * flusher only keeps an event whose stamp reads the same before and after it
+ * is copied out.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define TRACE_MASK (TM_TRACE_EVENTS - 1)
+
+/*Records packed per write() to the trace file*/
+#define TRACE_BATCH 256
+
+static const char *names[TM_TRACE_TYPES] = {
+    "?", "START", "LOST", "OPEN", "READ", "QUEUED", "WRITE", "DRAIN", "UNDERRUN", "DONE",
+    "READER_WAIT", "TX_WAIT"
+};
+
+static unsigned long long now_ns(clockid_t clock) {
+
+    struct timespec t;
+
+    clock_gettime(clock, &t);
+    return (unsigned long long) t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void put_le(unsigned char *p, unsigned long long v, int n) {
+
+    int i;
+
+    for (i = 0; i < n; i++) {
+        p[i] = (unsigned char) (v >> (8 * i));
+    }
+}
+
+static unsigned long long get_le(const unsigned char *p, int n) {
+
+    unsigned long long v = 0;
+    int i;
+
+    for (i = n - 1; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static void pack(const struct tm_trace_rec *rec, unsigned char *buf) {
+
+    put_le(buf, rec->ns, 8);
+    put_le(buf + 8, rec->type, 2);
+    put_le(buf + 10, rec->cls, 2);
+    put_le(buf + 12, rec->id, 4);
+    put_le(buf + 16, rec->a, 8);
+    put_le(buf + 24, rec->b, 8);
+}
+
+void trace_unpack(struct tm_trace_rec *rec, const unsigned char *buf) {
+
+    rec->ns = get_le(buf, 8);
+    rec->type = (unsigned short) get_le(buf + 8, 2);
+    rec->cls = (unsigned short) get_le(buf + 10, 2);
+    rec->id = (unsigned int) get_le(buf + 12, 4);
+    rec->a = get_le(buf + 16, 8);
+    rec->b = get_le(buf + 24, 8);
+}
+
+const char *trace_name(int type) {
+
+    return (type > 0 && type < TM_TRACE_TYPES) ? names[type] : names[0];
+}
+
+void trace_event(struct tm_trace *tr, int type, int cls, unsigned long id,
+        unsigned long long a, unsigned long long b) {
+
+    struct tm_trace_slot *s;
+    unsigned long long i;
+
+    if (tr == NULL) {
+        return;
+    }
+
+    i = __atomic_fetch_add(&tr->head, 1, __ATOMIC_RELAXED);
+    s = &tr->slots[i & TRACE_MASK];
+
+    /*Cleared before a single field changes, in case the flusher is copying it*/
+    __atomic_store_n(&s->stamp, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    s->rec.ns = now_ns(CLOCK_MONOTONIC);
+    s->rec.type = (unsigned short) type;
+    s->rec.cls = (unsigned short) cls;
+    s->rec.id = (unsigned int) id;
+    s->rec.a = a;
+    s->rec.b = b;
+
+    __atomic_store_n(&s->stamp, i + 1, __ATOMIC_RELEASE);
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len) {
+
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            printf("write(trace) error=%d %s\n", errno, strerror(errno));
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Append every event logged so far, up to the first one still being filled in
+ * unless final. Only the flusher, or trace_close() once it has stopped, calls this.
+ */
+static void flush(struct tm_trace *tr, int final) {
+
+    unsigned char out[TRACE_BATCH * TM_TRACE_REC_SIZE];
+    struct tm_trace_slot *s;
+    struct tm_trace_rec rec;
+    unsigned long long head, i, stamp, lost = 0;
+    int n = 0;
+
+    head = __atomic_load_n(&tr->head, __ATOMIC_ACQUIRE);
+
+    /*Lapped: whatever the ring no longer holds is gone*/
+    if (head - tr->flushed > TM_TRACE_EVENTS) {
+        lost += head - tr->flushed - TM_TRACE_EVENTS;
+        tr->flushed = head - TM_TRACE_EVENTS;
+    }
+
+    for (i = tr->flushed; i < head; i++) {
+        s = &tr->slots[i & TRACE_MASK];
+        stamp = __atomic_load_n(&s->stamp, __ATOMIC_ACQUIRE);
+        if (stamp < i + 1 && !final) {
+            break; //Still being filled in
+        }
+        if (stamp != i + 1) {
+            lost++;
+            continue;
+        }
+
+        rec = s->rec;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->stamp, __ATOMIC_RELAXED) != stamp) {
+            lost++; //Overwritten while being copied
+            continue;
+        }
+
+        pack(&rec, out + n * TM_TRACE_REC_SIZE);
+        if (++n == TRACE_BATCH) {
+            write_all(tr->fd, out, sizeof (out));
+            n = 0;
+        }
+    }
+    tr->flushed = i;
+
+    if (lost > 0) {
+        tr->lost += lost;
+        memset(&rec, 0, sizeof (rec));
+        rec.ns = now_ns(CLOCK_MONOTONIC);
+        rec.type = TM_TRACE_LOST;
+        rec.a = lost;
+        if (n == TRACE_BATCH) {
+            write_all(tr->fd, out, sizeof (out));
+            n = 0;
+        }
+        pack(&rec, out + n++ * TM_TRACE_REC_SIZE);
+    }
+    if (n > 0) {
+        write_all(tr->fd, out, n * TM_TRACE_REC_SIZE);
+    }
+}
+
+int trace_open(struct tm_trace *tr, const char *path) {
+
+    unsigned char buf[TM_TRACE_REC_SIZE];
+    struct tm_trace_rec rec;
+    struct stat st;
+
+    memset(tr, 0, sizeof (*tr));
+    tr->fd = -1;
+
+    tr->slots = calloc(TM_TRACE_EVENTS, sizeof (*tr->slots));
+    if (tr->slots == NULL) {
+        printf("Unable to allocate %d trace events\n", TM_TRACE_EVENTS);
+        return -1;
+    }
+
+    tr->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (tr->fd < 0) {
+        printf("open(%s) error=%d %s\n", path, errno, strerror(errno));
+        free(tr->slots);
+        return -1;
+    }
+    if (fstat(tr->fd, &st) == 0 && st.st_size == 0
+            && write_all(tr->fd, (const unsigned char *) TM_TRACE_MAGIC, TM_TRACE_MAGIC_SIZE) < 0) {
+        close(tr->fd);
+        free(tr->slots);
+        return -1;
+    }
+
+    /* Ties this run's monotonic times to the wall clock. Written straight out, since
+     * the decoder needs it to make sense of anything after it.
+     */
+    memset(&rec, 0, sizeof (rec));
+    rec.ns = now_ns(CLOCK_MONOTONIC);
+    rec.type = TM_TRACE_START;
+    rec.a = now_ns(CLOCK_REALTIME);
+    rec.b = TM_TRACE_EVENTS;
+    pack(&rec, buf);
+    if (write_all(tr->fd, buf, sizeof (buf)) < 0) {
+        close(tr->fd);
+        free(tr->slots);
+        return -1;
+    }
+
+    pthread_mutex_init(&tr->lock, NULL);
+    pthread_cond_init(&tr->wake, NULL);
+    return 0;
+}
+
+static void *trace_thread(void *arg) {
+
+    struct tm_trace *tr = arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&tr->lock);
+    while (tr->running) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += TM_TRACE_FLUSH_MS % 1000 * 1000000L;
+        deadline.tv_sec += TM_TRACE_FLUSH_MS / 1000 + deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        if (pthread_cond_timedwait(&tr->wake, &tr->lock, &deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&tr->lock);
+            flush(tr, 0);
+            pthread_mutex_lock(&tr->lock);
+        }
+    }
+    pthread_mutex_unlock(&tr->lock);
+
+    return NULL;
+}
+
+int trace_start(struct tm_trace *tr) {
+
+    int rc;
+
+    tr->running = 1;
+    rc = pthread_create(&tr->thread, NULL, trace_thread, tr);
+    if (rc != 0) {
+        printf("pthread_create(trace) error=%d %s\n", rc, strerror(rc));
+        tr->running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void trace_close(struct tm_trace *tr) {
+
+    int was_running;
+
+    pthread_mutex_lock(&tr->lock);
+    was_running = tr->running;
+    tr->running = 0;
+    pthread_cond_signal(&tr->wake);
+    pthread_mutex_unlock(&tr->lock);
+
+    if (was_running) {
+        pthread_join(tr->thread, NULL);
+    }
+
+    flush(tr, 1);
+    if (tr->lost > 0) {
+        printf("Trace lost %llu events\n", tr->lost);
+    }
+    close(tr->fd);
+    free(tr->slots);
+    pthread_mutex_destroy(&tr->lock);
+    pthread_cond_destroy(&tr->wake);
+}
@@ -0,0 +1,115 @@
+/********************************************************************************
+ * MOSES telemetry downlink trace recorder
+ *
+ * A flight record of what each pipeline stage did and when, so a run's
+ * timeline can be rebuilt afterwards and the stage that held back the link
+ * found. Every stage logs fixed-size binary events into one ring in memory:
+ * a file opened, a chunk read and queued for the transmitter, a frame
+ * written, the driver drained, an underrun, a file completed, and each time
+ * the reader or transmit thread had to wait for the other.
+ *
+ * Logging an event takes a slot with one atomic add and fills it in place,
+ * with no lock, allocation or formatting, so it costs next to nothing on the
+ * transmit path and no thread ever waits for another to log. A flusher thread
+ * appends whatever is new to the trace file every TM_TRACE_FLUSH_MS. Should
+ * the stages ever get more than TM_TRACE_EVENTS ahead of it, the oldest
+ * events are overwritten and a TM_TRACE_LOST event in the file says how many.
+ *
+ * The file starts with TM_TRACE_MAGIC, then holds TM_TRACE_REC_SIZE byte
+ * records, little-endian:
+ *
+ *   bytes  0-7   ns    CLOCK_MONOTONIC time of the event
+ *   bytes  8-9   type  TM_TRACE_*
+ *   bytes 10-11  cls   priority class, 0 for driver and wait events
+ *   bytes 12-15  id    file ID, or 0
+ *   bytes 16-23  a     and
+ *   bytes 24-31  b     as each type below says
+ *
+ * Runs append to the same file, each opening with a TM_TRACE_START event.
+ * traceTM decodes it on the ground.
+ *
+ ******************************************************************************/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <pthread.h>
+
+/*Default trace file*/
+#define TM_TRACE_FILE "/tmp/sendTM.trace"
+
+/*Events the ring holds, a power of two. Well over a second of frames at any rate*/
+#define TM_TRACE_EVENTS 16384
+
+/*Between appends to the trace file*/
+#define TM_TRACE_FLUSH_MS 1000
+
+/*Start of the trace file, and the size of each record after it*/
+#define TM_TRACE_MAGIC "MOSESTR1"
+#define TM_TRACE_MAGIC_SIZE 8
+#define TM_TRACE_REC_SIZE 32
+
+/*Event types                       a                       b*/
+#define TM_TRACE_START 1        //CLOCK_REALTIME ns       TM_TRACE_EVENTS
+#define TM_TRACE_LOST 2         //events overwritten      0
+#define TM_TRACE_OPEN 3         //bytes to send           us to open
+#define TM_TRACE_READ 4         //bytes read              us to read
+#define TM_TRACE_QUEUED 5       //bytes queued            file offset
+#define TM_TRACE_WRITE 6        //frame bytes             us in write()
+#define TM_TRACE_DRAIN 7        //0                       us in tcdrain()
+#define TM_TRACE_UNDERRUN 8     //new underruns           queue depth now
+#define TM_TRACE_DONE 9         //file bytes              us since it started
+#define TM_TRACE_READER_WAIT 10 //us waited               nonzero if for room
+#define TM_TRACE_TX_WAIT 11     //us waited               0
+#define TM_TRACE_TYPES 12
+
+struct tm_trace_rec {
+    unsigned long long ns;
+    unsigned short type;
+    unsigned short cls;
+    unsigned int id;
+    unsigned long long a;
+    unsigned long long b;
+};
+
+/*A ring slot. stamp is one past the event's index once it is filled in, 0 meanwhile*/
+struct tm_trace_slot {
+    unsigned long long stamp;
+    struct tm_trace_rec rec;
+};
+
+struct tm_trace {
+    struct tm_trace_slot *slots; //TM_TRACE_EVENTS of them
+    unsigned long long head;    //events logged, the next slot's index
+    unsigned long long flushed; //events written out or lost
+    unsigned long long lost;
+    int fd;                     //trace file
+
+    /*Flusher*/
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int running;
+    pthread_t thread;
+};
+
+/*Open path for appending and write this run's TM_TRACE_START. Returns 0 or -1*/
+int trace_open(struct tm_trace *tr, const char *path);
+
+/*Append events every TM_TRACE_FLUSH_MS from a thread of its own*/
+int trace_start(struct tm_trace *tr);
+
+/*Stop the flusher, append everything still in the ring and close the file. Every
+ *thread logging to tr must have finished*/
+void trace_close(struct tm_trace *tr);
+
+/*Log one event. Any thread may log at any time, and with tr NULL nothing is logged*/
+void trace_event(struct tm_trace *tr, int type, int cls, unsigned long id,
+        unsigned long long a, unsigned long long b);
+
+/*Decode the record at buf*/
+void trace_unpack(struct tm_trace_rec *rec, const unsigned char *buf);
+
+/*Name of a TM_TRACE_* type, "?" if unknown*/
+const char *trace_name(int type);
+
+#endif /* TRACE_H */
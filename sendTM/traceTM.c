@@ -0,0 +1,235 @@
+/********************************************************************************
+ * MOSES telemetry trace decoder
+ *
+ * Prints a trace file written by sendTM (see trace.h) as a timeline, one line
+ * per event with its time in seconds since the start of its run:
+ *
+ *   <secs> <type> cls=<n> id=<file_id> <field>=<n> <field>=<n>
+ *
+ * and after each run a summary of where the time went:
+ *
+ *   RUN <n> start=<UTC date and time> secs=<s> events=<n> lost=<n>
+ *   SUMMARY files=<n> bytes=<n> rate_bps=<n> frames=<n> underruns=<n>
+ *           read_us=<n> blocked_us=<n> write_us=<n> drain_us=<n>
+ *           starved_us=<n> limit=<stage>
+ *
+ * read_us is the reader's time opening files and loading chunks, blocked_us
+ * the time it had files to load but no room for them, and starved_us the
+ * time the transmit thread sat waiting for data while a file was still on
+ * its way. limit names the stage that held back the link: reader, when the
+ * transmitter was starved for longer than the reader was blocked, link in the
+ * opposite case, or none when there was never anything queued.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "trace.h"
+
+#define TRACE_OPTIONS "q"
+
+/*Names of the a and b fields of each type, NULL if the field means nothing*/
+static const char *fields[TM_TRACE_TYPES][2] = {
+    {"a", "b"},
+    {"wall_ns", "events"},
+    {"events", NULL},
+    {"bytes", "us"},
+    {"bytes", "us"},
+    {"bytes", "offset"},
+    {"bytes", "us"},
+    {NULL, "us"},
+    {"count", "depth"},
+    {"bytes", "us"},
+    {"us", "for_room"},
+    {"us", NULL}
+};
+
+/*What one run added up to*/
+struct run {
+    int n;
+    unsigned long long start_ns; //CLOCK_MONOTONIC at TM_TRACE_START
+    unsigned long long wall_ns;
+    unsigned long long last_ns;
+    unsigned long long events, lost;
+    unsigned long opened, done;
+    unsigned long long bytes;
+    unsigned long long frames, underruns;
+    unsigned long long read_us, blocked_us, write_us, drain_us, starved_us;
+    unsigned long long busy_since; //when the transmitter last had a file in flight
+};
+
+void display_usage(void) {
+    printf("Usage: traceTM [-q] [trace]\n"
+            "trace = trace file written by sendTM (default " TM_TRACE_FILE ")\n"
+            "-q    = print only the summary of each run\n");
+}
+
+static void print_event(const struct run *r, const struct tm_trace_rec *rec) {
+
+    int type = (rec->type < TM_TRACE_TYPES) ? rec->type : 0;
+
+    printf("%12.6f %s cls=%u id=%u", (double) (rec->ns - r->start_ns) / 1e9,
+            trace_name(rec->type), rec->cls, rec->id);
+    if (fields[type][0] != NULL) {
+        printf(" %s=%llu", fields[type][0], rec->a);
+    }
+    if (fields[type][1] != NULL) {
+        printf(" %s=%llu", fields[type][1], rec->b);
+    }
+    printf("\n");
+}
+
+static void print_summary(const struct run *r) {
+
+    char date[32];
+    struct tm tm;
+    time_t wall = (time_t) (r->wall_ns / 1000000000ULL);
+    double secs = (double) (r->last_ns - r->start_ns) / 1e9;
+    const char *limit = "none";
+
+    gmtime_r(&wall, &tm);
+    strftime(date, sizeof (date), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    if (r->starved_us > r->blocked_us) {
+        limit = "reader";
+    } else if (r->blocked_us > 0 || r->frames > 0) {
+        limit = "link";
+    }
+
+    printf("RUN %d start=%s secs=%.3f events=%llu lost=%llu\n", r->n, date, secs, r->events,
+            r->lost);
+    printf("SUMMARY files=%lu bytes=%llu rate_bps=%llu frames=%llu underruns=%llu "
+            "read_us=%llu blocked_us=%llu write_us=%llu drain_us=%llu starved_us=%llu "
+            "limit=%s\n", r->done, r->bytes,
+            secs > 0 ? (unsigned long long) (r->bytes * 8 / secs) : 0ULL, r->frames,
+            r->underruns, r->read_us, r->blocked_us, r->write_us, r->drain_us, r->starved_us,
+            limit);
+}
+
+/*Add one event to the run it belongs to*/
+static void add_event(struct run *r, const struct tm_trace_rec *rec) {
+
+    unsigned long long waited, since;
+
+    r->events++;
+    r->last_ns = rec->ns;
+
+    switch (rec->type) {
+        case TM_TRACE_LOST:
+            r->lost += rec->a;
+            break;
+        case TM_TRACE_OPEN:
+            if (r->opened++ == r->done) {
+                r->busy_since = rec->ns;
+            }
+            r->read_us += rec->b;
+            break;
+        case TM_TRACE_READ:
+            r->read_us += rec->b;
+            break;
+        case TM_TRACE_WRITE:
+            r->frames++;
+            r->write_us += rec->b;
+            break;
+        case TM_TRACE_DRAIN:
+            r->drain_us += rec->b;
+            break;
+        case TM_TRACE_UNDERRUN:
+            r->underruns += rec->a;
+            break;
+        case TM_TRACE_DONE:
+            if (r->done < r->opened) {
+                r->done++;
+            }
+            r->bytes += rec->a;
+            break;
+        case TM_TRACE_READER_WAIT:
+            if (rec->b != 0) {
+                r->blocked_us += rec->a;
+            }
+            break;
+        case TM_TRACE_TX_WAIT:
+
+            /*Only the part of the wait after a file was under way*/
+            if (r->opened > r->done) {
+                waited = rec->a;
+                since = (rec->ns - r->busy_since) / 1000;
+                r->starved_us += (waited < since) ? waited : since;
+            }
+            break;
+    }
+}
+
+int main(int argc, char **argv) {
+
+    unsigned char buf[TM_TRACE_REC_SIZE];
+    struct tm_trace_rec rec;
+    struct run r;
+    const char *name = TM_TRACE_FILE;
+    int quiet = 0;
+    int opt, n;
+    FILE *fp;
+
+    while ((opt = getopt(argc, argv, TRACE_OPTIONS)) != -1) {
+        if (opt == 'q') {
+            quiet = 1;
+        } else {
+            display_usage();
+            return 1;
+        }
+    }
+    if (argc - optind > 1) {
+        display_usage();
+        return 1;
+    }
+    if (optind < argc) {
+        name = argv[optind];
+    }
+
+    fp = fopen(name, "r");
+    if (fp == NULL) {
+        printf("fopen(%s) error=%d %s\n", name, errno, strerror(errno));
+        return 1;
+    }
+    if (fread(buf, 1, TM_TRACE_MAGIC_SIZE, fp) != TM_TRACE_MAGIC_SIZE
+            || memcmp(buf, TM_TRACE_MAGIC, TM_TRACE_MAGIC_SIZE) != 0) {
+        printf("%s is not a sendTM trace\n", name);
+        fclose(fp);
+        return 1;
+    }
+
+    memset(&r, 0, sizeof (r));
+    while (fread(buf, 1, TM_TRACE_REC_SIZE, fp) == TM_TRACE_REC_SIZE) {
+        trace_unpack(&rec, buf);
+
+        /*Each run starts with its own clock*/
+        if (rec.type == TM_TRACE_START) {
+            if (r.n > 0) {
+                print_summary(&r);
+            }
+            n = r.n;
+            memset(&r, 0, sizeof (r));
+            r.n = n + 1;
+            r.start_ns = rec.ns;
+            r.wall_ns = rec.a;
+        }
+        if (r.n == 0) {
+            continue; //Nothing to time it by
+        }
+        add_event(&r, &rec);
+        if (!quiet) {
+            print_event(&r, &rec);
+        }
+    }
+    if (r.n > 0) {
+        print_summary(&r);
+    }
+
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,251 @@
+/********************************************************************************
+ * MOSES telemetry downlink queue intake
+ *
+ * See watch.h.
+ *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+
+#include "watch.h"
+
+#define EVENT_BUF_SIZE (16 * (sizeof (struct inotify_event) + NAME_MAX + 1))
+
+/*Queue a file with its current length*/
+static void push_path(struct tm_watch *w, const char *path) {
+
+    struct stat st;
+
+    if (stat(path, &st) < 0) {
+        printf("stat(%s) error=%d %s\n", path, errno, strerror(errno));
+        return;
+    }
+
+    if (!S_ISREG(st.st_mode)) {
+        printf("Not queuing %s, not a regular file\n", path);
+        return;
+    }
+
+    if (queue_push(w->queue, path, TM_FILE_WHOLE, sched_classify(path), sched_file_flags(path)) < 0) {
+        printf("Unable to queue %s\n", path);
+        return;
+    }
+
+    printf("Queued %s (%d Bytes)\n", path, (int) st.st_size);
+}
+
+/*Queue every file the camera writer has finished with*/
+static void read_inotify(struct tm_watch *w) {
+
+    char buf[EVENT_BUF_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char path[PATH_MAX];
+    struct inotify_event *ev;
+    ssize_t len;
+    char *p;
+
+    len = read(w->inotify_fd, buf, sizeof (buf));
+    if (len <= 0) {
+        return;
+    }
+
+    for (p = buf; p < buf + len; p += sizeof (struct inotify_event) + ev->len) {
+        ev = (struct inotify_event *) p;
+
+        /*Skip directories and hidden files such as editor or rsync temporaries*/
+        if (ev->len == 0 || (ev->mask & IN_ISDIR) || ev->name[0] == '.') {
+            continue;
+        }
+
+        snprintf(path, sizeof (path), "%s/%s", w->dir, ev->name);
+        push_path(w, path);
+    }
+}
+
+/*Queue each complete line written to the FIFO as a pathname, or run it as a command*/
+static void read_fifo(struct tm_watch *w, char *line, size_t *used) {
+
+    ssize_t len;
+    char *start, *nl;
+
+    len = read(w->fifo_fd, line + *used, PATH_MAX - 1 - *used);
+    if (len <= 0) {
+        return;
+    }
+    *used += len;
+    line[*used] = '\0';
+
+    start = line;
+    while ((nl = strchr(start, '\n')) != NULL) {
+        *nl = '\0';
+        if (*start == TM_WATCH_COMMAND) {
+            if (w->command == NULL || w->command(start + 1, w->command_arg) < 0) {
+                printf("Unknown command %s\n", start);
+            }
+        } else if (*start != '\0') {
+            push_path(w, start);
+        }
+        start = nl + 1;
+    }
+
+    /*Keep a partial line for the next read, drop one that can never fit*/
+    *used = strlen(start);
+    if (*used == PATH_MAX - 1) {
+        printf("Discarding over-long pathname from FIFO\n");
+        *used = 0;
+    }
+    memmove(line, start, *used);
+}
+
+static void *watch_thread(void *arg) {
+
+    struct tm_watch *w = arg;
+    struct pollfd fds[3];
+    char line[PATH_MAX];
+    size_t used = 0;
+    int nfds, rc;
+
+    for (;;) {
+        nfds = 0;
+        fds[nfds].fd = w->signal_fd;
+        fds[nfds++].events = POLLIN;
+        if (w->inotify_fd >= 0) {
+            fds[nfds].fd = w->inotify_fd;
+            fds[nfds++].events = POLLIN;
+        }
+        if (w->fifo_fd >= 0) {
+            fds[nfds].fd = w->fifo_fd;
+            fds[nfds++].events = POLLIN;
+        }
+
+        rc = poll(fds, nfds, -1);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("poll error=%d %s\n", errno, strerror(errno));
+            break;
+        }
+
+        if (fds[0].revents & POLLIN) { //SIGINT, SIGTERM or watch_stop()
+            break;
+        }
+
+        for (rc = 1; rc < nfds; rc++) {
+            if (!(fds[rc].revents & POLLIN)) {
+                continue;
+            }
+            if (fds[rc].fd == w->inotify_fd) {
+                read_inotify(w);
+            } else {
+                read_fifo(w, line, &used);
+            }
+        }
+    }
+
+    printf("Closing downlink queue\n");
+    queue_close(w->queue);
+    return NULL;
+}
+
+int watch_start(struct tm_watch *w, struct tm_queue *q, const char *dir, const char *fifo,
+        tm_watch_command command, void *arg) {
+
+    sigset_t mask;
+    int rc;
+
+    memset(w, 0, sizeof (*w));
+    w->queue = q;
+    w->command = command;
+    w->command_arg = arg;
+    w->inotify_fd = -1;
+    w->fifo_fd = -1;
+
+    /*Only the intake thread receives shutdown signals, through its signalfd*/
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    w->signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (w->signal_fd < 0) {
+        printf("signalfd error=%d %s\n", errno, strerror(errno));
+        return -1;
+    }
+
+    if (dir != NULL) {
+        w->dir = strdup(dir);
+        w->inotify_fd = inotify_init1(IN_CLOEXEC);
+        if (w->dir == NULL || w->inotify_fd < 0) {
+            printf("inotify_init error=%d %s\n", errno, strerror(errno));
+            goto fail;
+        }
+
+        /*IN_CLOSE_WRITE: the writer is done. IN_MOVED_TO: renamed in when complete*/
+        if (inotify_add_watch(w->inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            printf("inotify_add_watch(%s) error=%d %s\n", dir, errno, strerror(errno));
+            goto fail;
+        }
+        printf("Watching %s for new files\n", dir);
+    }
+
+    if (fifo != NULL) {
+        if (mkfifo(fifo, 0660) < 0 && errno != EEXIST) {
+            printf("mkfifo(%s) error=%d %s\n", fifo, errno, strerror(errno));
+            goto fail;
+        }
+
+        /*Opened read/write so the FIFO never reports EOF when a writer closes it*/
+        w->fifo_fd = open(fifo, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (w->fifo_fd < 0) {
+            printf("open(%s) error=%d %s\n", fifo, errno, strerror(errno));
+            goto fail;
+        }
+        printf("Accepting pathnames on %s\n", fifo);
+    }
+
+    rc = pthread_create(&w->thread, NULL, watch_thread, w);
+    if (rc != 0) {
+        printf("pthread_create(watch) error=%d %s\n", rc, strerror(rc));
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    if (w->inotify_fd >= 0) {
+        close(w->inotify_fd);
+    }
+    if (w->fifo_fd >= 0) {
+        close(w->fifo_fd);
+    }
+    close(w->signal_fd);
+    free(w->dir);
+    return -1;
+}
+
+void watch_stop(struct tm_watch *w) {
+
+    /*Wakes the signalfd if the thread is still polling*/
+    pthread_kill(w->thread, SIGTERM);
+    pthread_join(w->thread, NULL);
+
+    if (w->inotify_fd >= 0) {
+        close(w->inotify_fd);
+    }
+    if (w->fifo_fd >= 0) {
+        close(w->fifo_fd);
+    }
+    close(w->signal_fd);
+    free(w->dir);
+}
@@ -0,0 +1,50 @@
+/********************************************************************************
+ * MOSES telemetry downlink queue intake
+ *
+ * Feeds the downlink queue at runtime from two sources: files closed after
+ * writing in (or moved into) a watched output directory, reported by inotify,
+ * and pathnames written one per line to a FIFO by the flight software. Each
+ * file is queued the moment the camera writer closes it. SIGINT and SIGTERM
+ * close the queue, so the downlink stops once the queued files are sent.
+ *
+ * A FIFO line starting with TM_WATCH_COMMAND is a command rather than a
+ * pathname, e.g. "!rate 5000000", and goes to the command handler without
+ * the prefix.
+ *
+ ******************************************************************************/
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <pthread.h>
+
+#include "queue.h"
+
+/*Marks a FIFO line as a command*/
+#define TM_WATCH_COMMAND '!'
+
+/*Handles one command line, returning 0 or -1 if it is not understood*/
+typedef int (*tm_watch_command)(const char *cmd, void *arg);
+
+struct tm_watch {
+    struct tm_queue *queue;
+    char *dir;                  //watched directory, or NULL
+    int inotify_fd;
+    int fifo_fd;                //pathname FIFO, or -1
+    int signal_fd;
+    tm_watch_command command;   //or NULL to take no commands
+    void *command_arg;
+    pthread_t thread;
+};
+
+/* Start the intake thread. dir, fifo and command may each be NULL. Must be called before
+ * any other thread is created, since it blocks SIGINT and SIGTERM for the whole
+ * process so only the intake thread sees them.
+ */
+int watch_start(struct tm_watch *w, struct tm_queue *q, const char *dir, const char *fifo,
+        tm_watch_command command, void *arg);
+
+/*Close the queue, stop the intake thread and release its descriptors*/
+void watch_stop(struct tm_watch *w);
+
+#endif /* WATCH_H */